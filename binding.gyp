@@ -44,9 +44,15 @@
       'sources': [
         "src/json_proj_transform_grammar.cpp",
         "src/mapnik_logger.cpp",
+        "src/mapnik_thread_pool.cpp",
         "src/node_mapnik.cpp",
         "src/blend.cpp",
         "src/mapnik_map.cpp",
+        "src/mapnik_map_pool.cpp",
+        "src/mapnik_cancel_token.cpp",
+        "src/mapnik_stylesheet_cache.cpp",
+        "src/mapnik_projection_cache.cpp",
+        "src/mapnik_feature_cache.cpp",
         "src/mapnik_color.cpp",
         "src/mapnik_geometry.cpp",
         "src/mapnik_feature.cpp",
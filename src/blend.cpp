@@ -21,6 +21,8 @@
 #include "mapnik_palette.hpp"
 #include "blend.hpp"
 #include "tint.hpp"
+#include "mapnik_thread_pool.hpp"
+#include "utils.hpp"
 
 #include <sstream>
 #include <cstring>
@@ -296,8 +298,19 @@ static void Blend_Encode(mapnik::image_data_rgba8 const& image, BlendBaton* bato
     }
 }
 
-void Work_Blend(uv_work_t* req) {
-    BlendBaton* baton = static_cast<BlendBaton*>(req->data);
+static bool Blend_Cancelled(BlendBaton* baton) {
+    try {
+        baton->cancel.check();
+    } catch (std::exception const& ex) {
+        baton->message = ex.what();
+        return true;
+    }
+    return false;
+}
+
+static void Blend_Images(BlendBaton* baton) {
+    // Drop blends that were cancelled or timed out while queued.
+    if (Blend_Cancelled(baton)) return;
 
     int total = baton->images.size();
     bool alpha = true;
@@ -310,6 +323,7 @@ void Work_Blend(uv_work_t* req) {
     for (int index = total - 1; rit != rend; rit++, index--) {
         // If an image that is higher than the current is opaque, stop alltogether.
         if (!alpha) break;
+        if (Blend_Cancelled(baton)) return;
 
         BImage *image = &**rit;
         MAPNIK_UNIQUE_PTR<mapnik::image_reader> image_reader;
@@ -402,9 +416,20 @@ void Work_Blend(uv_work_t* req) {
             Blend_Composite(target.getData(), baton, &*image_ptr);
         }
     }
+    if (Blend_Cancelled(baton)) return;
     Blend_Encode(target, baton, alpha);
 }
 
+void Work_Blend(uv_work_t* req) {
+    BlendBaton* baton = static_cast<BlendBaton*>(req->data);
+    Blend_Images(baton);
+    // Copy the encoded bytes out of the stream here rather than on the
+    // main thread, which then hands them to the Buffer as they are.
+    if (!baton->message.length()) {
+        baton->result = baton->stream.str();
+    }
+}
+
 void Work_AfterBlend(uv_work_t* req) {
     NanScope();
     BlendBaton* baton = static_cast<BlendBaton*>(req->data);
@@ -417,10 +442,9 @@ void Work_AfterBlend(uv_work_t* req) {
             warnings->Set(i, NanNew((*pos).c_str()));
         }
 
-        std::string result = baton->stream.str();
         Local<Value> argv[] = {
             NanNull(),
-            NanNewBufferHandle((char *)result.data(), result.length()),
+            string_to_buffer(baton->result),
             warnings
         };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(baton->callback), 3, argv);
@@ -557,6 +581,10 @@ NAN_METHOD(Blend) {
             NanThrowTypeError(msg.str().c_str());
             NanReturnUndefined();
         }
+
+        if (!parse_cancel_options(options, baton->cancel)) {
+            NanReturnUndefined();
+        }
     }
 
     Local<Array> js_images = Local<Array>::Cast(args[0]);
@@ -642,7 +670,7 @@ NAN_METHOD(Blend) {
         baton->images.push_back(image);
     }
 
-    uv_queue_work(uv_default_loop(), &(baton.release())->request, Work_Blend, (uv_after_work_cb)Work_AfterBlend);
+    queue_work(&(baton.release())->request, Work_Blend, Work_AfterBlend);
 
     NanReturnUndefined();
 }
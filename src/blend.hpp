@@ -12,6 +12,7 @@
 #include <vector>
 #include "mapnik_palette.hpp"
 #include "tint.hpp"
+#include "mapnik_cancel_token.hpp"
 
 #include "mapnik3x_compatibility.hpp"
 #include MAPNIK_SHARED_INCLUDE
@@ -79,7 +80,9 @@ struct BlendBaton {
     int compression;
     AlphaMode mode;
     EncoderType encoder;
+    render_cancel cancel;
     std::ostringstream stream;
+    std::string result;
 
     BlendBaton() :
         quality(0),
@@ -91,7 +94,9 @@ struct BlendBaton {
         compression(-1),
         mode(BLEND_MODE_HEXTREE),
         encoder(BLEND_ENCODER_LIBPNG),
-        stream(std::ios::out | std::ios::binary)
+        cancel(),
+        stream(std::ios::out | std::ios::binary),
+        result()
     {
         this->request.data = this;
     }
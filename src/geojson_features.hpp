@@ -0,0 +1,186 @@
+#ifndef __NODE_MAPNIK_GEOJSON_FEATURES_H__
+#define __NODE_MAPNIK_GEOJSON_FEATURES_H__
+
+// mapnik
+#include <mapnik/feature.hpp>           // for feature_ptr, context_ptr
+#include <mapnik/feature_factory.hpp>   // for feature_factory
+#include <mapnik/json/feature_parser.hpp>  // for from_geojson
+
+// stl
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace node_mapnik {
+
+namespace detail {
+
+inline const char * skip_space(const char * p, const char * end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    {
+        ++p;
+    }
+    return p;
+}
+
+// Returns the position just past the JSON value starting at `p`. Only
+// nesting and strings are tracked; the values themselves are validated by
+// the feature parser.
+inline const char * skip_value(const char * p, const char * end)
+{
+    int depth = 0;
+    bool in_string = false;
+    for (; p < end; ++p)
+    {
+        char c = *p;
+        if (in_string)
+        {
+            if (c == '\\') ++p;
+            else if (c == '"')
+            {
+                in_string = false;
+                if (depth == 0) return p + 1;
+            }
+            continue;
+        }
+        if (c == '"') in_string = true;
+        else if (c == '{' || c == '[') ++depth;
+        else if (c == '}' || c == ']')
+        {
+            if (depth == 0) return p;
+            if (--depth == 0) return p + 1;
+        }
+        else if (depth == 0 && (c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r'))
+        {
+            return p;
+        }
+    }
+    if (depth != 0 || in_string)
+    {
+        throw std::runtime_error("unexpected end of GeoJSON");
+    }
+    return p;
+}
+
+typedef std::pair<const char *, const char *> json_span;
+
+// Finds the members of the top level "features" array of a FeatureCollection
+// and the top level "type". Returns false if there is no "features" array.
+inline bool split_feature_collection(const char * p, const char * end,
+                                     std::vector<json_span> & features,
+                                     std::string & type)
+{
+    bool found = false;
+    p = skip_space(p, end);
+    if (p == end || *p != '{')
+    {
+        throw std::runtime_error("GeoJSON must be an object");
+    }
+    p = skip_space(p + 1, end);
+    while (p < end && *p != '}')
+    {
+        const char * key_end = skip_value(p, end);
+        bool is_features = (key_end - p == 10 && std::strncmp(p, "\"features\"", 10) == 0);
+        bool is_type = (key_end - p == 6 && std::strncmp(p, "\"type\"", 6) == 0);
+        p = skip_space(key_end, end);
+        if (p == end || *p != ':')
+        {
+            throw std::runtime_error("invalid GeoJSON object");
+        }
+        p = skip_space(p + 1, end);
+        if (is_features)
+        {
+            if (p == end || *p != '[')
+            {
+                throw std::runtime_error("GeoJSON 'features' must be an array");
+            }
+            found = true;
+            p = skip_space(p + 1, end);
+            while (p < end && *p != ']')
+            {
+                const char * feature_end = skip_value(p, end);
+                features.push_back(json_span(p, feature_end));
+                p = skip_space(feature_end, end);
+                if (p < end && *p == ',')
+                {
+                    p = skip_space(p + 1, end);
+                }
+            }
+            if (p == end)
+            {
+                throw std::runtime_error("unexpected end of GeoJSON");
+            }
+            ++p;
+        }
+        else
+        {
+            const char * value_end = skip_value(p, end);
+            if (is_type && value_end - p >= 2)
+            {
+                type.assign(p + 1, value_end - 1);
+            }
+            p = value_end;
+        }
+        p = skip_space(p, end);
+        if (p < end && *p == ',')
+        {
+            p = skip_space(p + 1, end);
+        }
+    }
+    return found;
+}
+
+}
+
+// Parses a GeoJSON FeatureCollection, Feature or bare geometry into
+// features created with `ctx`, numbered from `id` onwards. A FeatureCollection
+// is split natively and each feature goes through mapnik's feature parser, so
+// no datasource plugin is involved. Throws if any feature fails to parse.
+inline void parse_geojson_features(const char * data,
+                                   std::size_t size,
+                                   mapnik::context_ptr const& ctx,
+                                   unsigned & id,
+                                   std::vector<mapnik::feature_ptr> & features)
+{
+    std::vector<detail::json_span> spans;
+    std::string type;
+    std::string wrapped;
+    if (!detail::split_feature_collection(data, data + size, spans, type))
+    {
+        if (type == "Feature")
+        {
+            spans.push_back(detail::json_span(data, data + size));
+        }
+        else
+        {
+            wrapped = "{\"type\":\"Feature\",\"properties\":{},\"geometry\":";
+            wrapped.append(data, size);
+            wrapped += "}";
+            spans.push_back(detail::json_span(wrapped.data(), wrapped.data() + wrapped.size()));
+        }
+    }
+    features.reserve(features.size() + spans.size());
+    for (std::size_t i = 0; i < spans.size(); ++i)
+    {
+        std::string json(spans[i].first, spans[i].second);
+        mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx,id));
+        if (!mapnik::json::from_geojson(json,*feature))
+        {
+            // the index in the GeoJSON, not in `features`, which may
+            // already hold features from earlier calls
+            std::ostringstream s;
+            s << "Failed to parse geojson feature at index " << i;
+            throw std::runtime_error(s.str());
+        }
+        ++id;
+        features.push_back(feature);
+    }
+}
+
+}
+
+#endif
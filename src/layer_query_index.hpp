@@ -0,0 +1,206 @@
+#ifndef __NODE_MAPNIK_LAYER_QUERY_INDEX_H__
+#define __NODE_MAPNIK_LAYER_QUERY_INDEX_H__
+
+// mapnik
+#include <mapnik/box2d.hpp>             // for box2d
+#include <mapnik/coord.hpp>             // for coord2d
+#include <mapnik/datasource.hpp>        // for datasource, featureset_ptr
+#include <mapnik/feature.hpp>           // for feature_ptr
+#include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
+#include <mapnik/query.hpp>             // for query
+
+// boost
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/box.hpp>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/index/rtree.hpp>
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace node_mapnik {
+
+// The features of one vector tile layer, decoded with all of their
+// attributes, and an R-tree over their bounding boxes. Built on the first
+// query against a layer and kept on the tile, so later point queries only
+// look at features near the point.
+class layer_query_index
+{
+public:
+    typedef boost::geometry::model::point<double, 2, boost::geometry::cs::cartesian> point_type;
+    typedef boost::geometry::model::box<point_type> box_type;
+    // the position in entries_ keeps results in layer order
+    typedef std::pair<box_type, std::size_t> value_type;
+    typedef boost::geometry::index::rtree<value_type, boost::geometry::index::rstar<16> > rtree_type;
+
+    // envelopes are kept because computing them walks the geometries'
+    // vertex cursors, which is not safe while other threads read them
+    struct entry
+    {
+        mapnik::feature_ptr feature;
+        mapnik::box2d<double> envelope;
+    };
+
+    explicit layer_query_index(mapnik::datasource const& ds)
+      : entries_(),
+        tree_()
+    {
+        // the buffer around the tile holds features too, so nothing is
+        // filtered by extent here
+        double max = std::numeric_limits<double>::max();
+        mapnik::query q(mapnik::box2d<double>(-max, -max, max, max));
+        mapnik::layer_descriptor ld = ds.get_descriptor();
+        for (auto const& item : ld.get_descriptors())
+        {
+            q.add_property_name(item.get_name());
+        }
+        std::vector<value_type> values;
+        mapnik::featureset_ptr fs = ds.features(q);
+        if (fs)
+        {
+            mapnik::feature_ptr feature;
+            while ((feature = fs->next()))
+            {
+                entry e;
+                e.feature = feature;
+                e.envelope = feature->envelope();
+                mapnik::box2d<double> const& box = e.envelope;
+                values.push_back(value_type(box_type(point_type(box.minx(), box.miny()),
+                                                     point_type(box.maxx(), box.maxy())),
+                                            entries_.size()));
+                entries_.push_back(e);
+            }
+        }
+        // the range constructor packs the tree in one go
+        rtree_type tree(values.begin(), values.end());
+        tree_.swap(tree);
+    }
+
+    // Features whose bounding box intersects `box`, in layer order.
+    std::vector<entry> query(mapnik::box2d<double> const& box) const
+    {
+        std::vector<value_type> hits;
+        tree_.query(boost::geometry::index::intersects(box_type(point_type(box.minx(), box.miny()),
+                                                                point_type(box.maxx(), box.maxy()))),
+                    std::back_inserter(hits));
+        std::vector<std::size_t> ids;
+        ids.reserve(hits.size());
+        for (value_type const& hit : hits)
+        {
+            ids.push_back(hit.second);
+        }
+        std::sort(ids.begin(), ids.end());
+        std::vector<entry> result;
+        result.reserve(ids.size());
+        for (std::size_t id : ids)
+        {
+            result.push_back(entries_[id]);
+        }
+        return result;
+    }
+
+private:
+    std::vector<entry> entries_;
+    rtree_type tree_;
+};
+
+// The points of a queryMany call bucketed into a uniform grid of about one
+// point per cell, so a feature can find the points that fall inside its
+// bounding box without looking at all of them.
+class query_point_grid
+{
+public:
+    explicit query_point_grid(std::vector<mapnik::coord2d> const& points)
+      : points_(points),
+        extent_(),
+        columns_(1),
+        rows_(1),
+        cell_width_(0),
+        cell_height_(0),
+        cells_()
+    {
+        if (points_.empty())
+        {
+            return;
+        }
+        extent_.init(points_[0].x, points_[0].y, points_[0].x, points_[0].y);
+        for (mapnik::coord2d const& pt : points_)
+        {
+            extent_.expand_to_include(pt.x, pt.y);
+        }
+        std::size_t side = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(points_.size()))));
+        if (extent_.width() > 0)
+        {
+            columns_ = side;
+            cell_width_ = extent_.width() / columns_;
+        }
+        if (extent_.height() > 0)
+        {
+            rows_ = side;
+            cell_height_ = extent_.height() / rows_;
+        }
+        cells_.resize(columns_ * rows_);
+        for (std::size_t i = 0; i < points_.size(); ++i)
+        {
+            cells_[row(points_[i].y) * columns_ + column(points_[i].x)].push_back(i);
+        }
+    }
+
+    // Replaces `result` with the indexes of the points inside `box`.
+    void query(mapnik::box2d<double> const& box, std::vector<std::size_t> & result) const
+    {
+        result.clear();
+        if (points_.empty() || !extent_.intersects(box))
+        {
+            return;
+        }
+        std::size_t col0 = column(box.minx());
+        std::size_t col1 = column(box.maxx());
+        std::size_t row0 = row(box.miny());
+        std::size_t row1 = row(box.maxy());
+        for (std::size_t r = row0; r <= row1; ++r)
+        {
+            for (std::size_t c = col0; c <= col1; ++c)
+            {
+                for (std::size_t i : cells_[r * columns_ + c])
+                {
+                    if (box.contains(points_[i].x, points_[i].y))
+                    {
+                        result.push_back(i);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    std::size_t column(double x) const
+    {
+        if (cell_width_ <= 0 || x <= extent_.minx()) return 0;
+        return std::min(columns_ - 1, static_cast<std::size_t>((x - extent_.minx()) / cell_width_));
+    }
+
+    std::size_t row(double y) const
+    {
+        if (cell_height_ <= 0 || y <= extent_.miny()) return 0;
+        return std::min(rows_ - 1, static_cast<std::size_t>((y - extent_.miny()) / cell_height_));
+    }
+
+    std::vector<mapnik::coord2d> const& points_;
+    mapnik::box2d<double> extent_;
+    std::size_t columns_;
+    std::size_t rows_;
+    double cell_width_;
+    double cell_height_;
+    std::vector<std::vector<std::size_t> > cells_;
+};
+
+}
+
+#endif
@@ -94,5 +94,5 @@ NAN_METHOD(CairoSurface::getData)
     NanScope();
     CairoSurface* surface = node::ObjectWrap::Unwrap<CairoSurface>(args.Holder());
     std::string s = surface->ss_.str();
-    NanReturnValue(NanNewBufferHandle((char*)s.data(), s.size()));
+    NanReturnValue(node_mapnik::string_to_buffer(s));
 }
@@ -0,0 +1,94 @@
+#include "mapnik_cancel_token.hpp"
+
+Persistent<FunctionTemplate> CancelToken::constructor;
+
+void CancelToken::Initialize(Handle<Object> target) {
+
+    NanScope();
+
+    Local<FunctionTemplate> lcons = NanNew<FunctionTemplate>(CancelToken::New);
+    lcons->InstanceTemplate()->SetInternalFieldCount(1);
+    lcons->SetClassName(NanNew("CancelToken"));
+
+    NODE_SET_PROTOTYPE_METHOD(lcons, "cancel", cancel);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "cancelled", cancelled);
+
+    target->Set(NanNew("CancelToken"), lcons->GetFunction());
+    NanAssignPersistent(constructor, lcons);
+}
+
+CancelToken::CancelToken() :
+    ObjectWrap(),
+    flag_(std::make_shared<std::atomic<bool> >(false)) {}
+
+CancelToken::~CancelToken()
+{
+}
+
+NAN_METHOD(CancelToken::New)
+{
+    NanScope();
+
+    if (!args.IsConstructCall())
+    {
+        NanThrowError("Cannot call constructor as function, you need to use 'new' keyword");
+        NanReturnUndefined();
+    }
+
+    CancelToken* t = new CancelToken();
+    t->Wrap(args.This());
+    NanReturnValue(args.This());
+}
+
+NAN_METHOD(CancelToken::cancel)
+{
+    NanScope();
+    CancelToken* t = node::ObjectWrap::Unwrap<CancelToken>(args.Holder());
+    t->flag_->store(true);
+    NanReturnUndefined();
+}
+
+NAN_METHOD(CancelToken::cancelled)
+{
+    NanScope();
+    CancelToken* t = node::ObjectWrap::Unwrap<CancelToken>(args.Holder());
+    NanReturnValue(NanNew<Boolean>(t->flag_->load()));
+}
+
+namespace node_mapnik {
+
+bool parse_cancel_options(Local<Object> const& options, render_cancel & cancel)
+{
+    NanScope();
+
+    if (options->Has(NanNew("cancel")))
+    {
+        Local<Value> bind_opt = options->Get(NanNew("cancel"));
+        if (!bind_opt->IsObject())
+        {
+            NanThrowTypeError("optional arg 'cancel' must be a mapnik.CancelToken");
+            return false;
+        }
+        Local<Object> obj = bind_opt->ToObject();
+        if (obj->IsNull() || obj->IsUndefined() || !NanNew(CancelToken::constructor)->HasInstance(obj))
+        {
+            NanThrowTypeError("optional arg 'cancel' must be a mapnik.CancelToken");
+            return false;
+        }
+        cancel.set_flag(node::ObjectWrap::Unwrap<CancelToken>(obj)->get());
+    }
+
+    if (options->Has(NanNew("timeout")))
+    {
+        Local<Value> bind_opt = options->Get(NanNew("timeout"));
+        if (!bind_opt->IsNumber() || bind_opt->IntegerValue() < 0)
+        {
+            NanThrowTypeError("optional arg 'timeout' must be a positive number of milliseconds");
+            return false;
+        }
+        cancel.set_timeout(static_cast<unsigned>(bind_opt->IntegerValue()));
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef __NODE_MAPNIK_CANCEL_TOKEN_H__
+#define __NODE_MAPNIK_CANCEL_TOKEN_H__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <nan.h>
+#pragma GCC diagnostic pop
+
+// stl
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+using namespace v8;
+
+namespace node_mapnik {
+
+typedef std::shared_ptr<std::atomic<bool> > cancel_flag_ptr;
+
+// Copied into a baton on the main thread and polled from the worker:
+// either a CancelToken has been cancelled or the 'timeout' has passed.
+class render_cancel
+{
+public:
+    typedef std::chrono::steady_clock clock_type;
+
+    render_cancel() :
+      flag_(),
+      has_deadline_(false),
+      deadline_() {}
+
+    void set_flag(cancel_flag_ptr const& flag) { flag_ = flag; }
+
+    void set_timeout(unsigned milliseconds)
+    {
+        has_deadline_ = true;
+        deadline_ = clock_type::now() + std::chrono::milliseconds(milliseconds);
+    }
+
+    bool enabled() const { return flag_ || has_deadline_; }
+
+    bool cancelled() const
+    {
+        return (flag_ && flag_->load()) ||
+               (has_deadline_ && clock_type::now() >= deadline_);
+    }
+
+    // throws with a message suitable for the render callback
+    void check() const
+    {
+        if (flag_ && flag_->load())
+        {
+            throw std::runtime_error("render cancelled");
+        }
+        if (has_deadline_ && clock_type::now() >= deadline_)
+        {
+            throw std::runtime_error("render timed out");
+        }
+    }
+
+private:
+    cancel_flag_ptr flag_;
+    bool has_deadline_;
+    clock_type::time_point deadline_;
+};
+
+// reads the 'cancel' and 'timeout' options, throwing a JS TypeError
+// and returning false if either is invalid
+bool parse_cancel_options(Local<Object> const& options, render_cancel & cancel);
+
+}
+
+class CancelToken: public node::ObjectWrap {
+public:
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> target);
+    static NAN_METHOD(New);
+    static NAN_METHOD(cancel);
+    static NAN_METHOD(cancelled);
+
+    CancelToken();
+    inline node_mapnik::cancel_flag_ptr get() { return flag_; }
+
+private:
+    ~CancelToken();
+    node_mapnik::cancel_flag_ptr flag_;
+};
+
+#endif
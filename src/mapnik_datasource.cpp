@@ -3,20 +3,29 @@
 
 #include "mapnik_datasource.hpp"
 #include "mapnik_featureset.hpp"
+#include "mapnik_projection_cache.hpp"
+#include "mapnik_thread_pool.hpp"
 #include "utils.hpp"
 #include "ds_emitter.hpp"
+#include "proj_transform_adapter.hpp"
 
 // mapnik
 #include <mapnik/attribute_descriptor.hpp>  // for attribute_descriptor
 #include <mapnik/box2d.hpp>             // for box2d
 #include <mapnik/datasource.hpp>        // for datasource, datasource_ptr, etc
 #include <mapnik/datasource_cache.hpp>  // for datasource_cache
+#include <mapnik/feature.hpp>           // for feature_impl
 #include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
+#include <mapnik/json/geometry_generator_grammar.hpp>
+#include <mapnik/json/properties_generator_grammar.hpp>
 #include <mapnik/params.hpp>            // for parameters
 #include <mapnik/query.hpp>             // for query
 
 // stl
+#include <deque>
 #include <exception>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 Persistent<FunctionTemplate> Datasource::constructor;
@@ -34,6 +43,7 @@ void Datasource::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(lcons, "describe", describe);
     NODE_SET_PROTOTYPE_METHOD(lcons, "featureset", featureset);
     NODE_SET_PROTOTYPE_METHOD(lcons, "extent", extent);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "exportGeoJSON", exportGeoJSON);
 
     target->Set(NanNew("Datasource"), lcons->GetFunction());
     NanAssignPersistent(constructor, lcons);
@@ -201,18 +211,78 @@ NAN_METHOD(Datasource::describe)
     NanReturnValue(description);
 }
 
-NAN_METHOD(Datasource::featureset)
+// bbox and fields shared by featureset and exportGeoJSON
+struct query_options
 {
+    query_options()
+      : has_bbox(false),
+        bbox(),
+        has_fields(false),
+        fields() {}
+
+    bool has_bbox;
+    mapnik::box2d<double> bbox;
+    bool has_fields;
+    std::vector<std::string> fields;
+};
+
+// Returns false after throwing a JS exception for invalid options.
+static bool parse_query_options(Local<Object> const& options, query_options & opts)
+{
+    if (options->Has(NanNew("bbox")))
+    {
+        Local<Value> bbox_opt = options->Get(NanNew("bbox"));
+        if (!bbox_opt->IsArray() || bbox_opt.As<Array>()->Length() != 4)
+        {
+            NanThrowTypeError("option 'bbox' must be an array of [minx,miny,maxx,maxy]");
+            return false;
+        }
+        Local<Array> a = bbox_opt.As<Array>();
+        opts.bbox.init(a->Get(0)->NumberValue(),
+                       a->Get(1)->NumberValue(),
+                       a->Get(2)->NumberValue(),
+                       a->Get(3)->NumberValue());
+        opts.has_bbox = true;
+    }
+    if (options->Has(NanNew("fields")))
+    {
+        Local<Value> fields_opt = options->Get(NanNew("fields"));
+        if (!fields_opt->IsArray())
+        {
+            NanThrowTypeError("option 'fields' must be an array of attribute names");
+            return false;
+        }
+        Local<Array> a = fields_opt.As<Array>();
+        for (unsigned i = 0; i < a->Length(); ++i)
+        {
+            Local<Value> name = a->Get(i);
+            if (!name->IsString())
+            {
+                NanThrowTypeError("option 'fields' must be an array of attribute names");
+                return false;
+            }
+            opts.fields.push_back(TOSTR(name));
+        }
+        opts.has_fields = true;
+    }
+    return true;
+}
 
-    NanScope();
-
-    Datasource* ds = node::ObjectWrap::Unwrap<Datasource>(args.Holder());
-
-    mapnik::featureset_ptr fs;
-    try
+static mapnik::query make_query(mapnik::datasource const& ds, query_options const& opts)
+{
+    mapnik::query q(opts.has_bbox ? opts.bbox : ds.envelope());
+    if (opts.has_fields)
     {
-        mapnik::query q(ds->datasource_->envelope());
-        mapnik::layer_descriptor ld = ds->datasource_->get_descriptor();
+        // only the named attributes are read, which plugins such as
+        // shape use to skip decoding the others
+        for (std::string const& name : opts.fields)
+        {
+            q.add_property_name(name);
+        }
+    }
+    else
+    {
+        mapnik::layer_descriptor ld = ds.get_descriptor();
         std::vector<mapnik::attribute_descriptor> const& desc = ld.get_descriptors();
         std::vector<mapnik::attribute_descriptor>::const_iterator itr = desc.begin();
         std::vector<mapnik::attribute_descriptor>::const_iterator end = desc.end();
@@ -221,8 +291,35 @@ NAN_METHOD(Datasource::featureset)
             q.add_property_name(itr->get_name());
             ++itr;
         }
+    }
+    return q;
+}
+
+NAN_METHOD(Datasource::featureset)
+{
+
+    NanScope();
+
+    Datasource* ds = node::ObjectWrap::Unwrap<Datasource>(args.Holder());
 
-        fs = ds->datasource_->features(q);
+    query_options opts;
+    if (args.Length() > 0)
+    {
+        if (!args[0]->IsObject())
+        {
+            NanThrowTypeError("optional argument must be an options object");
+            NanReturnUndefined();
+        }
+        if (!parse_query_options(args[0]->ToObject(), opts))
+        {
+            NanReturnUndefined();
+        }
+    }
+
+    mapnik::featureset_ptr fs;
+    try
+    {
+        fs = ds->datasource_->features(make_query(*ds->datasource_, opts));
     }
     catch (std::exception const& ex)
     {
@@ -232,8 +329,373 @@ NAN_METHOD(Datasource::featureset)
 
     if (fs)
     {
-        NanReturnValue(Featureset::New(fs));
+        NanReturnValue(Featureset::New(fs, opts.has_fields, opts.fields));
     }
 
     NanReturnUndefined();
 }
+
+// An export runs as a series of work items, each of which generates up to
+// this many chunks and ends; the next one is only queued once JS has taken
+// them, so a slow or paused consumer never holds a pool thread
+static const std::size_t max_pending_chunks = 4;
+
+struct export_geojson_baton_t {
+    uv_work_t request;
+    Datasource* d;
+    query_options opts;
+    std::string srs;
+    bool ndjson;
+    std::size_t chunk_size;
+    // kept between work items, which read it one at a time
+    mapnik::featureset_ptr fs;
+    bool started;
+    bool first;
+    bool exhausted;
+    std::deque<std::string> chunks;
+    bool error;
+    std::string error_name;
+    // main thread only
+    bool running;
+    bool paused;
+    bool resume_requested;
+    bool delivering;
+    bool aborted;
+    Persistent<Function> on_chunk;
+    Persistent<Function> resume;
+    Persistent<Object> controller;
+    Persistent<Function> cb;
+};
+
+// Writes `feature` as a GeoJSON Feature with its geometry reprojected by
+// `prj_trans`.
+static void feature_to_geojson(std::string & out,
+                               mapnik::feature_impl & feature,
+                               mapnik::proj_transform const& prj_trans)
+{
+    using sink_type = std::back_insert_iterator<std::string>;
+    static const mapnik::json::properties_generator_grammar<sink_type, mapnik::feature_impl> prop_grammar;
+    static const mapnik::json::multi_geometry_generator_grammar<sink_type,node_mapnik::proj_transform_container> proj_grammar;
+    out += "{\"type\":\"Feature\",\"id\":";
+    out += std::to_string(feature.id());
+    out += ",\"geometry\":";
+    if (feature.paths().empty())
+    {
+        out += "null";
+    }
+    else
+    {
+        node_mapnik::proj_transform_container projected_paths;
+        for (auto & geom : feature.paths())
+        {
+            projected_paths.push_back(new node_mapnik::proj_transform_path_type(geom,prj_trans));
+        }
+        sink_type sink(out);
+        if (!boost::spirit::karma::generate(sink, proj_grammar, projected_paths))
+        {
+            throw std::runtime_error("Failed to generate GeoJSON geometry");
+        }
+    }
+    out += ",\"properties\":";
+    sink_type sink(out);
+    if (!boost::spirit::karma::generate(sink, prop_grammar, feature))
+    {
+        throw std::runtime_error("Failed to generate GeoJSON properties");
+    }
+    out += "}";
+}
+
+// main thread, once no work item is running and every chunk was delivered
+// or the export was aborted
+static void finish_export(export_geojson_baton_t *closure)
+{
+    NanScope();
+    // later calls to resume() and abort() do nothing
+    NanSetInternalFieldPointer(NanNew(closure->controller), 0, NULL);
+    closure->fs.reset();
+    Local<Function> cb = NanNew(closure->cb);
+    closure->d->Unref();
+    NanDisposePersistent(closure->on_chunk);
+    NanDisposePersistent(closure->resume);
+    NanDisposePersistent(closure->controller);
+    NanDisposePersistent(closure->cb);
+    Local<Value> argv[1] = { NanNull() };
+    if (closure->aborted)
+    {
+        argv[0] = NanError("exportGeoJSON was aborted");
+    }
+    else if (closure->error)
+    {
+        argv[0] = NanError(closure->error_name.c_str());
+    }
+    delete closure;
+    NanMakeCallback(NanGetCurrentContext()->Global(), cb, 1, argv);
+}
+
+// main thread. Hands queued chunks to onChunk in order until it returns
+// false, then queues the next work item, or finishes once the featureset
+// is exhausted.
+static void pump_export(export_geojson_baton_t *closure)
+{
+    NanScope();
+    if (closure->delivering)
+    {
+        return;
+    }
+    closure->delivering = true;
+    while (!closure->paused && !closure->aborted && !closure->chunks.empty())
+    {
+        std::string chunk;
+        chunk.swap(closure->chunks.front());
+        closure->chunks.pop_front();
+        closure->resume_requested = false;
+        Local<Value> argv[2] = { node_mapnik::string_to_buffer(chunk), NanNew(closure->resume) };
+        Local<Value> ret = NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->on_chunk), 2, argv);
+        // resume() may already have been called from within onChunk
+        if (!ret.IsEmpty() && ret->IsFalse() && !closure->resume_requested)
+        {
+            closure->paused = true;
+        }
+    }
+    closure->delivering = false;
+    if (closure->running)
+    {
+        // picked up again when the work item is done
+        return;
+    }
+    if (closure->aborted)
+    {
+        finish_export(closure);
+    }
+    else if (!closure->paused && closure->chunks.empty())
+    {
+        if (closure->error || closure->exhausted)
+        {
+            finish_export(closure);
+        }
+        else
+        {
+            closure->running = true;
+            node_mapnik::queue_work(&closure->request, Datasource::EIO_ExportGeoJSON, Datasource::EIO_AfterExportGeoJSON);
+        }
+    }
+}
+
+static export_geojson_baton_t * export_from_args(_NAN_METHOD_ARGS)
+{
+    return static_cast<export_geojson_baton_t *>(
+        NanGetInternalFieldPointer(args.Data()->ToObject(), 0));
+}
+
+static NAN_METHOD(resume_export)
+{
+    NanScope();
+    export_geojson_baton_t *closure = export_from_args(args);
+    if (closure)
+    {
+        closure->resume_requested = true;
+        if (closure->paused)
+        {
+            closure->paused = false;
+            pump_export(closure);
+        }
+    }
+    NanReturnUndefined();
+}
+
+// Stops the export and drops its featureset; the completion callback gets
+// an error. A running work item is left to end on its own.
+static NAN_METHOD(abort_export)
+{
+    NanScope();
+    export_geojson_baton_t *closure = export_from_args(args);
+    if (closure && !closure->aborted)
+    {
+        closure->aborted = true;
+        closure->chunks.clear();
+        pump_export(closure);
+    }
+    NanReturnUndefined();
+}
+
+/**
+ * exportGeoJSON(options, onChunk(chunk, resume), callback(err)): streams the
+ * features as Buffer chunks of GeoJSON generated on the threadpool. Options
+ * are 'bbox' and 'fields' as for featureset, 'srs' for the projection of the
+ * datasource (lon/lat by default; coordinates are always written in
+ * EPSG:4326), 'format' and 'chunkSize'. If onChunk returns false no more
+ * chunks are generated or delivered until it calls resume(). Returns an
+ * object with resume() and abort(); abort() ends the export early and
+ * calls back with an error.
+ */
+NAN_METHOD(Datasource::exportGeoJSON)
+{
+    NanScope();
+
+    Datasource* ds = node::ObjectWrap::Unwrap<Datasource>(args.Holder());
+
+    if (args.Length() < 3 || !args[0]->IsObject() || !args[1]->IsFunction() || !args[2]->IsFunction())
+    {
+        NanThrowTypeError("expects an options object, a chunk callback and a completion callback");
+        NanReturnUndefined();
+    }
+    Local<Object> options = args[0]->ToObject();
+    query_options opts;
+    if (!parse_query_options(options, opts))
+    {
+        NanReturnUndefined();
+    }
+    bool ndjson = false;
+    if (options->Has(NanNew("format")))
+    {
+        Local<Value> format_opt = options->Get(NanNew("format"));
+        std::string format = format_opt->IsString() ? TOSTR(format_opt) : std::string();
+        if (format == "ndjson")
+        {
+            ndjson = true;
+        }
+        else if (format != "featurecollection")
+        {
+            NanThrowTypeError("option 'format' must be 'ndjson' or 'featurecollection'");
+            NanReturnUndefined();
+        }
+    }
+    std::size_t chunk_size = 65536;
+    if (options->Has(NanNew("chunkSize")))
+    {
+        Local<Value> chunk_opt = options->Get(NanNew("chunkSize"));
+        if (!chunk_opt->IsNumber() || chunk_opt->IntegerValue() <= 0)
+        {
+            NanThrowTypeError("option 'chunkSize' must be a positive number of bytes");
+            NanReturnUndefined();
+        }
+        chunk_size = static_cast<std::size_t>(chunk_opt->IntegerValue());
+    }
+    // datasources do not know their projection; like mapnik.Layer the
+    // default is lon/lat
+    std::string srs("+init=epsg:4326");
+    if (options->Has(NanNew("srs")))
+    {
+        Local<Value> srs_opt = options->Get(NanNew("srs"));
+        if (!srs_opt->IsString())
+        {
+            NanThrowTypeError("option 'srs' must be a projection string");
+            NanReturnUndefined();
+        }
+        srs = TOSTR(srs_opt);
+        try
+        {
+            // fail early for an invalid srs
+            node_mapnik::cached_proj_transform(srs, "+init=epsg:4326");
+        }
+        catch (std::exception const& ex)
+        {
+            NanThrowError(ex.what());
+            NanReturnUndefined();
+        }
+    }
+
+    export_geojson_baton_t *closure = new export_geojson_baton_t();
+    closure->request.data = closure;
+    closure->d = ds;
+    closure->opts = opts;
+    closure->srs = srs;
+    closure->ndjson = ndjson;
+    closure->chunk_size = chunk_size;
+    closure->started = false;
+    closure->first = true;
+    closure->exhausted = false;
+    closure->error = false;
+    closure->running = true;
+    closure->paused = false;
+    closure->resume_requested = false;
+    closure->delivering = false;
+    closure->aborted = false;
+    NanAssignPersistent(closure->on_chunk, args[1].As<Function>());
+    // the baton is reached through an internal field that is cleared when
+    // the export finishes, so a late resume() or abort() is harmless
+    Local<ObjectTemplate> controller_tpl = NanNew<ObjectTemplate>();
+    controller_tpl->SetInternalFieldCount(1);
+    Local<Object> controller = controller_tpl->NewInstance();
+    NanSetInternalFieldPointer(controller, 0, closure);
+    Local<Function> resume = NanNew<FunctionTemplate>(resume_export, controller)->GetFunction();
+    controller->Set(NanNew("resume"), resume);
+    controller->Set(NanNew("abort"), NanNew<FunctionTemplate>(abort_export, controller)->GetFunction());
+    NanAssignPersistent(closure->controller, controller);
+    NanAssignPersistent(closure->resume, resume);
+    NanAssignPersistent(closure->cb, args[2].As<Function>());
+    node_mapnik::queue_work(&closure->request, EIO_ExportGeoJSON, EIO_AfterExportGeoJSON);
+    ds->Ref();
+    NanReturnValue(controller);
+}
+
+// Generates chunks until max_pending_chunks are queued or the featureset
+// is exhausted, resuming where the previous work item stopped.
+void Datasource::EIO_ExportGeoJSON(uv_work_t* req)
+{
+    export_geojson_baton_t *closure = static_cast<export_geojson_baton_t *>(req->data);
+    try
+    {
+        std::string chunk;
+        chunk.reserve(closure->chunk_size);
+        if (!closure->started)
+        {
+            mapnik::datasource const& ds = *closure->d->datasource_;
+            closure->fs = ds.features(make_query(ds, closure->opts));
+            closure->started = true;
+            if (!closure->ndjson)
+            {
+                chunk += "{\"type\":\"FeatureCollection\",\"features\":[";
+            }
+        }
+        // GeoJSON coordinates are always WGS84
+        std::shared_ptr<node_mapnik::cached_transform const> tr = node_mapnik::cached_proj_transform(closure->srs, "+init=epsg:4326");
+        mapnik::feature_ptr feature;
+        while (closure->chunks.size() < max_pending_chunks)
+        {
+            if (!closure->fs || !(feature = closure->fs->next()))
+            {
+                closure->fs.reset();
+                closure->exhausted = true;
+                break;
+            }
+            if (!closure->ndjson && !closure->first)
+            {
+                chunk += ",";
+            }
+            closure->first = false;
+            feature_to_geojson(chunk, *feature, tr->trans);
+            if (closure->ndjson)
+            {
+                chunk += "\n";
+            }
+            if (chunk.size() >= closure->chunk_size)
+            {
+                closure->chunks.push_back(std::string());
+                closure->chunks.back().swap(chunk);
+                chunk.reserve(closure->chunk_size);
+            }
+        }
+        if (closure->exhausted && !closure->ndjson)
+        {
+            chunk += "]}";
+        }
+        if (!chunk.empty())
+        {
+            closure->chunks.push_back(std::string());
+            closure->chunks.back().swap(chunk);
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void Datasource::EIO_AfterExportGeoJSON(uv_work_t* req)
+{
+    export_geojson_baton_t *closure = static_cast<export_geojson_baton_t *>(req->data);
+    closure->running = false;
+    pump_export(closure);
+}
@@ -27,6 +27,9 @@ public:
     static NAN_METHOD(describe);
     static NAN_METHOD(featureset);
     static NAN_METHOD(extent);
+    static NAN_METHOD(exportGeoJSON);
+    static void EIO_ExportGeoJSON(uv_work_t* req);
+    static void EIO_AfterExportGeoJSON(uv_work_t* req);
 
     Datasource();
     inline datasource_ptr get() { return datasource_; }
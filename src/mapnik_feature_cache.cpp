@@ -0,0 +1,375 @@
+#include "mapnik_feature_cache.hpp"
+
+// mapnik
+#include <mapnik/box2d.hpp>             // for box2d
+#include <mapnik/featureset.hpp>        // for Featureset
+#include <mapnik/layer.hpp>             // for layer
+#include <mapnik/map.hpp>               // for Map
+#include <mapnik/value.hpp>             // for value
+
+// boost
+#include MAPNIK_MAKE_SHARED_INCLUDE
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <utility>
+
+namespace node_mapnik {
+
+feature_cache::feature_cache(std::size_t max_size, unsigned cell_size)
+  : mutex_(),
+    lru_(),
+    index_(),
+    max_size_(max_size),
+    size_(0),
+    cell_size_(cell_size),
+    hits_(0),
+    misses_(0) {}
+
+feature_list_ptr feature_cache::find(std::string const& key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, entry_list::iterator>::iterator itr = index_.find(key);
+    if (itr == index_.end())
+    {
+        ++misses_;
+        return feature_list_ptr();
+    }
+    ++hits_;
+    // most recently used entries live at the front
+    lru_.splice(lru_.begin(), lru_, itr->second);
+    return itr->second->features;
+}
+
+void feature_cache::insert(std::string const& key, feature_list_ptr const& features, std::size_t size)
+{
+    if (size > max_size_)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, entry_list::iterator>::iterator itr = index_.find(key);
+    if (itr != index_.end())
+    {
+        // a concurrent miss on the same key got here first
+        size_ -= itr->second->size;
+        lru_.erase(itr->second);
+        index_.erase(itr);
+    }
+    evict(size);
+    entry e = { key, features, size };
+    lru_.push_front(e);
+    index_[key] = lru_.begin();
+    size_ += size;
+}
+
+feature_cache::stats_type feature_cache::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_type s = { lru_.size(), size_, hits_, misses_ };
+    return s;
+}
+
+void feature_cache::evict(std::size_t needed)
+{
+    while (!lru_.empty() && size_ + needed > max_size_)
+    {
+        size_ -= lru_.back().size;
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
+
+namespace {
+
+// rough number of bytes held by a decoded feature
+std::size_t estimate_size(mapnik::feature_impl const& feature)
+{
+    std::size_t size = sizeof(mapnik::feature_impl) + feature.size() * sizeof(mapnik::value);
+    for (mapnik::geometry_type const& geom : feature.paths())
+    {
+        size += sizeof(mapnik::geometry_type) + geom.size() * (2 * sizeof(double) + 1);
+    }
+    return size;
+}
+
+// queries that span more cells than this go straight to the datasource
+const long long max_cells = 1024;
+
+class cached_featureset : public mapnik::Featureset
+{
+public:
+    explicit cached_featureset(std::vector<mapnik::feature_ptr> && features)
+      : features_(std::move(features)),
+        pos_(0) {}
+
+    mapnik::feature_ptr next()
+    {
+        if (pos_ < features_.size())
+        {
+            return features_[pos_++];
+        }
+        return mapnik::feature_ptr();
+    }
+
+private:
+    std::vector<mapnik::feature_ptr> features_;
+    std::size_t pos_;
+};
+
+bool by_sequence(cached_feature const* a, cached_feature const* b)
+{
+    return a->sequence < b->sequence;
+}
+
+bool same_sequence(cached_feature const* a, cached_feature const* b)
+{
+    return a->sequence == b->sequence;
+}
+
+// Features from cells fetched by different queries can only be put back in
+// the order the datasource returns them if their ids say where they come in
+// it. The file based plugins number features by their position in the file
+// and return them in that order; others, like postgis without a key_field
+// or ogr, may number them per query.
+bool ids_follow_datasource_order(mapnik::datasource const& ds)
+{
+    boost::optional<std::string> type = ds.params().get<std::string>("type");
+    return type && (*type == "shape" || *type == "csv" ||
+                    *type == "geojson" || *type == "topojson");
+}
+
+}
+
+caching_datasource::caching_datasource(mapnik::datasource_ptr const& ds,
+                                       std::string const& layer_name,
+                                       feature_cache_ptr const& cache)
+  : mapnik::datasource(ds->params()),
+    ds_(ds),
+    layer_name_(layer_name),
+    cache_(cache) {}
+
+mapnik::datasource::datasource_t caching_datasource::type() const
+{
+    return ds_->type();
+}
+
+mapnik::processor_context_ptr caching_datasource::get_context(mapnik::feature_style_context_map & ctx) const
+{
+    return ds_->get_context(ctx);
+}
+
+mapnik::featureset_ptr caching_datasource::features_with_context(mapnik::query const& q,
+                                                                 mapnik::processor_context_ptr ctx) const
+{
+    return cached_features(q, ctx);
+}
+
+mapnik::featureset_ptr caching_datasource::features(mapnik::query const& q) const
+{
+    return cached_features(q, mapnik::processor_context_ptr());
+}
+
+mapnik::featureset_ptr caching_datasource::features_at_point(mapnik::coord2d const& pt, double tol) const
+{
+    return ds_->features_at_point(pt, tol);
+}
+
+mapnik::box2d<double> caching_datasource::envelope() const
+{
+    return ds_->envelope();
+}
+
+boost::optional<mapnik::datasource::geometry_t> caching_datasource::get_geometry_type() const
+{
+    return ds_->get_geometry_type();
+}
+
+mapnik::layer_descriptor caching_datasource::get_descriptor() const
+{
+    return ds_->get_descriptor();
+}
+
+mapnik::featureset_ptr caching_datasource::query(mapnik::query const& q,
+                                                 mapnik::processor_context_ptr const& ctx) const
+{
+    return ctx ? ds_->features_with_context(q, ctx) : ds_->features(q);
+}
+
+mapnik::featureset_ptr caching_datasource::cached_features(mapnik::query const& q,
+                                                           mapnik::processor_context_ptr const& ctx) const
+{
+    mapnik::query::resolution_type const& res = q.resolution();
+    double res_x = res.get<0>();
+    double res_y = res.get<1>();
+    if (ds_->type() != mapnik::datasource::Vector || res_x <= 0 || res_y <= 0)
+    {
+        return query(q, ctx);
+    }
+
+    // the cells of the grid for this resolution that the bbox covers
+    mapnik::box2d<double> const& bbox = q.get_bbox();
+    double cell_x = cache_->cell_size() / res_x;
+    double cell_y = cache_->cell_size() / res_y;
+    long long minx = static_cast<long long>(std::floor(bbox.minx() / cell_x));
+    long long miny = static_cast<long long>(std::floor(bbox.miny() / cell_y));
+    long long maxx = std::max(minx + 1, static_cast<long long>(std::ceil(bbox.maxx() / cell_x)));
+    long long maxy = std::max(miny + 1, static_cast<long long>(std::ceil(bbox.maxy() / cell_y)));
+    long long nx = maxx - minx;
+    long long ny = maxy - miny;
+    if (nx * ny > max_cells)
+    {
+        return query(q, ctx);
+    }
+
+    // everything else that changes what the datasource returns
+    std::ostringstream s;
+    s.precision(17);
+    s << layer_name_ << '\0'
+      << res_x << ',' << res_y << ',' << q.scale_denominator() << ',' << q.get_filter_factor() << '\0';
+    for (std::string const& name : q.property_names())
+    {
+        s << name << ',';
+    }
+    s << '\0';
+    for (auto const& var : q.variables())
+    {
+        s << var.first << '=' << var.second.to_string() << ',';
+    }
+    s << '\0';
+    std::string prefix = s.str();
+
+    std::vector<std::string> keys(nx * ny);
+    std::vector<mapnik::box2d<double> > boxes(nx * ny);
+    std::vector<feature_list_ptr> cells(nx * ny);
+    std::vector<std::size_t> missing;
+    for (long long cy = miny; cy < maxy; ++cy)
+    {
+        for (long long cx = minx; cx < maxx; ++cx)
+        {
+            std::size_t idx = static_cast<std::size_t>((cy - miny) * nx + (cx - minx));
+            std::ostringstream key;
+            key << prefix << cx << ',' << cy;
+            keys[idx] = key.str();
+            boxes[idx].init(cx * cell_x, cy * cell_y, (cx + 1) * cell_x, (cy + 1) * cell_y);
+            cells[idx] = cache_->find(keys[idx]);
+            if (!cells[idx])
+            {
+                missing.push_back(idx);
+            }
+        }
+    }
+
+    if (!missing.empty())
+    {
+        // one datasource query for all missing cells, whose features are
+        // then handed to every missing cell they touch
+        mapnik::box2d<double> area(boxes[missing.front()]);
+        for (std::size_t idx : missing)
+        {
+            area.expand_to_include(boxes[idx]);
+        }
+        mapnik::query cell_query(area, res, q.scale_denominator(), q.get_unbuffered_bbox());
+        cell_query.set_filter_factor(q.get_filter_factor());
+        cell_query.set_variables(q.variables());
+        for (std::string const& name : q.property_names())
+        {
+            cell_query.add_property_name(name);
+        }
+        std::vector<MAPNIK_SHARED_PTR<feature_list> > fetched(missing.size());
+        std::vector<std::size_t> sizes(missing.size(), 0);
+        for (std::size_t m = 0; m < missing.size(); ++m)
+        {
+            fetched[m] = MAPNIK_MAKE_SHARED<feature_list>();
+        }
+        mapnik::featureset_ptr fs = query(cell_query, ctx);
+        if (fs)
+        {
+            mapnik::feature_ptr feature;
+            while ((feature = fs->next()))
+            {
+                cached_feature cf = { feature, feature->envelope(), feature->id() };
+                std::size_t size = estimate_size(*feature);
+                for (std::size_t m = 0; m < missing.size(); ++m)
+                {
+                    if (boxes[missing[m]].intersects(cf.envelope))
+                    {
+                        fetched[m]->push_back(cf);
+                        sizes[m] += size;
+                    }
+                }
+            }
+        }
+        for (std::size_t m = 0; m < missing.size(); ++m)
+        {
+            cache_->insert(keys[missing[m]], fetched[m], sizes[m]);
+            cells[missing[m]] = fetched[m];
+        }
+    }
+
+    // Merge the cells back into datasource order. Features that cross cell
+    // edges are in several cells, as separate copies if the cells were
+    // fetched separately, and are only kept once.
+    std::vector<cached_feature const*> merged;
+    for (feature_list_ptr const& cell : cells)
+    {
+        for (cached_feature const& cf : *cell)
+        {
+            if (bbox.intersects(cf.envelope))
+            {
+                merged.push_back(&cf);
+            }
+        }
+    }
+    std::stable_sort(merged.begin(), merged.end(), by_sequence);
+    merged.erase(std::unique(merged.begin(), merged.end(), same_sequence), merged.end());
+    std::vector<mapnik::feature_ptr> features;
+    features.reserve(merged.size());
+    for (cached_feature const* cf : merged)
+    {
+        features.push_back(cf->feature);
+    }
+    return MAPNIK_MAKE_SHARED<cached_featureset>(std::move(features));
+}
+
+void set_feature_cache(mapnik::Map & map, feature_cache_ptr const& cache)
+{
+    for (mapnik::layer & lyr : map.layers())
+    {
+        mapnik::datasource_ptr ds = lyr.datasource();
+        if (!ds)
+        {
+            continue;
+        }
+        caching_datasource const* wrapper = dynamic_cast<caching_datasource const*>(ds.get());
+        if (wrapper)
+        {
+            ds = wrapper->wrapped();
+        }
+        if (cache && ids_follow_datasource_order(*ds))
+        {
+            lyr.set_datasource(MAPNIK_MAKE_SHARED<caching_datasource>(ds, lyr.name(), cache));
+        }
+        else
+        {
+            lyr.set_datasource(ds);
+        }
+    }
+}
+
+feature_cache_ptr get_feature_cache(mapnik::Map const& map)
+{
+    for (mapnik::layer const& lyr : map.layers())
+    {
+        caching_datasource const* wrapper = dynamic_cast<caching_datasource const*>(lyr.datasource().get());
+        if (wrapper)
+        {
+            return wrapper->cache();
+        }
+    }
+    return feature_cache_ptr();
+}
+
+}
@@ -0,0 +1,132 @@
+#ifndef __NODE_MAPNIK_FEATURE_CACHE_H__
+#define __NODE_MAPNIK_FEATURE_CACHE_H__
+
+#include "mapnik3x_compatibility.hpp"
+
+// mapnik
+#include <mapnik/box2d.hpp>             // for box2d
+#include <mapnik/datasource.hpp>        // for datasource, featureset_ptr
+#include <mapnik/feature.hpp>           // for feature_ptr
+#include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
+#include <mapnik/query.hpp>             // for query
+#include <mapnik/value_types.hpp>       // for value_integer
+
+// boost
+#include <boost/optional/optional.hpp>
+#include MAPNIK_SHARED_INCLUDE
+
+// stl
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mapnik { class Map; }
+
+namespace node_mapnik {
+
+// a decoded feature and its envelope, worked out once when it is cached,
+// and where the feature comes in the order the datasource returns them
+struct cached_feature
+{
+    mapnik::feature_ptr feature;
+    mapnik::box2d<double> envelope;
+    mapnik::value_integer sequence;
+};
+
+typedef std::vector<cached_feature> feature_list;
+typedef MAPNIK_SHARED_PTR<feature_list const> feature_list_ptr;
+
+// LRU of decoded features shared by all layers of a map, bounded by an
+// estimate of the memory the features use. Each entry holds the features
+// of one grid cell.
+class feature_cache
+{
+public:
+    struct stats_type
+    {
+        std::size_t entries;
+        std::size_t size;
+        std::size_t hits;
+        std::size_t misses;
+    };
+
+    feature_cache(std::size_t max_size, unsigned cell_size);
+
+    unsigned cell_size() const { return cell_size_; }
+    feature_list_ptr find(std::string const& key);
+    void insert(std::string const& key, feature_list_ptr const& features, std::size_t size);
+    stats_type stats();
+
+private:
+    struct entry
+    {
+        std::string key;
+        feature_list_ptr features;
+        std::size_t size;
+    };
+    typedef std::list<entry> entry_list;
+
+    void evict(std::size_t needed);
+
+    std::mutex mutex_;
+    entry_list lru_;
+    std::unordered_map<std::string, entry_list::iterator> index_;
+    std::size_t max_size_;
+    std::size_t size_;
+    unsigned cell_size_;
+    std::size_t hits_;
+    std::size_t misses_;
+};
+
+typedef MAPNIK_SHARED_PTR<feature_cache> feature_cache_ptr;
+
+// Answers bbox queries from `cache` where it can. The cache holds the
+// features of each cell of a grid at the query's resolution, so
+// neighbouring tiles at the same zoom share the cells they both cover and
+// only ask the wrapped datasource for cells that are not cached yet.
+class caching_datasource : public mapnik::datasource
+{
+public:
+    caching_datasource(mapnik::datasource_ptr const& ds,
+                       std::string const& layer_name,
+                       feature_cache_ptr const& cache);
+
+    datasource_t type() const;
+    mapnik::processor_context_ptr get_context(mapnik::feature_style_context_map & ctx) const;
+    mapnik::featureset_ptr features_with_context(mapnik::query const& q,
+                                                 mapnik::processor_context_ptr ctx) const;
+    mapnik::featureset_ptr features(mapnik::query const& q) const;
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt, double tol) const;
+    mapnik::box2d<double> envelope() const;
+    boost::optional<mapnik::datasource::geometry_t> get_geometry_type() const;
+    mapnik::layer_descriptor get_descriptor() const;
+
+    mapnik::datasource_ptr const& wrapped() const { return ds_; }
+    feature_cache_ptr const& cache() const { return cache_; }
+
+private:
+    mapnik::featureset_ptr cached_features(mapnik::query const& q,
+                                           mapnik::processor_context_ptr const& ctx) const;
+    mapnik::featureset_ptr query(mapnik::query const& q,
+                                 mapnik::processor_context_ptr const& ctx) const;
+
+    mapnik::datasource_ptr ds_;
+    std::string layer_name_;
+    feature_cache_ptr cache_;
+};
+
+// Wraps the datasource of every layer in `map` that numbers its features in
+// the order it returns them with a caching_datasource sharing `cache`, or
+// restores the original datasources when `cache` is empty. Layers that are
+// already wrapped are rewrapped.
+void set_feature_cache(mapnik::Map & map, feature_cache_ptr const& cache);
+
+// the cache in use by `map`, if any
+feature_cache_ptr get_feature_cache(mapnik::Map const& map);
+
+}
+
+#endif
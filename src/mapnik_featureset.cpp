@@ -1,5 +1,10 @@
 #include "mapnik_featureset.hpp"
 #include "mapnik_feature.hpp"
+#include "utils.hpp"
+
+// mapnik
+#include <mapnik/feature.hpp>           // for feature_impl
+#include <mapnik/util/geometry_to_geojson.hpp>
 
 Persistent<FunctionTemplate> Featureset::constructor;
 
@@ -12,6 +17,7 @@ void Featureset::Initialize(Handle<Object> target) {
     lcons->SetClassName(NanNew("Featureset"));
 
     NODE_SET_PROTOTYPE_METHOD(lcons, "next", next);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "nextBatch", nextBatch);
 
     target->Set(NanNew("Featureset"), lcons->GetFunction());
     NanAssignPersistent(constructor, lcons);
@@ -19,7 +25,9 @@ void Featureset::Initialize(Handle<Object> target) {
 
 Featureset::Featureset() :
     ObjectWrap(),
-    this_() {}
+    this_(),
+    has_fields_(false),
+    fields_() {}
 
 Featureset::~Featureset()
 {
@@ -73,11 +81,105 @@ NAN_METHOD(Featureset::next)
     NanReturnUndefined();
 }
 
-Handle<Value> Featureset::New(mapnik::featureset_ptr fs_ptr)
+NAN_METHOD(Featureset::nextBatch)
+{
+    NanScope();
+
+    Featureset* fs = node::ObjectWrap::Unwrap<Featureset>(args.Holder());
+
+    if (args.Length() < 1 || !args[0]->IsNumber() || args[0]->IntegerValue() <= 0) {
+        NanThrowTypeError("first argument must be a positive number of features");
+        NanReturnUndefined();
+    }
+    std::size_t count = static_cast<std::size_t>(args[0]->IntegerValue());
+    bool with_geometry = false;
+    if (args.Length() > 1) {
+        if (!args[1]->IsObject()) {
+            NanThrowTypeError("optional second argument must be an options object");
+            NanReturnUndefined();
+        }
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(NanNew("geometry"))) {
+            Local<Value> param_val = options->Get(NanNew("geometry"));
+            if (!param_val->IsBoolean()) {
+                NanThrowTypeError("option 'geometry' must be a boolean");
+                NanReturnUndefined();
+            }
+            with_geometry = param_val->BooleanValue();
+        }
+    }
+
+    Local<Array> batch = NanNew<Array>();
+    if (!fs->this_) {
+        NanReturnValue(batch);
+    }
+    // property names are created once per batch rather than per feature
+    Local<String> id_key = NanNew("id");
+    Local<String> properties_key = NanNew("properties");
+    Local<String> geometry_key = NanNew("geometry");
+    std::vector<Local<String> > field_keys;
+    field_keys.reserve(fs->fields_.size());
+    for (std::string const& name : fs->fields_) {
+        field_keys.push_back(NanNew(name.c_str()));
+    }
+    try
+    {
+        std::string json;
+        for (std::size_t i = 0; i < count; ++i) {
+            mapnik::feature_ptr fp = fs->this_->next();
+            if (!fp) {
+                // exhausted, so later calls return empty batches
+                fs->this_.reset();
+                break;
+            }
+            Local<Object> properties = NanNew<Object>();
+            if (!fs->has_fields_) {
+                for (mapnik::feature_impl::iterator itr = fp->begin(); itr != fp->end(); ++itr) {
+                    node_mapnik::params_to_object serializer(properties, MAPNIK_GET<0>(*itr));
+                    MAPNIK_APPLY_VISITOR(serializer, MAPNIK_GET<1>(*itr));
+                }
+            } else {
+                for (std::size_t j = 0; j < fs->fields_.size(); ++j) {
+                    if (!fp->has_key(fs->fields_[j])) continue;
+                    mapnik::value const& val = fp->get(fs->fields_[j]);
+                    if (val.is_null()) {
+                        properties->Set(field_keys[j], NanNull());
+                    } else {
+                        properties->Set(field_keys[j], MAPNIK_APPLY_VISITOR(node_mapnik::value_converter(), val));
+                    }
+                }
+            }
+            Local<Object> feature = NanNew<Object>();
+            feature->Set(id_key, NanNew<Number>(fp->id()));
+            feature->Set(properties_key, properties);
+            if (with_geometry) {
+                json.clear();
+                if (!mapnik::util::to_geojson(json, fp->paths())) {
+                    NanThrowError("Failed to generate GeoJSON");
+                    NanReturnUndefined();
+                }
+                feature->Set(geometry_key, NanNew(json.c_str()));
+            }
+            batch->Set(static_cast<uint32_t>(i), feature);
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        NanThrowError(ex.what());
+        NanReturnUndefined();
+    }
+    NanReturnValue(batch);
+}
+
+Handle<Value> Featureset::New(mapnik::featureset_ptr fs_ptr,
+                              bool has_fields,
+                              std::vector<std::string> const& fields)
 {
     NanEscapableScope();
     Featureset* fs = new Featureset();
     fs->this_ = fs_ptr;
+    fs->has_fields_ = has_fields;
+    fs->fields_ = fields;
     Handle<Value> ext = NanNew<External>(fs);
     Handle<Object> obj = NanNew(constructor)->GetFunction()->NewInstance(1, &ext);
     return NanEscapeScope(obj);
@@ -9,6 +9,10 @@
 #include <mapnik/featureset.hpp>
 #include "mapnik3x_compatibility.hpp"
 
+// stl
+#include <string>
+#include <vector>
+
 using namespace v8;
 
 typedef mapnik::featureset_ptr fs_ptr;
@@ -18,14 +22,20 @@ public:
     static Persistent<FunctionTemplate> constructor;
     static void Initialize(Handle<Object> target);
     static NAN_METHOD(New);
-    static Handle<Value> New(mapnik::featureset_ptr fs_ptr);
+    static Handle<Value> New(mapnik::featureset_ptr fs_ptr,
+                             bool has_fields = false,
+                             std::vector<std::string> const& fields = std::vector<std::string>());
     static NAN_METHOD(next);
+    static NAN_METHOD(nextBatch);
 
     Featureset();
 
 private:
     ~Featureset();
     fs_ptr this_;
+    // attributes nextBatch hands out, all of them unless has_fields_
+    bool has_fields_;
+    std::vector<std::string> fields_;
 };
 
 #endif
@@ -7,6 +7,7 @@
 #include "mapnik_grid_view.hpp"
 #include "js_grid_utils.hpp"
 #include "utils.hpp"
+#include "mapnik_thread_pool.hpp"
 
 #include MAPNIK_MAKE_SHARED_INCLUDE
 
@@ -489,7 +490,7 @@ NAN_METHOD(Grid::encode) // format, resolution
     closure->add_features = add_features;
     NanAssignPersistent(closure->cb, callback.As<Function>());
     // todo - reserve lines size?
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_Encode, (uv_after_work_cb)EIO_AfterEncode);
+    node_mapnik::queue_work(&closure->request, EIO_Encode, EIO_AfterEncode);
     g->Ref();
     NanReturnUndefined();
 }
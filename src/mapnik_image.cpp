@@ -18,6 +18,7 @@
 #include "mapnik_color.hpp"
 
 #include "utils.hpp"
+#include "mapnik_thread_pool.hpp"
 
 // boost
 #include MAPNIK_MAKE_SHARED_INCLUDE
@@ -501,7 +502,7 @@ NAN_METHOD(Image::premultiply)
     closure->im = im;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_Premultiply, (uv_after_work_cb)EIO_AfterMultiply);
+    node_mapnik::queue_work(&closure->request, EIO_Premultiply, EIO_AfterMultiply);
     im->Ref();
     NanReturnUndefined();
 }
@@ -573,7 +574,7 @@ NAN_METHOD(Image::demultiply)
     closure->im = im;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_Demultiply, (uv_after_work_cb)EIO_AfterMultiply);
+    node_mapnik::queue_work(&closure->request, EIO_Demultiply, EIO_AfterMultiply);
     im->Ref();
     NanReturnUndefined();
 }
@@ -862,7 +863,7 @@ NAN_METHOD(Image::fromBytes)
     NanAssignPersistent(closure->buffer, obj.As<Object>());
     closure->data = node::Buffer::Data(obj);
     closure->dataLength = node::Buffer::Length(obj);
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_FromBytes, (uv_after_work_cb)EIO_AfterFromBytes);
+    node_mapnik::queue_work(&closure->request, EIO_FromBytes, EIO_AfterFromBytes);
     NanReturnUndefined();
 }
 
@@ -966,7 +967,7 @@ NAN_METHOD(Image::encodeSync)
             s = save_to_string(*(im->this_), format);
         }
 
-        NanReturnValue(NanNewBufferHandle((char*)s.data(), s.size()));
+        NanReturnValue(node_mapnik::string_to_buffer(s));
     }
     catch (std::exception const& ex)
     {
@@ -1045,7 +1046,7 @@ NAN_METHOD(Image::encode)
     closure->palette = palette;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_Encode, (uv_after_work_cb)EIO_AfterEncode);
+    node_mapnik::queue_work(&closure->request, EIO_Encode, EIO_AfterEncode);
     im->Ref();
 
     NanReturnUndefined();
@@ -1084,7 +1085,7 @@ void Image::EIO_AfterEncode(uv_work_t* req)
     }
     else
     {
-        Local<Value> argv[2] = { NanNull(), NanNewBufferHandle((char*)closure->result.data(), closure->result.size()) };
+        Local<Value> argv[2] = { NanNull(), node_mapnik::string_to_buffer(closure->result) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
     }
 
@@ -1283,7 +1284,7 @@ NAN_METHOD(Image::composite)
         closure->dy = dy;
         closure->error = false;
         NanAssignPersistent(closure->cb, callback.As<Function>());
-        uv_queue_work(uv_default_loop(), &closure->request, EIO_Composite, (uv_after_work_cb)EIO_AfterComposite);
+        node_mapnik::queue_work(&closure->request, EIO_Composite, EIO_AfterComposite);
         closure->im1->Ref();
         closure->im2->Ref();
     }
@@ -10,6 +10,7 @@
 #include "mapnik_color.hpp"
 #include "mapnik_palette.hpp"
 #include "utils.hpp"
+#include "mapnik_thread_pool.hpp"
 
 // boost
 #include MAPNIK_MAKE_SHARED_INCLUDE
@@ -332,7 +333,7 @@ NAN_METHOD(ImageView::encodeSync)
             s = save_to_string(image, format);
         }
 
-        NanReturnValue(NanNewBufferHandle((char*)s.data(),s.size()));
+        NanReturnValue(node_mapnik::string_to_buffer(s));
     }
     catch (std::exception const& ex)
     {
@@ -412,7 +413,7 @@ NAN_METHOD(ImageView::encode)
     closure->palette = palette;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_Encode, (uv_after_work_cb)EIO_AfterEncode);
+    node_mapnik::queue_work(&closure->request, EIO_Encode, EIO_AfterEncode);
     im->Ref();
     NanReturnUndefined();
 }
@@ -451,7 +452,7 @@ void ImageView::EIO_AfterEncode(uv_work_t* req)
     }
     else
     {
-        Local<Value> argv[2] = { NanNull(), NanNewBufferHandle((char*)closure->result.data(), closure->result.size()) };
+        Local<Value> argv[2] = { NanNull(), node_mapnik::string_to_buffer(closure->result) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
     }
 
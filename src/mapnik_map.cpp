@@ -4,6 +4,13 @@
 
 #include "mapnik_map.hpp"
 #include "utils.hpp"
+#include "mapnik_thread_pool.hpp"
+#include "mapnik_cancel_token.hpp"
+#include "render_layers.hpp"
+#include "render_empty.hpp"
+#include "render_parallel.hpp"
+#include "mapnik_stylesheet_cache.hpp"
+#include "mapnik_feature_cache.hpp"
 #include "mapnik_color.hpp"             // for Color, Color::constructor
 #include "mapnik_featureset.hpp"        // for Featureset
 #include "mapnik_grid.hpp"              // for Grid, Grid::constructor
@@ -12,6 +19,7 @@
 #include "mapnik_palette.hpp"           // for palette_ptr, Palette, etc
 #include "vector_tile_processor.hpp"
 #include "vector_tile_backend_pbf.hpp"
+#include "vector_tile_projection.hpp"
 #include "mapnik_vector_tile.hpp"
 #include "object_to_container.hpp"
 
@@ -25,6 +33,7 @@
 #include <mapnik/grid/grid.hpp>         // for hit_grid, grid
 #include <mapnik/grid/grid_renderer.hpp>  // for grid_renderer
 #include <mapnik/image_data.hpp>        // for image_data_rgba8
+#include <mapnik/image_view.hpp>        // for image_view
 #include <mapnik/image_util.hpp>        // for save_to_file, guess_type, etc
 #include <mapnik/layer.hpp>             // for layer
 #include <mapnik/load_map.hpp>          // for load_map, load_map_string
@@ -35,11 +44,16 @@
 #include <mapnik/request.hpp>
 
 // stl
+#include <algorithm>                    // for min
+#include <atomic>
 #include <exception>                    // for exception
 #include <iosfwd>                       // for ostringstream, ostream
 #include <iostream>                     // for clog
 #include <ostream>                      // for operator<<, basic_ostream, etc
 #include <sstream>                      // for basic_ostringstream, etc
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 // boost
 #include <boost/optional/optional.hpp>  // for optional
@@ -68,6 +82,8 @@ void Map::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(lcons, "clone", clone);
     NODE_SET_PROTOTYPE_METHOD(lcons, "save", save);
     NODE_SET_PROTOTYPE_METHOD(lcons, "clear", clear);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "setFeatureCache", setFeatureCache);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "featureCacheStats", featureCacheStats);
     NODE_SET_PROTOTYPE_METHOD(lcons, "toXML", to_string);
     NODE_SET_PROTOTYPE_METHOD(lcons, "resize", resize);
 
@@ -76,6 +92,8 @@ void Map::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(lcons, "renderSync", renderSync);
     NODE_SET_PROTOTYPE_METHOD(lcons, "renderFile", renderFile);
     NODE_SET_PROTOTYPE_METHOD(lcons, "renderFileSync", renderFileSync);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "renderMetatile", renderMetatile);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "renderMany", renderMany);
 
     NODE_SET_PROTOTYPE_METHOD(lcons, "zoomAll", zoomAll);
     NODE_SET_PROTOTYPE_METHOD(lcons, "zoomToBox", zoomToBox); //setExtent
@@ -126,17 +144,23 @@ void Map::Initialize(Handle<Object> target) {
 Map::Map(int width, int height) :
     ObjectWrap(),
     map_(MAPNIK_MAKE_SHARED<mapnik::Map>(width,height)),
-    in_use_(0) {}
+    in_use_(0),
+    clones_(),
+    generation_(0) {}
 
 Map::Map(int width, int height, std::string const& srs) :
     ObjectWrap(),
     map_(MAPNIK_MAKE_SHARED<mapnik::Map>(width,height,srs)),
-    in_use_(0) {}
+    in_use_(0),
+    clones_(),
+    generation_(0) {}
 
 Map::Map() :
     ObjectWrap(),
     map_(),
-    in_use_(0) {}
+    in_use_(0),
+    clones_(),
+    generation_(0) {}
 
 Map::~Map() { }
 
@@ -152,6 +176,26 @@ int Map::active() const {
     return in_use_;
 }
 
+map_ptr Map::take_clone() {
+    if (clones_.empty()) {
+        return map_ptr();
+    }
+    map_ptr clone = clones_.back();
+    clones_.pop_back();
+    return clone;
+}
+
+void Map::return_clone(map_ptr const& clone, unsigned generation) {
+    if (clone && generation == generation_) {
+        clones_.push_back(clone);
+    }
+}
+
+void Map::modified() {
+    clones_.clear();
+    ++generation_;
+}
+
 NAN_METHOD(Map::New)
 {
     NanScope();
@@ -207,6 +251,15 @@ NAN_METHOD(Map::New)
     NanReturnUndefined();
 }
 
+Handle<Value> Map::New(map_ptr map) {
+    NanEscapableScope();
+    Map* m = new Map();
+    m->map_ = map;
+    Handle<Value> ext = NanNew<External>(m);
+    Handle<Object> obj = NanNew(constructor)->GetFunction()->NewInstance(1, &ext);
+    return NanEscapeScope(obj);
+}
+
 NAN_GETTER(Map::get_prop)
 {
     NanScope();
@@ -279,6 +332,7 @@ NAN_SETTER(Map::set_prop)
 {
     NanScope();
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+    m->modified();
     std::string a = TOSTR(property);
     if(a == "extent" || a == "maximumExtent") {
         if (!value->IsArray()) {
@@ -405,6 +459,7 @@ NAN_METHOD(Map::loadFonts)
 {
     NanScope();
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+    m->modified();
     NanReturnValue(NanNew<Boolean>(m->map_->load_fonts()));
 }
 
@@ -456,6 +511,7 @@ NAN_METHOD(Map::registerFonts)
             }
         }
         std::string path = TOSTR(args[0]);
+        m->modified();
         NanReturnValue(NanNew(m->map_->register_fonts(path,recurse)));
     }
     catch (std::exception const& ex)
@@ -801,6 +857,7 @@ NAN_METHOD(Map::add_layer) {
     Layer *l = node::ObjectWrap::Unwrap<Layer>(obj);
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
     m->map_->MAPNIK_ADD_LAYER(*l->get());
+    m->modified();
     NanReturnUndefined();
 }
 
@@ -868,9 +925,80 @@ NAN_METHOD(Map::clear)
     NanScope();
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
     m->map_->remove_all();
+    m->modified();
+    NanReturnUndefined();
+}
+
+/**
+ * Enables a cache of decoded features shared by every layer of the map,
+ * and by its clones. Call with false to drop the cache.
+ */
+NAN_METHOD(Map::setFeatureCache)
+{
+    NanScope();
+
+    if (args.Length() != 1 || !(args[0]->IsObject() || args[0]->IsBoolean())) {
+        NanThrowTypeError("requires one argument: an options object, eg {max_size: 67108864}, or false");
+        NanReturnUndefined();
+    }
+
+    Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+    if (args[0]->IsBoolean()) {
+        if (args[0]->BooleanValue()) {
+            NanThrowTypeError("pass an options object to enable the feature cache");
+            NanReturnUndefined();
+        }
+        node_mapnik::set_feature_cache(*m->map_, node_mapnik::feature_cache_ptr());
+        m->modified();
+        NanReturnUndefined();
+    }
+
+    // defaults
+    double max_size = 64 * 1024 * 1024;
+    unsigned cell_size = 1024;
+
+    Local<Object> options = args[0]->ToObject();
+    if (options->Has(NanNew("max_size"))) {
+        Local<Value> bind_opt = options->Get(NanNew("max_size"));
+        if (!bind_opt->IsNumber() || bind_opt->NumberValue() <= 0) {
+            NanThrowTypeError("optional arg 'max_size' must be a positive number of bytes");
+            NanReturnUndefined();
+        }
+        max_size = bind_opt->NumberValue();
+    }
+
+    if (options->Has(NanNew("cell_size"))) {
+        Local<Value> bind_opt = options->Get(NanNew("cell_size"));
+        if (!bind_opt->IsNumber() || bind_opt->IntegerValue() <= 0) {
+            NanThrowTypeError("optional arg 'cell_size' must be a positive number of pixels");
+            NanReturnUndefined();
+        }
+        cell_size = bind_opt->IntegerValue();
+    }
+
+    node_mapnik::set_feature_cache(*m->map_,
+                                   MAPNIK_MAKE_SHARED<node_mapnik::feature_cache>(static_cast<std::size_t>(max_size), cell_size));
+    m->modified();
     NanReturnUndefined();
 }
 
+NAN_METHOD(Map::featureCacheStats)
+{
+    NanScope();
+    Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+    node_mapnik::feature_cache_ptr cache = node_mapnik::get_feature_cache(*m->map_);
+    if (!cache) {
+        NanReturnNull();
+    }
+    node_mapnik::feature_cache::stats_type stats = cache->stats();
+    Local<Object> obj = NanNew<Object>();
+    obj->Set(NanNew("entries"), NanNew<Number>(stats.entries));
+    obj->Set(NanNew("size"), NanNew<Number>(stats.size));
+    obj->Set(NanNew("hits"), NanNew<Number>(stats.hits));
+    obj->Set(NanNew("misses"), NanNew<Number>(stats.misses));
+    NanReturnValue(obj);
+}
+
 NAN_METHOD(Map::resize)
 {
     NanScope();
@@ -887,6 +1015,7 @@ NAN_METHOD(Map::resize)
 
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
     m->map_->resize(args[0]->IntegerValue(),args[1]->IntegerValue());
+    m->modified();
     NanReturnUndefined();
 }
 
@@ -897,6 +1026,7 @@ typedef struct {
     std::string stylesheet;
     std::string base_path;
     bool strict;
+    bool cache;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -962,6 +1092,19 @@ NAN_METHOD(Map::load)
         closure->base_path = TOSTR(param_val);
     }
 
+    param = NanNew("cache");
+    if (options->Has(param))
+    {
+        Local<Value> param_val = options->Get(param);
+        if (!param_val->IsBoolean())
+        {
+            delete closure;
+            NanThrowTypeError("'cache' must be a Boolean");
+            NanReturnUndefined();
+        }
+        closure->cache = param_val->BooleanValue();
+    }
+
     closure->stylesheet = TOSTR(stylesheet);
     closure->m = m;
     closure->strict = strict;
@@ -978,7 +1121,14 @@ void Map::EIO_Load(uv_work_t* req)
 
     try
     {
-        mapnik::load_map(*closure->m->map_,closure->stylesheet,closure->strict,closure->base_path);
+        if (closure->cache)
+        {
+            node_mapnik::load_map_cached(*closure->m->map_,closure->stylesheet,closure->strict,closure->base_path);
+        }
+        else
+        {
+            mapnik::load_map(*closure->m->map_,closure->stylesheet,closure->strict,closure->base_path);
+        }
     }
     catch (std::exception const& ex)
     {
@@ -993,6 +1143,8 @@ void Map::EIO_AfterLoad(uv_work_t* req)
 
     load_xml_baton_t *closure = static_cast<load_xml_baton_t *>(req->data);
 
+    closure->m->modified();
+
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
@@ -1018,6 +1170,7 @@ NAN_METHOD(Map::loadSync)
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
     std::string stylesheet = TOSTR(args[0]);
     bool strict = false;
+    bool cache = false;
     std::string base_path;
 
     if (args.Length() > 2)
@@ -1060,11 +1213,31 @@ NAN_METHOD(Map::loadSync)
             }
             base_path = TOSTR(param_val);
         }
+
+        param = NanNew("cache");
+        if (options->Has(param))
+        {
+            Local<Value> param_val = options->Get(param);
+            if (!param_val->IsBoolean())
+            {
+                NanThrowTypeError("'cache' must be a Boolean");
+                NanReturnUndefined();
+            }
+            cache = param_val->BooleanValue();
+        }
     }
 
+    m->modified();
     try
     {
-        mapnik::load_map(*m->map_,stylesheet,strict,base_path);
+        if (cache)
+        {
+            node_mapnik::load_map_cached(*m->map_,stylesheet,strict,base_path);
+        }
+        else
+        {
+            mapnik::load_map(*m->map_,stylesheet,strict,base_path);
+        }
     }
     catch (std::exception const& ex)
     {
@@ -1090,6 +1263,7 @@ NAN_METHOD(Map::fromStringSync)
 
     // defaults
     bool strict = false;
+    bool cache = false;
     std::string base_path("");
 
     if (args.Length() >= 2) {
@@ -1122,15 +1296,34 @@ NAN_METHOD(Map::fromStringSync)
             }
             base_path = TOSTR(param_val);
         }
+
+        param = NanNew("cache");
+        if (options->Has(param))
+        {
+            Local<Value> param_val = options->Get(param);
+            if (!param_val->IsBoolean()) {
+                NanThrowTypeError("'cache' must be a Boolean");
+                NanReturnUndefined();
+            }
+            cache = param_val->BooleanValue();
+        }
     }
 
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
 
     std::string stylesheet = TOSTR(args[0]);
 
+    m->modified();
     try
     {
-        mapnik::load_map_string(*m->map_,stylesheet,strict,base_path);
+        if (cache)
+        {
+            node_mapnik::load_map_string_cached(*m->map_,stylesheet,strict,base_path);
+        }
+        else
+        {
+            mapnik::load_map_string(*m->map_,stylesheet,strict,base_path);
+        }
     }
     catch (std::exception const& ex)
     {
@@ -1205,6 +1398,19 @@ NAN_METHOD(Map::fromString)
         closure->base_path = TOSTR(param_val);
     }
 
+    param = NanNew("cache");
+    if (options->Has(param))
+    {
+        Local<Value> param_val = options->Get(param);
+        if (!param_val->IsBoolean())
+        {
+            delete closure;
+            NanThrowTypeError("'cache' must be a Boolean");
+            NanReturnUndefined();
+        }
+        closure->cache = param_val->BooleanValue();
+    }
+
     closure->stylesheet = TOSTR(stylesheet);
     closure->m = m;
     closure->strict = strict;
@@ -1221,7 +1427,14 @@ void Map::EIO_FromString(uv_work_t* req)
 
     try
     {
-        mapnik::load_map_string(*closure->m->map_,closure->stylesheet,closure->strict,closure->base_path);
+        if (closure->cache)
+        {
+            node_mapnik::load_map_string_cached(*closure->m->map_,closure->stylesheet,closure->strict,closure->base_path);
+        }
+        else
+        {
+            mapnik::load_map_string(*closure->m->map_,closure->stylesheet,closure->strict,closure->base_path);
+        }
     }
     catch (std::exception const& ex)
     {
@@ -1236,6 +1449,8 @@ void Map::EIO_AfterFromString(uv_work_t* req)
 
     load_xml_baton_t *closure = static_cast<load_xml_baton_t *>(req->data);
 
+    closure->m->modified();
+
     TryCatch try_catch;
 
     if (closure->error) {
@@ -1255,10 +1470,7 @@ NAN_METHOD(Map::clone)
 {
     NanScope();
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
-    Map* m2 = new Map();
-    m2->map_ = MAPNIK_MAKE_SHARED<mapnik::Map>(*m->map_);
-    Handle<Value> ext = NanNew<External>(m2);
-    NanReturnValue(NanNew(constructor)->GetFunction()->NewInstance(1, &ext));
+    NanReturnValue(Map::New(MAPNIK_MAKE_SHARED<mapnik::Map>(*m->map_)));
 }
 
 NAN_METHOD(Map::save)
@@ -1344,23 +1556,42 @@ NAN_METHOD(Map::zoomToBox)
 struct image_baton_t {
     uv_work_t request;
     Map *m;
-    Image *im;
+    Image *im; // null when rendering straight to an encoded format
     int buffer_size; // TODO - no effect until mapnik::request is used
     double scale_factor;
     double scale_denominator;
     mapnik::attributes variables;
     unsigned offset_x;
     unsigned offset_y;
+    std::string format;
+    palette_ptr palette;
+    std::string result;
+    node_mapnik::render_cancel cancel;
+    bool collect_stats;
+    node_mapnik::render_stats stats;
+    node_mapnik::layer_ranges parallel;
+    node_mapnik::layer_mask layers;
+    bool skip_empty;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
     image_baton_t() :
+      im(NULL),
       buffer_size(0),
       scale_factor(1.0),
       scale_denominator(0.0),
       variables(),
       offset_x(0),
       offset_y(0),
+      format(),
+      palette(),
+      result(),
+      cancel(),
+      collect_stats(false),
+      stats(),
+      parallel(),
+      layers(),
+      skip_empty(false),
       error(false),
       error_name() {}
 };
@@ -1376,6 +1607,7 @@ struct grid_baton_t {
     mapnik::attributes variables;
     unsigned offset_x;
     unsigned offset_y;
+    node_mapnik::render_cancel cancel;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -1387,6 +1619,7 @@ struct grid_baton_t {
       variables(),
       offset_x(0),
       offset_y(0),
+      cancel(),
       error(false),
       error_name() {}
 };
@@ -1405,6 +1638,10 @@ struct vector_tile_baton_t {
     unsigned offset_y;
     std::string image_format;
     mapnik::scaling_method_e scaling_method;
+    node_mapnik::render_cancel cancel;
+    bool collect_stats;
+    node_mapnik::render_stats stats;
+    node_mapnik::layer_mask layers;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
@@ -1418,6 +1655,10 @@ struct vector_tile_baton_t {
         offset_y(0),
         image_format("jpeg"),
         scaling_method(mapnik::SCALING_NEAR),
+        cancel(),
+        collect_stats(false),
+        stats(),
+        layers(),
         error(false) {}
 };
 
@@ -1431,9 +1672,9 @@ NAN_METHOD(Map::render)
         NanReturnUndefined();
     }
 
-    // ensure renderable object
-    if (!args[0]->IsObject()) {
-        NanThrowTypeError("requires a renderable mapnik object to be passed as first argument");
+    // ensure renderable object or output format
+    if (!args[0]->IsObject() && !args[0]->IsString()) {
+        NanThrowTypeError("requires a renderable mapnik object or a format string to be passed as first argument");
         NanReturnUndefined();
     }
 
@@ -1452,7 +1693,7 @@ NAN_METHOD(Map::render)
             s << "render: this map appears to be in use by "
               << m->active()
               << " other thread(s) which is not allowed."
-              << " You need to use a map pool to avoid sharing map objects between concurrent rendering";
+              << " You need to use a map pool (see mapnik.MapPool) to avoid sharing map objects between concurrent rendering";
             std::clog << s.str() << "\n";
         }
 
@@ -1464,6 +1705,16 @@ NAN_METHOD(Map::render)
         double scale_denominator = 0.0;
         unsigned offset_x = 0;
         unsigned offset_y = 0;
+        std::string format;
+        palette_ptr palette;
+        node_mapnik::render_cancel cancel;
+        bool collect_stats = false;
+        node_mapnik::layer_ranges parallel;
+        node_mapnik::layer_mask layers;
+        bool skip_empty = false;
+        if (args[0]->IsString()) {
+            format = TOSTR(args[0]);
+        }
 
         Local<Object> options = NanNew<Object>();
 
@@ -1526,6 +1777,114 @@ NAN_METHOD(Map::render)
 
                 offset_y = bind_opt->IntegerValue();
             }
+
+            if (!node_mapnik::parse_cancel_options(options, cancel)) {
+                NanReturnUndefined();
+            }
+
+            if (options->Has(NanNew("stats"))) {
+                Local<Value> bind_opt = options->Get(NanNew("stats"));
+                if (!bind_opt->IsBoolean()) {
+                    NanThrowTypeError("optional arg 'stats' must be a boolean");
+                    NanReturnUndefined();
+                }
+
+                collect_stats = bind_opt->BooleanValue();
+            }
+
+            if (options->Has(NanNew("parallel"))) {
+                if (!node_mapnik::parse_parallel_option(options->Get(NanNew("parallel")), *m->map_, parallel)) {
+                    NanReturnUndefined();
+                }
+            }
+
+            if (options->Has(NanNew("layers"))) {
+                if (!node_mapnik::parse_layers_option(options->Get(NanNew("layers")), *m->map_, layers)) {
+                    NanReturnUndefined();
+                }
+            }
+
+            if (options->Has(NanNew("skipEmpty"))) {
+                Local<Value> bind_opt = options->Get(NanNew("skipEmpty"));
+                if (!bind_opt->IsBoolean()) {
+                    NanThrowTypeError("optional arg 'skipEmpty' must be a boolean");
+                    NanReturnUndefined();
+                }
+
+                skip_empty = bind_opt->BooleanValue();
+            }
+
+            if (args[0]->IsString()) {
+                // the format argument is authoritative; the option is only
+                // accepted when it says the same thing
+                if (options->Has(NanNew("format"))) {
+                    Local<Value> bind_opt = options->Get(NanNew("format"));
+                    if (!bind_opt->IsString()) {
+                        NanThrowTypeError("optional arg 'format' must be a string");
+                        NanReturnUndefined();
+                    }
+
+                    if (format != TOSTR(bind_opt)) {
+                        NanThrowTypeError("optional arg 'format' conflicts with the format argument");
+                        NanReturnUndefined();
+                    }
+                }
+
+                if (options->Has(NanNew("palette"))) {
+                    Local<Value> bind_opt = options->Get(NanNew("palette"));
+                    if (!bind_opt->IsObject()) {
+                        NanThrowTypeError("'palette' must be an object");
+                        NanReturnUndefined();
+                    }
+
+                    Local<Object> pal = bind_opt->ToObject();
+                    if (pal->IsNull() || pal->IsUndefined() || !NanNew(Palette::constructor)->HasInstance(pal)) {
+                        NanThrowTypeError("mapnik.Palette expected as 'palette' option");
+                        NanReturnUndefined();
+                    }
+
+                    palette = node::ObjectWrap::Unwrap<Palette>(pal)->palette();
+                }
+            }
+        }
+
+        if (args[0]->IsString()) {
+
+            // render and encode in a single pass on the threadpool,
+            // calling back with the encoded bytes rather than an Image
+            image_baton_t *closure = new image_baton_t();
+            closure->request.data = closure;
+            closure->m = m;
+            closure->buffer_size = buffer_size;
+            closure->scale_factor = scale_factor;
+            closure->scale_denominator = scale_denominator;
+            closure->offset_x = offset_x;
+            closure->offset_y = offset_y;
+            closure->format = format;
+            closure->palette = palette;
+            closure->cancel = cancel;
+            closure->collect_stats = collect_stats;
+            closure->parallel = parallel;
+            closure->layers = layers;
+            closure->skip_empty = skip_empty;
+            closure->error = false;
+
+            if (options->Has(NanNew("variables")))
+            {
+                Local<Value> bind_opt = options->Get(NanNew("variables"));
+                if (!bind_opt->IsObject())
+                {
+                    delete closure;
+                    NanThrowTypeError("optional arg 'variables' must be an object");
+                    NanReturnUndefined();
+                }
+                object_to_container(closure->variables,bind_opt->ToObject());
+            }
+            NanAssignPersistent(closure->cb, args[args.Length() - 1].As<Function>());
+            node_mapnik::queue_work(&closure->request, EIO_RenderImage, EIO_AfterRenderImage);
+            m->acquire();
+            m->Ref();
+            NanReturnUndefined();
         }
 
         Local<Object> obj = args[0]->ToObject();
@@ -1546,6 +1905,11 @@ NAN_METHOD(Map::render)
             closure->scale_denominator = scale_denominator;
             closure->offset_x = offset_x;
             closure->offset_y = offset_y;
+            closure->cancel = cancel;
+            closure->collect_stats = collect_stats;
+            closure->parallel = parallel;
+            closure->layers = layers;
+            closure->skip_empty = skip_empty;
             closure->error = false;
 
             if (options->Has(NanNew("variables")))
@@ -1560,7 +1924,7 @@ NAN_METHOD(Map::render)
                 object_to_container(closure->variables,bind_opt->ToObject());
             }
             NanAssignPersistent(closure->cb, args[args.Length() - 1].As<Function>());
-            uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderImage, (uv_after_work_cb)EIO_AfterRenderImage);
+            node_mapnik::queue_work(&closure->request, EIO_RenderImage, EIO_AfterRenderImage);
 
         } else if (NanNew(Grid::constructor)->HasInstance(obj)) {
 
@@ -1670,13 +2034,22 @@ NAN_METHOD(Map::render)
             closure->scale_denominator = scale_denominator;
             closure->offset_x = offset_x;
             closure->offset_y = offset_y;
+            closure->cancel = cancel;
             closure->error = false;
             NanAssignPersistent(closure->cb, args[args.Length() - 1].As<Function>());
-            uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderGrid, (uv_after_work_cb)EIO_AfterRenderGrid);
+            node_mapnik::queue_work(&closure->request, EIO_RenderGrid, EIO_AfterRenderGrid);
         } else if (NanNew(VectorTile::constructor)->HasInstance(obj)) {
 
-            vector_tile_baton_t *closure = new vector_tile_baton_t();
             VectorTile * vector_tile_obj = node::ObjectWrap::Unwrap<VectorTile>(obj);
+            if (vector_tile_obj->active() != 0) {
+                std::ostringstream s;
+                s << "render: this tile appears to be in use by "
+                  << vector_tile_obj->active()
+                  << " async operation(s) and its data cannot be changed until they finish";
+                NanThrowError(s.str().c_str());
+                NanReturnUndefined();
+            }
+            vector_tile_baton_t *closure = new vector_tile_baton_t();
 
             if (options->Has(NanNew("image_scaling"))) {
                 Local<Value> param_val = options->Get(NanNew("image_scaling"));
@@ -1746,9 +2119,13 @@ NAN_METHOD(Map::render)
             closure->scale_denominator = scale_denominator;
             closure->offset_x = offset_x;
             closure->offset_y = offset_y;
+            closure->cancel = cancel;
+            closure->collect_stats = collect_stats;
+            closure->layers = layers;
             closure->error = false;
             NanAssignPersistent(closure->cb, args[args.Length() - 1].As<Function>());
-            uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderVectorTile, (uv_after_work_cb)EIO_AfterRenderVectorTile);
+            node_mapnik::queue_work(&closure->request, EIO_RenderVectorTile, EIO_AfterRenderVectorTile);
+            vector_tile_obj->acquire();
         } else {
             NanThrowTypeError("renderable mapnik object expected");
             NanReturnUndefined();
@@ -1770,6 +2147,7 @@ void Map::EIO_RenderVectorTile(uv_work_t* req)
     vector_tile_baton_t *closure = static_cast<vector_tile_baton_t *>(req->data);
     try
     {
+        closure->cancel.check();
         typedef mapnik::vector_tile_impl::backend_pbf backend_type;
         typedef mapnik::vector_tile_impl::processor<backend_type> renderer_type;
         backend_type backend(closure->d->get_tile_nonconst(),
@@ -1786,7 +2164,15 @@ void Map::EIO_RenderVectorTile(uv_work_t* req)
                           closure->tolerance,
                           closure->image_format,
                           closure->scaling_method);
-        ren.apply(closure->scale_denominator);
+        node_mapnik::process_map_layers(ren,
+                                        map,
+                                        m_req,
+                                        closure->scale_denominator,
+                                        closure->scale_factor,
+                                        closure->variables,
+                                        closure->cancel,
+                                        closure->collect_stats ? &closure->stats : NULL,
+                                        closure->layers);
         closure->d->painted(ren.painted());
         closure->d->cache_bytesize();
 
@@ -1805,10 +2191,14 @@ void Map::EIO_AfterRenderVectorTile(uv_work_t* req)
     vector_tile_baton_t *closure = static_cast<vector_tile_baton_t *>(req->data);
 
     closure->m->release();
+    closure->d->release();
 
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    } else if (closure->collect_stats) {
+        Local<Value> argv[3] = { NanNull(), NanObjectWrapHandle(closure->d), node_mapnik::stats_to_object(closure->stats) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 3, argv);
     } else {
         Local<Value> argv[2] = { NanNull(), NanObjectWrapHandle(closure->d) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
@@ -1829,6 +2219,7 @@ void Map::EIO_RenderGrid(uv_work_t* req)
 
     try
     {
+        closure->cancel.check();
         // copy property names
         std::set<std::string> attributes = closure->g->get()->property_names();
 
@@ -1852,7 +2243,22 @@ void Map::EIO_RenderGrid(uv_work_t* req)
                                                 closure->offset_x,
                                                 closure->offset_y);
         mapnik::layer const& layer = layers[closure->layer_idx];
-        ren.apply(layer,attributes,closure->scale_denominator);
+        if (closure->cancel.enabled())
+        {
+            ren.apply(node_mapnik::wrap_layer(layer,
+                                              closure->cancel,
+                                              NULL,
+                                              *closure->m->map_,
+                                              closure->scale_denominator,
+                                              closure->variables),
+                      attributes,
+                      closure->scale_denominator);
+            closure->cancel.check();
+        }
+        else
+        {
+            ren.apply(layer,attributes,closure->scale_denominator);
+        }
 
     }
     catch (std::exception const& ex)
@@ -1893,17 +2299,100 @@ void Map::EIO_RenderImage(uv_work_t* req)
 
     try
     {
+        // drop renders that were cancelled or timed out while queued
+        closure->cancel.check();
         mapnik::Map const& map = *closure->m->map_;
         mapnik::request m_req(map.width(),map.height(),map.get_current_extent());
         m_req.set_buffer_size(closure->buffer_size);
-        mapnik::agg_renderer<mapnik::image_32> ren(map,
-                                                   m_req,
-                                                   closure->variables,
-                                                   *closure->im->get(),
-                                                   closure->scale_factor,
-                                                   closure->offset_x,
-                                                   closure->offset_y);
-        ren.apply(closure->scale_denominator);
+        // a tile without features is just the background, which is cheap to
+        // fill in and, once encoded, the same for every empty tile
+        if (closure->skip_empty && !map.background_image())
+        {
+            node_mapnik::stats_clock::time_point render_start = node_mapnik::stats_clock::now();
+            bool has_features = node_mapnik::map_has_features(map,
+                                                              m_req,
+                                                              closure->scale_denominator,
+                                                              closure->scale_factor,
+                                                              closure->variables,
+                                                              closure->layers);
+            closure->stats.render_time = node_mapnik::elapsed_ms(render_start);
+            if (!has_features)
+            {
+                if (closure->im)
+                {
+                    node_mapnik::render_background(map, *closure->im->get());
+                }
+                else if (closure->palette.get())
+                {
+                    mapnik::image_32 im(map.width(),map.height());
+                    node_mapnik::render_background(map, im);
+                    closure->result = save_to_string(im, closure->format, *closure->palette);
+                }
+                else
+                {
+                    closure->result = node_mapnik::encoded_background(map, closure->format);
+                }
+                return;
+            }
+        }
+        image_ptr im;
+        if (closure->im)
+        {
+            im = closure->im->get();
+        }
+        else
+        {
+            im = MAPNIK_MAKE_SHARED<mapnik::image_32>(map.width(),map.height());
+        }
+        // a background image would be repeated in every group, so such maps
+        // are always rendered in a single pass
+        if (closure->parallel.size() > 1 && !map.background_image())
+        {
+            node_mapnik::render_parallel(map,
+                                         m_req,
+                                         closure->variables,
+                                         *im,
+                                         closure->scale_denominator,
+                                         closure->scale_factor,
+                                         closure->offset_x,
+                                         closure->offset_y,
+                                         closure->parallel,
+                                         closure->cancel,
+                                         closure->collect_stats ? &closure->stats : NULL,
+                                         closure->layers);
+        }
+        else
+        {
+            mapnik::agg_renderer<mapnik::image_32> ren(map,
+                                                       m_req,
+                                                       closure->variables,
+                                                       *im,
+                                                       closure->scale_factor,
+                                                       closure->offset_x,
+                                                       closure->offset_y);
+            node_mapnik::render_layers(ren,
+                                       map,
+                                       m_req,
+                                       closure->scale_denominator,
+                                       closure->scale_factor,
+                                       closure->variables,
+                                       closure->cancel,
+                                       closure->collect_stats ? &closure->stats : NULL,
+                                       closure->layers);
+        }
+        if (!closure->im)
+        {
+            node_mapnik::stats_clock::time_point encode_start = node_mapnik::stats_clock::now();
+            if (closure->palette.get())
+            {
+                closure->result = save_to_string(*im, closure->format, *closure->palette);
+            }
+            else
+            {
+                closure->result = save_to_string(*im, closure->format);
+            }
+            closure->stats.encode_time = node_mapnik::elapsed_ms(encode_start);
+        }
     }
     catch (std::exception const& ex)
     {
@@ -1924,63 +2413,765 @@ void Map::EIO_AfterRenderImage(uv_work_t* req)
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
     } else {
-        Local<Value> argv[2] = { NanNull(), NanObjectWrapHandle(closure->im) };
-        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+        Local<Value> result;
+        if (closure->im) {
+            result = NanObjectWrapHandle(closure->im);
+        } else {
+            result = node_mapnik::string_to_buffer(closure->result);
+        }
+        if (closure->collect_stats) {
+            Local<Value> argv[3] = { NanNull(), result, node_mapnik::stats_to_object(closure->stats) };
+            NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 3, argv);
+        } else {
+            Local<Value> argv[2] = { NanNull(), result };
+            NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+        }
     }
 
     closure->m->Unref();
-    closure->im->_unref();
+    if (closure->im) closure->im->_unref();
     NanDisposePersistent(closure->cb);
     delete closure;
 }
 
-typedef struct {
+struct metatile_baton_t {
     uv_work_t request;
     Map *m;
+    int z;
+    int x;
+    int y;
+    unsigned metatile;
     std::string format;
-    std::string output;
     palette_ptr palette;
+    int buffer_size;
     double scale_factor;
     double scale_denominator;
     mapnik::attributes variables;
-    bool use_cairo;
-    int buffer_size; // TODO - no effect until mapnik::request is used
+    std::vector<std::string> tiles;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
-} render_file_baton_t;
+    metatile_baton_t() :
+      z(0),
+      x(0),
+      y(0),
+      metatile(1),
+      format("png"),
+      palette(),
+      buffer_size(0),
+      scale_factor(1.0),
+      scale_denominator(0.0),
+      variables(),
+      tiles(),
+      error(false),
+      error_name() {}
+};
 
-NAN_METHOD(Map::renderFile)
+/**
+ * Renders the metatile containing tile z/x/y in one pass and splits and
+ * encodes each sub-tile on the worker thread. The map must be in spherical
+ * mercator, and its width and height set the size of each sub-tile.
+ *
+ * Calls back with an array of Buffers in row-major order. The array starts
+ * at the metatile origin: x - x % metatile, y - y % metatile.
+ */
+NAN_METHOD(Map::renderMetatile)
 {
     NanScope();
 
-    if (args.Length() < 1 || !args[0]->IsString()) {
-        NanThrowTypeError("first argument must be a path to a file to save");
+    if (args.Length() < 4) {
+        NanThrowTypeError("requires at least four arguments: z, x, y, and a callback");
         NanReturnUndefined();
     }
 
-    // defaults
-    std::string format = "png";
-    double scale_factor = 1.0;
-    double scale_denominator = 0.0;
-    palette_ptr palette;
-    int buffer_size = 0;
-
-    Local<Value> callback = args[args.Length()-1];
+    if (!args[0]->IsNumber() || !args[1]->IsNumber() || !args[2]->IsNumber()) {
+        NanThrowTypeError("z, x, and y must be integers");
+        NanReturnUndefined();
+    }
 
-    if (!callback->IsFunction()) {
+    if (!args[args.Length()-1]->IsFunction()) {
         NanThrowTypeError("last argument must be a callback function");
         NanReturnUndefined();
     }
 
-    Local<Object> options = NanNew<Object>();
+    int z = args[0]->IntegerValue();
+    int x = args[1]->IntegerValue();
+    int y = args[2]->IntegerValue();
+    if (z < 0 || z > 30) {
+        NanThrowTypeError("z must be an integer between 0 and 30");
+        NanReturnUndefined();
+    }
+    int dim = 1 << z;
+    if (x < 0 || x >= dim || y < 0 || y >= dim) {
+        NanThrowTypeError("x and y must be valid tile coordinates for the given zoom level");
+        NanReturnUndefined();
+    }
 
-    if (!args[1]->IsFunction() && args[1]->IsObject()) {
-        options = args[1]->ToObject();
-        if (options->Has(NanNew("format")))
-        {
-            Local<Value> format_opt = options->Get(NanNew("format"));
-            if (!format_opt->IsString()) {
+    Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+    metatile_baton_t *closure = new metatile_baton_t();
+
+    if (args.Length() > 4) {
+        if (!args[3]->IsObject()) {
+            delete closure;
+            NanThrowTypeError("optional fourth argument must be an options object");
+            NanReturnUndefined();
+        }
+
+        Local<Object> options = args[3]->ToObject();
+
+        if (options->Has(NanNew("metatile"))) {
+            Local<Value> bind_opt = options->Get(NanNew("metatile"));
+            if (!bind_opt->IsNumber() || bind_opt->IntegerValue() <= 0) {
+                delete closure;
+                NanThrowTypeError("optional arg 'metatile' must be a positive integer");
+                NanReturnUndefined();
+            }
+            closure->metatile = bind_opt->IntegerValue();
+        }
+
+        if (options->Has(NanNew("format"))) {
+            Local<Value> bind_opt = options->Get(NanNew("format"));
+            if (!bind_opt->IsString()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'format' must be a string");
+                NanReturnUndefined();
+            }
+            closure->format = TOSTR(bind_opt);
+        }
+
+        if (options->Has(NanNew("palette"))) {
+            Local<Value> bind_opt = options->Get(NanNew("palette"));
+            if (!bind_opt->IsObject()) {
+                delete closure;
+                NanThrowTypeError("'palette' must be an object");
+                NanReturnUndefined();
+            }
+            Local<Object> obj = bind_opt->ToObject();
+            if (obj->IsNull() || obj->IsUndefined() || !NanNew(Palette::constructor)->HasInstance(obj)) {
+                delete closure;
+                NanThrowTypeError("mapnik.Palette expected as 'palette' option");
+                NanReturnUndefined();
+            }
+            closure->palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+        }
+
+        if (options->Has(NanNew("buffer_size"))) {
+            Local<Value> bind_opt = options->Get(NanNew("buffer_size"));
+            if (!bind_opt->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'buffer_size' must be a number");
+                NanReturnUndefined();
+            }
+            closure->buffer_size = bind_opt->IntegerValue();
+        }
+
+        if (options->Has(NanNew("scale"))) {
+            Local<Value> bind_opt = options->Get(NanNew("scale"));
+            if (!bind_opt->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'scale' must be a number");
+                NanReturnUndefined();
+            }
+            closure->scale_factor = bind_opt->NumberValue();
+        }
+
+        if (options->Has(NanNew("scale_denominator"))) {
+            Local<Value> bind_opt = options->Get(NanNew("scale_denominator"));
+            if (!bind_opt->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'scale_denominator' must be a number");
+                NanReturnUndefined();
+            }
+            closure->scale_denominator = bind_opt->NumberValue();
+        }
+
+        if (options->Has(NanNew("variables"))) {
+            Local<Value> bind_opt = options->Get(NanNew("variables"));
+            if (!bind_opt->IsObject()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'variables' must be an object");
+                NanReturnUndefined();
+            }
+            object_to_container(closure->variables,bind_opt->ToObject());
+        }
+    }
+
+    if (m->active() != 0) {
+        std::ostringstream s;
+        s << "renderMetatile: this map appears to be in use by "
+          << m->active()
+          << " other thread(s) which is not allowed."
+          << " You need to use a map pool (see mapnik.MapPool) to avoid sharing map objects between concurrent rendering";
+        std::clog << s.str() << "\n";
+    }
+
+    closure->request.data = closure;
+    closure->m = m;
+    closure->z = z;
+    closure->x = x;
+    closure->y = y;
+    NanAssignPersistent(closure->cb, args[args.Length() - 1].As<Function>());
+    node_mapnik::queue_work(&closure->request, EIO_RenderMetatile, EIO_AfterRenderMetatile);
+    m->acquire();
+    m->Ref();
+    NanReturnUndefined();
+}
+
+void Map::EIO_RenderMetatile(uv_work_t* req)
+{
+    metatile_baton_t *closure = static_cast<metatile_baton_t *>(req->data);
+
+    try
+    {
+        mapnik::Map const& map = *closure->m->map_;
+        unsigned tile_width = map.width();
+        unsigned tile_height = map.height();
+        unsigned dim = 1u << closure->z;
+        unsigned meta = std::min(closure->metatile, dim);
+        unsigned meta_x = closure->x - (closure->x % meta);
+        unsigned meta_y = closure->y - (closure->y % meta);
+        // metatiles touching the edge of the grid are truncated
+        unsigned cols = std::min(meta, dim - meta_x);
+        unsigned rows = std::min(meta, dim - meta_y);
+
+        mapnik::vector_tile_impl::spherical_mercator merc(tile_width);
+        double minx,miny,maxx,maxy;
+        double ignore_x,ignore_y;
+        merc.xyz(meta_x,meta_y,closure->z,minx,ignore_y,ignore_x,maxy);
+        merc.xyz(meta_x + cols - 1,meta_y + rows - 1,closure->z,ignore_x,miny,maxx,ignore_y);
+        mapnik::box2d<double> extent(minx,miny,maxx,maxy);
+
+        mapnik::image_32 im(tile_width * cols, tile_height * rows);
+        mapnik::request m_req(im.width(),im.height(),extent);
+        m_req.set_buffer_size(closure->buffer_size);
+        mapnik::agg_renderer<mapnik::image_32> ren(map,
+                                                   m_req,
+                                                   closure->variables,
+                                                   im,
+                                                   closure->scale_factor);
+        ren.apply(closure->scale_denominator);
+
+        closure->tiles.reserve(cols * rows);
+        for (unsigned row = 0; row < rows; ++row)
+        {
+            for (unsigned col = 0; col < cols; ++col)
+            {
+                mapnik::image_view<mapnik::image_data_rgba8> view = im.get_view(col * tile_width,
+                                                                                row * tile_height,
+                                                                                tile_width,
+                                                                                tile_height);
+                if (closure->palette.get())
+                {
+                    closure->tiles.push_back(save_to_string(view, closure->format, *closure->palette));
+                }
+                else
+                {
+                    closure->tiles.push_back(save_to_string(view, closure->format));
+                }
+            }
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void Map::EIO_AfterRenderMetatile(uv_work_t* req)
+{
+    NanScope();
+
+    metatile_baton_t *closure = static_cast<metatile_baton_t *>(req->data);
+
+    closure->m->release();
+
+    if (closure->error) {
+        Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    } else {
+        Local<Array> tiles = NanNew<Array>(closure->tiles.size());
+        for (std::size_t i = 0; i < closure->tiles.size(); ++i)
+        {
+            tiles->Set(i, node_mapnik::string_to_buffer(closure->tiles[i]));
+        }
+        Local<Value> argv[2] = { NanNull(), tiles };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+    }
+
+    closure->m->Unref();
+    NanDisposePersistent(closure->cb);
+    delete closure;
+}
+
+struct render_many_entry {
+    mapnik::box2d<double> extent;
+    std::string format;
+    std::string result;
+    bool error;
+    std::string error_name;
+    render_many_entry() :
+      extent(),
+      format(),
+      result(),
+      error(false),
+      error_name() {}
+};
+
+struct render_many_baton_t;
+
+// one of the jobs the entries are split between, each with its own map
+struct render_many_job {
+    uv_work_t request;
+    render_many_baton_t *closure;
+    map_ptr map;
+    bool error;
+    std::string error_name;
+    render_many_job() :
+      closure(NULL),
+      map(),
+      error(false),
+      error_name() {}
+};
+
+struct render_many_baton_t {
+    Map *m;
+    std::vector<render_many_entry> entries;
+    std::vector<render_many_job> jobs;
+    palette_ptr palette;
+    int buffer_size;
+    double scale_factor;
+    double scale_denominator;
+    mapnik::attributes variables;
+    unsigned concurrency;
+    node_mapnik::render_cancel cancel;
+    unsigned generation;
+    std::atomic<std::size_t> next;
+    std::atomic<bool> failed;
+    std::size_t remaining; // jobs still running, main thread only
+    Persistent<Function> cb;
+    render_many_baton_t() :
+      entries(),
+      jobs(),
+      palette(),
+      buffer_size(0),
+      scale_factor(1.0),
+      scale_denominator(0.0),
+      variables(),
+      concurrency(0),
+      cancel(),
+      generation(0),
+      next(0),
+      failed(false),
+      remaining(0) {}
+};
+
+/**
+ * Renders and encodes a list of extents. Each entry is either
+ * {bbox: [minx,miny,maxx,maxy]} in the map srs or {z, x, y} for a
+ * spherical mercator tile, with an optional per entry 'format'. Entries are
+ * split between up to 'concurrency' jobs on the worker pool. The first job
+ * renders with the map itself and the others with clones of it, which are
+ * kept for later calls until the map is changed.
+ *
+ * Calls back with an array of Buffers in the order of the entries.
+ */
+NAN_METHOD(Map::renderMany)
+{
+    NanScope();
+
+    if (args.Length() < 2) {
+        NanThrowTypeError("requires at least two arguments: an array of entries and a callback");
+        NanReturnUndefined();
+    }
+
+    if (!args[0]->IsArray()) {
+        NanThrowTypeError("first argument must be an array of entries");
+        NanReturnUndefined();
+    }
+
+    if (!args[args.Length()-1]->IsFunction()) {
+        NanThrowTypeError("last argument must be a callback function");
+        NanReturnUndefined();
+    }
+
+    Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+    render_many_baton_t *closure = new render_many_baton_t();
+    std::string format("png");
+
+    if (args.Length() > 2) {
+        if (!args[1]->IsObject()) {
+            delete closure;
+            NanThrowTypeError("optional second argument must be an options object");
+            NanReturnUndefined();
+        }
+
+        Local<Object> options = args[1]->ToObject();
+
+        if (options->Has(NanNew("format"))) {
+            Local<Value> bind_opt = options->Get(NanNew("format"));
+            if (!bind_opt->IsString()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'format' must be a string");
+                NanReturnUndefined();
+            }
+            format = TOSTR(bind_opt);
+        }
+
+        if (options->Has(NanNew("palette"))) {
+            Local<Value> bind_opt = options->Get(NanNew("palette"));
+            if (!bind_opt->IsObject()) {
+                delete closure;
+                NanThrowTypeError("'palette' must be an object");
+                NanReturnUndefined();
+            }
+            Local<Object> obj = bind_opt->ToObject();
+            if (obj->IsNull() || obj->IsUndefined() || !NanNew(Palette::constructor)->HasInstance(obj)) {
+                delete closure;
+                NanThrowTypeError("mapnik.Palette expected as 'palette' option");
+                NanReturnUndefined();
+            }
+            closure->palette = node::ObjectWrap::Unwrap<Palette>(obj)->palette();
+        }
+
+        if (options->Has(NanNew("buffer_size"))) {
+            Local<Value> bind_opt = options->Get(NanNew("buffer_size"));
+            if (!bind_opt->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'buffer_size' must be a number");
+                NanReturnUndefined();
+            }
+            closure->buffer_size = bind_opt->IntegerValue();
+        }
+
+        if (options->Has(NanNew("scale"))) {
+            Local<Value> bind_opt = options->Get(NanNew("scale"));
+            if (!bind_opt->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'scale' must be a number");
+                NanReturnUndefined();
+            }
+            closure->scale_factor = bind_opt->NumberValue();
+        }
+
+        if (options->Has(NanNew("scale_denominator"))) {
+            Local<Value> bind_opt = options->Get(NanNew("scale_denominator"));
+            if (!bind_opt->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'scale_denominator' must be a number");
+                NanReturnUndefined();
+            }
+            closure->scale_denominator = bind_opt->NumberValue();
+        }
+
+        if (options->Has(NanNew("variables"))) {
+            Local<Value> bind_opt = options->Get(NanNew("variables"));
+            if (!bind_opt->IsObject()) {
+                delete closure;
+                NanThrowTypeError("optional arg 'variables' must be an object");
+                NanReturnUndefined();
+            }
+            object_to_container(closure->variables,bind_opt->ToObject());
+        }
+
+        if (options->Has(NanNew("concurrency"))) {
+            Local<Value> bind_opt = options->Get(NanNew("concurrency"));
+            if (!bind_opt->IsNumber() || bind_opt->IntegerValue() <= 0) {
+                delete closure;
+                NanThrowTypeError("optional arg 'concurrency' must be a positive integer");
+                NanReturnUndefined();
+            }
+            closure->concurrency = bind_opt->IntegerValue();
+        }
+
+        if (!node_mapnik::parse_cancel_options(options, closure->cancel)) {
+            delete closure;
+            NanReturnUndefined();
+        }
+    }
+
+    Local<Array> entries = Local<Array>::Cast(args[0]);
+    unsigned num_entries = entries->Length();
+    closure->entries.resize(num_entries);
+    mapnik::vector_tile_impl::spherical_mercator merc(m->map_->width());
+    for (unsigned i = 0; i < num_entries; ++i) {
+        Local<Value> entry_val = entries->Get(i);
+        if (!entry_val->IsObject()) {
+            delete closure;
+            NanThrowTypeError("each entry must be an object with a 'bbox' or 'z', 'x' and 'y'");
+            NanReturnUndefined();
+        }
+        Local<Object> entry_obj = entry_val->ToObject();
+        render_many_entry & entry = closure->entries[i];
+        entry.format = format;
+
+        if (entry_obj->Has(NanNew("bbox"))) {
+            Local<Value> bbox_val = entry_obj->Get(NanNew("bbox"));
+            if (!bbox_val->IsArray() || Local<Array>::Cast(bbox_val)->Length() != 4) {
+                delete closure;
+                NanThrowTypeError("'bbox' must be an array of [minx,miny,maxx,maxy]");
+                NanReturnUndefined();
+            }
+            Local<Array> bbox = Local<Array>::Cast(bbox_val);
+            for (unsigned j = 0; j < 4; ++j) {
+                if (!bbox->Get(j)->IsNumber()) {
+                    delete closure;
+                    NanThrowTypeError("'bbox' must be an array of [minx,miny,maxx,maxy]");
+                    NanReturnUndefined();
+                }
+            }
+            entry.extent.init(bbox->Get(0)->NumberValue(),
+                              bbox->Get(1)->NumberValue(),
+                              bbox->Get(2)->NumberValue(),
+                              bbox->Get(3)->NumberValue());
+        } else if (entry_obj->Has(NanNew("z")) && entry_obj->Has(NanNew("x")) && entry_obj->Has(NanNew("y"))) {
+            Local<Value> z_val = entry_obj->Get(NanNew("z"));
+            Local<Value> x_val = entry_obj->Get(NanNew("x"));
+            Local<Value> y_val = entry_obj->Get(NanNew("y"));
+            if (!z_val->IsNumber() || !x_val->IsNumber() || !y_val->IsNumber()) {
+                delete closure;
+                NanThrowTypeError("z, x, and y must be integers");
+                NanReturnUndefined();
+            }
+            int z = z_val->IntegerValue();
+            int x = x_val->IntegerValue();
+            int y = y_val->IntegerValue();
+            if (z < 0 || z > 30) {
+                delete closure;
+                NanThrowTypeError("z must be an integer between 0 and 30");
+                NanReturnUndefined();
+            }
+            int dim = 1 << z;
+            if (x < 0 || x >= dim || y < 0 || y >= dim) {
+                delete closure;
+                NanThrowTypeError("x and y must be valid tile coordinates for the given zoom level");
+                NanReturnUndefined();
+            }
+            double minx,miny,maxx,maxy;
+            merc.xyz(x,y,z,minx,miny,maxx,maxy);
+            entry.extent.init(minx,miny,maxx,maxy);
+        } else {
+            delete closure;
+            NanThrowTypeError("each entry must be an object with a 'bbox' or 'z', 'x' and 'y'");
+            NanReturnUndefined();
+        }
+
+        if (entry_obj->Has(NanNew("format"))) {
+            Local<Value> format_val = entry_obj->Get(NanNew("format"));
+            if (!format_val->IsString()) {
+                delete closure;
+                NanThrowTypeError("entry 'format' must be a string");
+                NanReturnUndefined();
+            }
+            entry.format = TOSTR(format_val);
+        }
+    }
+
+    if (m->active() != 0) {
+        std::ostringstream s;
+        s << "renderMany: this map appears to be in use by "
+          << m->active()
+          << " other thread(s) which is not allowed."
+          << " You need to use a map pool (see mapnik.MapPool) to avoid sharing map objects between concurrent rendering";
+        std::clog << s.str() << "\n";
+    }
+
+    std::size_t job_count = closure->concurrency;
+    if (job_count == 0)
+    {
+        job_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    job_count = std::max<std::size_t>(1, std::min<std::size_t>(job_count, num_entries));
+    closure->m = m;
+    closure->generation = m->generation();
+    closure->remaining = job_count;
+    closure->jobs.resize(job_count);
+    for (std::size_t j = 0; j < job_count; ++j)
+    {
+        render_many_job & job = closure->jobs[j];
+        job.request.data = &job;
+        job.closure = closure;
+        // jobs without a clone make one on the worker
+        job.map = (j == 0) ? m->get() : m->take_clone();
+    }
+    NanAssignPersistent(closure->cb, args[args.Length() - 1].As<Function>());
+    m->acquire();
+    m->Ref();
+    for (render_many_job & job : closure->jobs)
+    {
+        node_mapnik::queue_work(&job.request, EIO_RenderMany, EIO_AfterRenderMany);
+    }
+    NanReturnUndefined();
+}
+
+void Map::EIO_RenderMany(uv_work_t* req)
+{
+    render_many_job *job = static_cast<render_many_job *>(req->data);
+    render_many_baton_t *closure = job->closure;
+
+    try
+    {
+        // drop renders that were cancelled or timed out while queued
+        closure->cancel.check();
+        if (!job->map)
+        {
+            job->map = MAPNIK_MAKE_SHARED<mapnik::Map>(*closure->m->get());
+        }
+        mapnik::Map const& render_map = *job->map;
+        std::size_t count = closure->entries.size();
+        std::size_t i;
+        while (!closure->failed && (i = closure->next++) < count)
+        {
+            render_many_entry & entry = closure->entries[i];
+            try
+            {
+                mapnik::image_32 im(render_map.width(),render_map.height());
+                mapnik::request m_req(im.width(),im.height(),entry.extent);
+                m_req.set_buffer_size(closure->buffer_size);
+                mapnik::agg_renderer<mapnik::image_32> ren(render_map,
+                                                           m_req,
+                                                           closure->variables,
+                                                           im,
+                                                           closure->scale_factor);
+                node_mapnik::render_layers(ren,
+                                           render_map,
+                                           m_req,
+                                           closure->scale_denominator,
+                                           closure->scale_factor,
+                                           closure->variables,
+                                           closure->cancel,
+                                           NULL);
+                if (closure->palette.get())
+                {
+                    entry.result = save_to_string(im, entry.format, *closure->palette);
+                }
+                else
+                {
+                    entry.result = save_to_string(im, entry.format);
+                }
+            }
+            catch (std::exception const& ex)
+            {
+                entry.error = true;
+                entry.error_name = ex.what();
+                closure->failed = true;
+            }
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        job->error = true;
+        job->error_name = ex.what();
+        closure->failed = true;
+    }
+}
+
+void Map::EIO_AfterRenderMany(uv_work_t* req)
+{
+    NanScope();
+
+    render_many_job *job = static_cast<render_many_job *>(req->data);
+    render_many_baton_t *closure = job->closure;
+    if (--closure->remaining > 0)
+    {
+        return;
+    }
+
+    Map *m = closure->m;
+    m->release();
+    for (std::size_t j = 1; j < closure->jobs.size(); ++j)
+    {
+        m->return_clone(closure->jobs[j].map, closure->generation);
+    }
+
+    // the first failed entry, or else the first failed job
+    std::string const* error_name = NULL;
+    for (render_many_entry const& entry : closure->entries)
+    {
+        if (entry.error)
+        {
+            error_name = &entry.error_name;
+            break;
+        }
+    }
+    for (std::size_t j = 0; !error_name && j < closure->jobs.size(); ++j)
+    {
+        if (closure->jobs[j].error)
+        {
+            error_name = &closure->jobs[j].error_name;
+        }
+    }
+
+    if (error_name) {
+        Local<Value> argv[1] = { NanError(error_name->c_str()) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    } else {
+        Local<Array> results = NanNew<Array>(closure->entries.size());
+        for (std::size_t i = 0; i < closure->entries.size(); ++i)
+        {
+            results->Set(i, node_mapnik::string_to_buffer(closure->entries[i].result));
+        }
+        Local<Value> argv[2] = { NanNull(), results };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+    }
+
+    m->Unref();
+    NanDisposePersistent(closure->cb);
+    delete closure;
+}
+
+typedef struct {
+    uv_work_t request;
+    Map *m;
+    std::string format;
+    std::string output;
+    palette_ptr palette;
+    double scale_factor;
+    double scale_denominator;
+    mapnik::attributes variables;
+    bool use_cairo;
+    int buffer_size; // TODO - no effect until mapnik::request is used
+    bool collect_stats;
+    node_mapnik::render_stats stats;
+    node_mapnik::layer_mask layers;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} render_file_baton_t;
+
+NAN_METHOD(Map::renderFile)
+{
+    NanScope();
+
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        NanThrowTypeError("first argument must be a path to a file to save");
+        NanReturnUndefined();
+    }
+
+    // defaults
+    std::string format = "png";
+    double scale_factor = 1.0;
+    double scale_denominator = 0.0;
+    palette_ptr palette;
+    int buffer_size = 0;
+    bool collect_stats = false;
+    node_mapnik::layer_mask layers;
+
+    Local<Value> callback = args[args.Length()-1];
+
+    if (!callback->IsFunction()) {
+        NanThrowTypeError("last argument must be a callback function");
+        NanReturnUndefined();
+    }
+
+    Local<Object> options = NanNew<Object>();
+
+    if (!args[1]->IsFunction() && args[1]->IsObject()) {
+        options = args[1]->ToObject();
+        if (options->Has(NanNew("format")))
+        {
+            Local<Value> format_opt = options->Get(NanNew("format"));
+            if (!format_opt->IsString()) {
                 NanThrowTypeError("'format' must be a String");
                 NanReturnUndefined();
             }
@@ -2034,6 +3225,23 @@ NAN_METHOD(Map::renderFile)
             buffer_size = bind_opt->IntegerValue();
         }
 
+        if (options->Has(NanNew("stats"))) {
+            Local<Value> bind_opt = options->Get(NanNew("stats"));
+            if (!bind_opt->IsBoolean()) {
+                NanThrowTypeError("optional arg 'stats' must be a boolean");
+                NanReturnUndefined();
+            }
+
+            collect_stats = bind_opt->BooleanValue();
+        }
+
+        if (options->Has(NanNew("layers"))) {
+            Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+            if (!node_mapnik::parse_layers_option(options->Get(NanNew("layers")), *m->map_, layers)) {
+                NanReturnUndefined();
+            }
+        }
+
     } else if (!args[1]->IsFunction()) {
         NanThrowTypeError("optional argument must be an object");
         NanReturnUndefined();
@@ -2068,6 +3276,11 @@ NAN_METHOD(Map::renderFile)
     }
 
     if (format == "pdf" || format == "svg" || format == "ps" || format == "ARGB32" || format == "RGB24") {
+        if (!layers.empty()) {
+            delete closure;
+            NanThrowTypeError("option 'layers' is not supported for cairo formats");
+            NanReturnUndefined();
+        }
 #if defined(HAVE_CAIRO)
         closure->use_cairo = true;
 #else
@@ -2087,6 +3300,8 @@ NAN_METHOD(Map::renderFile)
     closure->scale_factor = scale_factor;
     closure->scale_denominator = scale_denominator;
     closure->buffer_size = buffer_size;
+    closure->collect_stats = collect_stats;
+    closure->layers = layers;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
 
@@ -2094,7 +3309,7 @@ NAN_METHOD(Map::renderFile)
     closure->palette = palette;
     closure->output = output;
 
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderFile, (uv_after_work_cb)EIO_AfterRenderFile);
+    node_mapnik::queue_work(&closure->request, EIO_RenderFile, EIO_AfterRenderFile);
     m->Ref();
 
     NanReturnUndefined();
@@ -2111,7 +3326,10 @@ void Map::EIO_RenderFile(uv_work_t* req)
         {
 #if defined(HAVE_CAIRO)
             // https://github.com/mapnik/mapnik/issues/1930
+            // rendering and encoding happen in one call so only the total is known
+            node_mapnik::stats_clock::time_point render_start = node_mapnik::stats_clock::now();
             mapnik::save_to_cairo_file(*closure->m->map_,closure->output,closure->format,closure->scale_factor,closure->scale_denominator);
+            closure->stats.render_time = node_mapnik::elapsed_ms(render_start);
 #else
 #endif
         }
@@ -2126,13 +3344,23 @@ void Map::EIO_RenderFile(uv_work_t* req)
                                                    closure->variables,
                                                    im,
                                                    closure->scale_factor);
-            ren.apply(closure->scale_denominator);
-
+            node_mapnik::render_layers(ren,
+                                       map,
+                                       m_req,
+                                       closure->scale_denominator,
+                                       closure->scale_factor,
+                                       closure->variables,
+                                       node_mapnik::render_cancel(),
+                                       closure->collect_stats ? &closure->stats : NULL,
+                                       closure->layers);
+
+            node_mapnik::stats_clock::time_point encode_start = node_mapnik::stats_clock::now();
             if (closure->palette.get()) {
                 mapnik::save_to_file<mapnik::image_data_rgba8>(im.data(),closure->output,*closure->palette);
             } else {
                 mapnik::save_to_file<mapnik::image_data_rgba8>(im.data(),closure->output);
             }
+            closure->stats.encode_time = node_mapnik::elapsed_ms(encode_start);
         }
     }
     catch (std::exception const& ex)
@@ -2153,6 +3381,10 @@ void Map::EIO_AfterRenderFile(uv_work_t* req)
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    } else if (closure->collect_stats) {
+        // no rendered object is passed back, so stats keep their third position
+        Local<Value> argv[3] = { NanNull(), NanUndefined(), node_mapnik::stats_to_object(closure->stats) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 3, argv);
     } else {
         Local<Value> argv[1] = { NanNull() };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
@@ -2179,6 +3411,7 @@ NAN_METHOD(Map::renderSync)
     double scale_factor = 1.0;
     double scale_denominator = 0.0;
     int buffer_size = 0;
+    node_mapnik::layer_mask layers;
 
     if (args.Length() >= 2){
         if (!args[1]->IsObject()) {
@@ -2241,6 +3474,12 @@ NAN_METHOD(Map::renderSync)
 
             buffer_size = bind_opt->IntegerValue();
         }
+        if (options->Has(NanNew("layers"))) {
+            Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+            if (!node_mapnik::parse_layers_option(options->Get(NanNew("layers")), *m->map_, layers)) {
+                NanReturnUndefined();
+            }
+        }
     }
 
     // options hash
@@ -2283,7 +3522,15 @@ NAN_METHOD(Map::renderSync)
                                                    mapnik::attributes(),
                                                    im,
                                                    scale_factor);
-        ren.apply(scale_denominator);
+        node_mapnik::render_layers(ren,
+                                   map,
+                                   m_req,
+                                   scale_denominator,
+                                   scale_factor,
+                                   mapnik::attributes(),
+                                   node_mapnik::render_cancel(),
+                                   NULL,
+                                   layers);
 
         if (palette.get())
         {
@@ -2298,7 +3545,7 @@ NAN_METHOD(Map::renderSync)
         NanThrowError(ex.what());
         NanReturnUndefined();
     }
-    NanReturnValue(NanNewBufferHandle((char*)s.data(), s.size()));
+    NanReturnValue(node_mapnik::string_to_buffer(s));
 }
 
 NAN_METHOD(Map::renderFileSync)
@@ -2318,6 +3565,7 @@ NAN_METHOD(Map::renderFileSync)
     double scale_factor = 1.0;
     double scale_denominator = 0.0;
     int buffer_size = 0;
+    node_mapnik::layer_mask layers;
     std::string format = "png";
     palette_ptr palette;
 
@@ -2382,6 +3630,12 @@ NAN_METHOD(Map::renderFileSync)
 
             buffer_size = bind_opt->IntegerValue();
         }
+        if (options->Has(NanNew("layers"))) {
+            Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
+            if (!node_mapnik::parse_layers_option(options->Get(NanNew("layers")), *m->map_, layers)) {
+                NanReturnUndefined();
+            }
+        }
     }
 
     Map* m = node::ObjectWrap::Unwrap<Map>(args.Holder());
@@ -2402,6 +3656,11 @@ NAN_METHOD(Map::renderFileSync)
 
         if (format == "pdf" || format == "svg" || format =="ps" || format == "ARGB32" || format == "RGB24")
         {
+            if (!layers.empty())
+            {
+                NanThrowTypeError("option 'layers' is not supported for cairo formats");
+                NanReturnUndefined();
+            }
 #if defined(HAVE_CAIRO)
             mapnik::save_to_cairo_file(*m->map_,output,format,scale_factor,scale_denominator);
 #else
@@ -2422,8 +3681,15 @@ NAN_METHOD(Map::renderFileSync)
                                                    mapnik::attributes(),
                                                    im,
                                                    scale_factor);
-
-            ren.apply(scale_denominator);
+            node_mapnik::render_layers(ren,
+                                       map,
+                                       m_req,
+                                       scale_denominator,
+                                       scale_factor,
+                                       mapnik::attributes(),
+                                       node_mapnik::render_cancel(),
+                                       NULL,
+                                       layers);
 
             if (palette.get())
             {
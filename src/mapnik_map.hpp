@@ -11,6 +11,7 @@
 
 // stl
 #include <string>
+#include <vector>
 
 using namespace v8;
 
@@ -24,6 +25,7 @@ public:
     static Persistent<FunctionTemplate> constructor;
     static void Initialize(Handle<Object> target);
     static NAN_METHOD(New);
+    static Handle<Value> New(map_ptr map);
 
     static NAN_METHOD(fonts);
     static NAN_METHOD(fontFiles);
@@ -51,6 +53,14 @@ public:
     static void EIO_RenderVectorTile(uv_work_t* req);
     static void EIO_AfterRenderVectorTile(uv_work_t* req);
 
+    static NAN_METHOD(renderMetatile);
+    static void EIO_RenderMetatile(uv_work_t* req);
+    static void EIO_AfterRenderMetatile(uv_work_t* req);
+
+    static NAN_METHOD(renderMany);
+    static void EIO_RenderMany(uv_work_t* req);
+    static void EIO_AfterRenderMany(uv_work_t* req);
+
     static NAN_METHOD(renderFile);
     static void EIO_RenderFile(uv_work_t* req);
     static void EIO_AfterRenderFile(uv_work_t* req);
@@ -63,6 +73,8 @@ public:
     static NAN_METHOD(to_string);
 
     static NAN_METHOD(clear);
+    static NAN_METHOD(setFeatureCache);
+    static NAN_METHOD(featureCacheStats);
     static NAN_METHOD(resize);
     static NAN_METHOD(zoomAll);
     static NAN_METHOD(zoomToBox);
@@ -93,10 +105,20 @@ public:
 
     inline map_ptr get() { return map_; }
 
+    // Clones of the map that renderMany keeps between calls. Anything that
+    // changes the map calls modified(), which drops them, and clones handed
+    // out before that are not taken back.
+    map_ptr take_clone();
+    void return_clone(map_ptr const& clone, unsigned generation);
+    unsigned generation() const { return generation_; }
+    void modified();
+
 private:
     ~Map();
     map_ptr map_;
     int in_use_;
+    std::vector<map_ptr> clones_;
+    unsigned generation_;
 };
 
 #endif
@@ -0,0 +1,305 @@
+#include "mapnik_map_pool.hpp"
+#include "mapnik_map.hpp"
+#include "utils.hpp"
+
+// mapnik
+#include <mapnik/map.hpp>               // for Map
+
+// boost
+#include MAPNIK_MAKE_SHARED_INCLUDE
+
+// stl
+#include <exception>
+
+Persistent<FunctionTemplate> MapPool::constructor;
+
+void MapPool::Initialize(Handle<Object> target) {
+
+    NanScope();
+
+    Local<FunctionTemplate> lcons = NanNew<FunctionTemplate>(MapPool::New);
+    lcons->InstanceTemplate()->SetInternalFieldCount(1);
+    lcons->SetClassName(NanNew("MapPool"));
+
+    NODE_SET_PROTOTYPE_METHOD(lcons, "acquire", acquire);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "release", release);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "size", size);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "idle", idle);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "waiting", waiting);
+
+    target->Set(NanNew("MapPool"), lcons->GetFunction());
+    NanAssignPersistent(constructor, lcons);
+}
+
+MapPool::MapPool() :
+    ObjectWrap(),
+    maps_(),
+    natives_(),
+    index_(),
+    busy_(),
+    idle_(),
+    waiting_() {}
+
+MapPool::~MapPool()
+{
+    while (!waiting_.empty())
+    {
+        Persistent<Function> * cb = waiting_.front();
+        waiting_.pop_front();
+        NanDisposePersistent(*cb);
+        delete cb;
+    }
+    NanDisposePersistent(maps_);
+}
+
+/**
+ * new mapnik.MapPool(map, [{size: N}])
+ *
+ * Clones `map` N times (default 4, the size of the default libuv threadpool)
+ * so that concurrent renders never share a single mapnik::Map.
+ */
+NAN_METHOD(MapPool::New)
+{
+    NanScope();
+
+    if (!args.IsConstructCall())
+    {
+        NanThrowError("Cannot call constructor as function, you need to use 'new' keyword");
+        NanReturnUndefined();
+    }
+
+    if (args.Length() < 1 || !args[0]->IsObject())
+    {
+        NanThrowTypeError("first argument must be a mapnik.Map");
+        NanReturnUndefined();
+    }
+
+    Local<Object> obj = args[0]->ToObject();
+    if (obj->IsNull() || obj->IsUndefined() || !NanNew(Map::constructor)->HasInstance(obj))
+    {
+        NanThrowTypeError("first argument must be a mapnik.Map");
+        NanReturnUndefined();
+    }
+
+    unsigned size = 4;
+    if (args.Length() > 1)
+    {
+        if (!args[1]->IsObject())
+        {
+            NanThrowTypeError("optional second argument must be an options object");
+            NanReturnUndefined();
+        }
+        Local<Object> options = args[1]->ToObject();
+        if (options->Has(NanNew("size")))
+        {
+            Local<Value> bind_opt = options->Get(NanNew("size"));
+            if (!bind_opt->IsNumber() || bind_opt->IntegerValue() <= 0)
+            {
+                NanThrowTypeError("optional arg 'size' must be a positive integer");
+                NanReturnUndefined();
+            }
+            size = bind_opt->IntegerValue();
+        }
+    }
+
+    Map* m = node::ObjectWrap::Unwrap<Map>(obj);
+    MapPool* pool = new MapPool();
+    Local<Array> maps = NanNew<Array>(size);
+    try
+    {
+        for (unsigned i = 0; i < size; ++i)
+        {
+            Local<Object> clone = Map::New(MAPNIK_MAKE_SHARED<mapnik::Map>(*m->get()))->ToObject();
+            Map* native = node::ObjectWrap::Unwrap<Map>(clone);
+            maps->Set(i, clone);
+            pool->natives_.push_back(native);
+            pool->index_[native] = i;
+            pool->busy_.push_back(false);
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        delete pool;
+        NanThrowError(ex.what());
+        NanReturnUndefined();
+    }
+    // hand out maps in index order: the top of the stack is the lowest index
+    for (unsigned i = size; i > 0; --i)
+    {
+        pool->idle_.push_back(i - 1);
+    }
+    NanAssignPersistent(pool->maps_, maps);
+    pool->Wrap(args.This());
+    NanReturnValue(args.This());
+}
+
+// A map handed to an acquire callback. The callback runs from a check
+// handle, like setImmediate, so acquire is always asynchronous and release
+// never re-enters user code; the idle handle keeps the loop from blocking
+// in poll before the check phase.
+struct map_pool_delivery {
+    uv_check_t check;
+    uv_idle_t idle;
+    MapPool* pool;
+    unsigned idx;
+    int open_handles;
+    Persistent<Function> cb;
+};
+
+static void on_delivery_closed(uv_handle_t* handle)
+{
+    map_pool_delivery * d = static_cast<map_pool_delivery *>(handle->data);
+    if (--d->open_handles == 0)
+    {
+        delete d;
+    }
+}
+
+#if NODE_MODULE_VERSION > 0x000B
+static void on_delivery_idle(uv_idle_t*) {}
+static void on_delivery_check(uv_check_t* handle)
+#else
+static void on_delivery_idle(uv_idle_t*, int) {}
+static void on_delivery_check(uv_check_t* handle, int)
+#endif
+{
+    MapPool::deliver(static_cast<map_pool_delivery *>(handle->data));
+}
+
+void MapPool::hand_out(unsigned idx, Local<Function> cb)
+{
+    busy_[idx] = true;
+    map_pool_delivery * d = new map_pool_delivery();
+    d->pool = this;
+    d->idx = idx;
+    d->open_handles = 2;
+    NanAssignPersistent(d->cb, cb);
+    uv_check_init(uv_default_loop(), &d->check);
+    uv_idle_init(uv_default_loop(), &d->idle);
+    d->check.data = d;
+    d->idle.data = d;
+    uv_check_start(&d->check, on_delivery_check);
+    uv_idle_start(&d->idle, on_delivery_idle);
+    // the pool owns the maps, so it stays alive until the callback ran
+    Ref();
+}
+
+void MapPool::deliver(map_pool_delivery * d)
+{
+    NanScope();
+    uv_check_stop(&d->check);
+    uv_idle_stop(&d->idle);
+    uv_close(reinterpret_cast<uv_handle_t*>(&d->check), on_delivery_closed);
+    uv_close(reinterpret_cast<uv_handle_t*>(&d->idle), on_delivery_closed);
+    MapPool* pool = d->pool;
+    Local<Function> cb = NanNew(d->cb);
+    NanDisposePersistent(d->cb);
+    Local<Value> argv[2] = { NanNull(), NanNew(pool->maps_)->Get(d->idx) };
+    pool->Unref();
+    NanMakeCallback(NanGetCurrentContext()->Global(), cb, 2, argv);
+}
+
+/**
+ * pool.acquire(callback)
+ *
+ * Reserves an idle map if one is available and calls back with it on the
+ * next turn of the event loop, otherwise queues the callback until a map
+ * is released back to the pool.
+ */
+NAN_METHOD(MapPool::acquire)
+{
+    NanScope();
+
+    if (args.Length() < 1 || !args[args.Length()-1]->IsFunction()) {
+        NanThrowTypeError("last argument must be a callback function");
+        NanReturnUndefined();
+    }
+
+    MapPool* pool = node::ObjectWrap::Unwrap<MapPool>(args.Holder());
+    Local<Function> cb = args[args.Length()-1].As<Function>();
+
+    if (pool->idle_.empty())
+    {
+        Persistent<Function> * queued = new Persistent<Function>();
+        NanAssignPersistent(*queued, cb);
+        pool->waiting_.push_back(queued);
+        NanReturnUndefined();
+    }
+
+    unsigned idx = pool->idle_.back();
+    pool->idle_.pop_back();
+    pool->hand_out(idx, cb);
+    NanReturnUndefined();
+}
+
+/**
+ * pool.release(map)
+ *
+ * Returns a map to the pool. If callers are waiting the map is reserved for
+ * the oldest of them, which is called back on the next turn of the loop.
+ */
+NAN_METHOD(MapPool::release)
+{
+    NanScope();
+
+    if (args.Length() < 1 || !args[0]->IsObject()) {
+        NanThrowTypeError("first argument must be a mapnik.Map");
+        NanReturnUndefined();
+    }
+
+    Local<Object> obj = args[0]->ToObject();
+    if (obj->IsNull() || obj->IsUndefined() || !NanNew(Map::constructor)->HasInstance(obj)) {
+        NanThrowTypeError("first argument must be a mapnik.Map");
+        NanReturnUndefined();
+    }
+
+    MapPool* pool = node::ObjectWrap::Unwrap<MapPool>(args.Holder());
+    Map* m = node::ObjectWrap::Unwrap<Map>(obj);
+
+    std::unordered_map<Map*, unsigned>::const_iterator itr = pool->index_.find(m);
+    if (itr == pool->index_.end()) {
+        NanThrowError("map does not belong to this pool");
+        NanReturnUndefined();
+    }
+
+    unsigned idx = itr->second;
+    if (!pool->busy_[idx]) {
+        NanThrowError("map was already released to the pool");
+        NanReturnUndefined();
+    }
+    pool->busy_[idx] = false;
+
+    if (pool->waiting_.empty()) {
+        pool->idle_.push_back(idx);
+        NanReturnUndefined();
+    }
+
+    Persistent<Function> * queued = pool->waiting_.front();
+    pool->waiting_.pop_front();
+    Local<Function> cb = NanNew(*queued);
+    NanDisposePersistent(*queued);
+    delete queued;
+    pool->hand_out(idx, cb);
+    NanReturnUndefined();
+}
+
+NAN_METHOD(MapPool::size)
+{
+    NanScope();
+    MapPool* pool = node::ObjectWrap::Unwrap<MapPool>(args.Holder());
+    NanReturnValue(NanNew<Integer>(static_cast<unsigned>(pool->natives_.size())));
+}
+
+NAN_METHOD(MapPool::idle)
+{
+    NanScope();
+    MapPool* pool = node::ObjectWrap::Unwrap<MapPool>(args.Holder());
+    NanReturnValue(NanNew<Integer>(static_cast<unsigned>(pool->idle_.size())));
+}
+
+NAN_METHOD(MapPool::waiting)
+{
+    NanScope();
+    MapPool* pool = node::ObjectWrap::Unwrap<MapPool>(args.Holder());
+    NanReturnValue(NanNew<Integer>(static_cast<unsigned>(pool->waiting_.size())));
+}
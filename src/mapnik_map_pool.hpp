@@ -0,0 +1,50 @@
+#ifndef __NODE_MAPNIK_MAP_POOL_H__
+#define __NODE_MAPNIK_MAP_POOL_H__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <nan.h>
+#pragma GCC diagnostic pop
+
+// stl
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+using namespace v8;
+
+class Map;
+struct map_pool_delivery;
+
+class MapPool: public node::ObjectWrap {
+public:
+    static Persistent<FunctionTemplate> constructor;
+    static void Initialize(Handle<Object> target);
+    static NAN_METHOD(New);
+
+    static NAN_METHOD(acquire);
+    static NAN_METHOD(release);
+    static NAN_METHOD(size);
+    static NAN_METHOD(idle);
+    static NAN_METHOD(waiting);
+
+    MapPool();
+
+    // runs a deferred acquire callback, called from the loop's check phase
+    static void deliver(map_pool_delivery * d);
+
+private:
+    ~MapPool();
+    // marks the map busy now and calls back on a later loop iteration
+    void hand_out(unsigned idx, Local<Function> cb);
+
+    // keeps the cloned Map objects alive for the lifetime of the pool
+    Persistent<Array> maps_;
+    std::vector<Map*> natives_;
+    std::unordered_map<Map*, unsigned> index_;
+    std::vector<bool> busy_;
+    std::vector<unsigned> idle_;
+    std::deque<Persistent<Function>*> waiting_;
+};
+
+#endif
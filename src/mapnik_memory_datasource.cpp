@@ -11,11 +11,14 @@
 #include "mapnik_memory_datasource.hpp"
 //#include "mapnik_datasource.hpp"
 #include "mapnik_featureset.hpp"
+#include "geojson_features.hpp"
+#include "memory_index_datasource.hpp"
 #include "utils.hpp"
 #include "ds_emitter.hpp"
 
 // stl
 #include <exception>
+#include <vector>
 
 // boost
 #include MAPNIK_MAKE_SHARED_INCLUDE
@@ -35,6 +38,7 @@ void MemoryDatasource::Initialize(Handle<Object> target) {
     NODE_SET_PROTOTYPE_METHOD(lcons, "describe", describe);
     NODE_SET_PROTOTYPE_METHOD(lcons, "featureset", featureset);
     NODE_SET_PROTOTYPE_METHOD(lcons, "add", add);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "addMany", addMany);
 
     target->Set(NanNew("MemoryDatasource"), lcons->GetFunction());
     NanAssignPersistent(constructor, lcons);
@@ -96,7 +100,7 @@ NAN_METHOD(MemoryDatasource::New)
     //memory_datasource cache;
     MemoryDatasource* d = new MemoryDatasource();
     d->Wrap(args.This());
-    d->datasource_ = MAPNIK_MAKE_SHARED<mapnik::memory_datasource>(params);
+    d->datasource_ = MAPNIK_MAKE_SHARED<node_mapnik::memory_index_datasource>(params);
     NanReturnValue(args.This());
 }
 
@@ -180,6 +184,95 @@ NAN_METHOD(MemoryDatasource::featureset)
     NanReturnUndefined();
 }
 
+mapnik::context_ptr MemoryDatasource::context() const
+{
+    node_mapnik::memory_index_datasource * ds = dynamic_cast<node_mapnik::memory_index_datasource *>(datasource_.get());
+    if (ds)
+    {
+        return ds->context();
+    }
+    return MAPNIK_MAKE_SHARED<mapnik::context_type>();
+}
+
+void MemoryDatasource::push(mapnik::feature_ptr const& feature)
+{
+    node_mapnik::memory_index_datasource * ds = dynamic_cast<node_mapnik::memory_index_datasource *>(datasource_.get());
+    if (ds)
+    {
+        ds->push(feature);
+        return;
+    }
+    mapnik::memory_datasource * cache = dynamic_cast<mapnik::memory_datasource *>(datasource_.get());
+    if (cache)
+    {
+        cache->push(feature);
+    }
+}
+
+// Returns an empty pointer unless `obj` has a numeric x and y.
+mapnik::feature_ptr MemoryDatasource::point_feature(Local<Object> const& obj, mapnik::context_ptr const& ctx)
+{
+    Local<Value> x = obj->Get(NanNew("x"));
+    Local<Value> y = obj->Get(NanNew("y"));
+    if (x->IsUndefined() || !x->IsNumber() || y->IsUndefined() || !y->IsNumber())
+    {
+        return mapnik::feature_ptr();
+    }
+    mapnik::geometry_type * pt = new mapnik::geometry_type(MAPNIK_POINT);
+    pt->move_to(x->NumberValue(),y->NumberValue());
+    mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx,feature_id_));
+    ++feature_id_;
+    feature->add_geometry(pt);
+    if (obj->Has(NanNew("properties")))
+    {
+        Local<Value> props = obj->Get(NanNew("properties"));
+        if (props->IsObject())
+        {
+            Local<Object> p_obj = props->ToObject();
+            Local<Array> names = p_obj->GetPropertyNames();
+            unsigned int i = 0;
+            unsigned int a_length = names->Length();
+            while (i < a_length)
+            {
+                Local<Value> name = names->Get(i)->ToString();
+                // if name in q.property_names() ?
+                Local<Value> value = p_obj->Get(name);
+                if (value->IsString()) {
+                    mapnik::value_unicode_string ustr = tr_.transcode(TOSTR(value));
+                    feature->put_new(TOSTR(name),ustr);
+                } else if (value->IsNumber()) {
+                    double num = value->NumberValue();
+                    // todo - round
+                    if (num == value->IntegerValue()) {
+                        feature->put_new(TOSTR(name),static_cast<node_mapnik::value_integer>(value->IntegerValue()));
+                    } else {
+                        double dub_val = value->NumberValue();
+                        feature->put_new(TOSTR(name),dub_val);
+                    }
+                } else if (value->IsNull()) {
+                    feature->put_new(TOSTR(name),mapnik::value_null());
+                }
+                i++;
+            }
+        }
+    }
+    return feature;
+}
+
+std::size_t MemoryDatasource::add_geojson(const char * data, std::size_t size, mapnik::context_ptr const& ctx)
+{
+    // parse everything before pushing so a bad feature adds nothing
+    std::vector<mapnik::feature_ptr> features;
+    unsigned id = feature_id_;
+    node_mapnik::parse_geojson_features(data, size, ctx, id, features);
+    feature_id_ = id;
+    for (mapnik::feature_ptr const& feature : features)
+    {
+        push(feature);
+    }
+    return features.size();
+}
+
 NAN_METHOD(MemoryDatasource::add)
 {
 
@@ -203,52 +296,79 @@ NAN_METHOD(MemoryDatasource::add)
             NanReturnUndefined();
         }
 
-        Local<Value> x = obj->Get(NanNew("x"));
-        Local<Value> y = obj->Get(NanNew("y"));
-        if (!x->IsUndefined() && x->IsNumber() && !y->IsUndefined() && y->IsNumber())
+        mapnik::feature_ptr feature = d->point_feature(obj, d->context());
+        if (feature)
         {
-            mapnik::geometry_type * pt = new mapnik::geometry_type(MAPNIK_POINT);
-            pt->move_to(x->NumberValue(),y->NumberValue());
-            mapnik::context_ptr ctx = MAPNIK_MAKE_SHARED<mapnik::context_type>();
-            mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx,d->feature_id_));
-            ++(d->feature_id_);
-            feature->add_geometry(pt);
-            if (obj->Has(NanNew("properties")))
-            {
-                Local<Value> props = obj->Get(NanNew("properties"));
-                if (props->IsObject())
-                {
-                    Local<Object> p_obj = props->ToObject();
-                    Local<Array> names = p_obj->GetPropertyNames();
-                    unsigned int i = 0;
-                    unsigned int a_length = names->Length();
-                    while (i < a_length)
-                    {
-                        Local<Value> name = names->Get(i)->ToString();
-                        // if name in q.property_names() ?
-                        Local<Value> value = p_obj->Get(name);
-                        if (value->IsString()) {
-                            mapnik::value_unicode_string ustr = d->tr_.transcode(TOSTR(value));
-                            feature->put_new(TOSTR(name),ustr);
-                        } else if (value->IsNumber()) {
-                            double num = value->NumberValue();
-                            // todo - round
-                            if (num == value->IntegerValue()) {
-                                feature->put_new(TOSTR(name),static_cast<node_mapnik::value_integer>(value->IntegerValue()));
-                            } else {
-                                double dub_val = value->NumberValue();
-                                feature->put_new(TOSTR(name),dub_val);
-                            }
-                        } else if (value->IsNull()) {
-                            feature->put_new(TOSTR(name),mapnik::value_null());
-                        }
-                        i++;
-                    }
-                }
-            }
-            mapnik::memory_datasource *cache = dynamic_cast<mapnik::memory_datasource *>(d->datasource_.get());
-            cache->push(feature);
+            d->push(feature);
         }
     }
     NanReturnValue(NanFalse());
 }
+
+/**
+ * Adds an array of {x, y, properties} objects, or a Buffer holding a GeoJSON
+ * FeatureCollection, in one call. All features share one context. Returns
+ * the number of features added.
+ */
+NAN_METHOD(MemoryDatasource::addMany)
+{
+    NanScope();
+
+    if (args.Length() != 1 || !args[0]->IsObject())
+    {
+        NanThrowTypeError("accepts one argument: an array of objects including x and y and properties, or a GeoJSON FeatureCollection Buffer");
+        NanReturnUndefined();
+    }
+
+    MemoryDatasource* d = node::ObjectWrap::Unwrap<MemoryDatasource>(args.Holder());
+    mapnik::context_ptr ctx = d->context();
+    std::size_t count = 0;
+
+    if (node::Buffer::HasInstance(args[0]))
+    {
+        Local<Object> buffer = args[0].As<Object>();
+        try
+        {
+            count = d->add_geojson(node::Buffer::Data(buffer), node::Buffer::Length(buffer), ctx);
+        }
+        catch (std::exception const& ex)
+        {
+            NanThrowError(ex.what());
+            NanReturnUndefined();
+        }
+        NanReturnValue(NanNew<Number>(count));
+    }
+
+    if (!args[0]->IsArray())
+    {
+        NanThrowTypeError("accepts one argument: an array of objects including x and y and properties, or a GeoJSON FeatureCollection Buffer");
+        NanReturnUndefined();
+    }
+
+    Local<Array> items = args[0].As<Array>();
+    unsigned first_id = d->feature_id_;
+    std::vector<mapnik::feature_ptr> features;
+    features.reserve(items->Length());
+    for (unsigned i = 0; i < items->Length(); ++i)
+    {
+        Local<Value> item = items->Get(i);
+        mapnik::feature_ptr feature;
+        if (item->IsObject())
+        {
+            feature = d->point_feature(item->ToObject(), ctx);
+        }
+        if (!feature)
+        {
+            d->feature_id_ = first_id;
+            NanThrowTypeError("every item must be an object including a numeric x and y");
+            NanReturnUndefined();
+        }
+        features.push_back(feature);
+    }
+    for (mapnik::feature_ptr const& feature : features)
+    {
+        d->push(feature);
+    }
+    count = features.size();
+    NanReturnValue(NanNew<Number>(count));
+}
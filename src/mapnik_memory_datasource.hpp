@@ -23,12 +23,17 @@ public:
     static NAN_METHOD(features);
     static NAN_METHOD(featureset);
     static NAN_METHOD(add);
+    static NAN_METHOD(addMany);
 
     MemoryDatasource();
     inline mapnik::datasource_ptr get() { return datasource_; }
 
 private:
     ~MemoryDatasource();
+    mapnik::feature_ptr point_feature(Local<Object> const& obj, mapnik::context_ptr const& ctx);
+    std::size_t add_geojson(const char * data, std::size_t size, mapnik::context_ptr const& ctx);
+    mapnik::context_ptr context() const;
+    void push(mapnik::feature_ptr const& feature);
     mapnik::datasource_ptr datasource_;
     unsigned int feature_id_;
     mapnik::transcoder tr_;
@@ -1,16 +1,224 @@
 #include "mapnik_projection.hpp"
+#include "mapnik_projection_cache.hpp"
+#include "mapnik_thread_pool.hpp"
 #include "utils.hpp"
 
 #include <mapnik/box2d.hpp>
 #include <mapnik/proj_transform.hpp>
 #include <mapnik/projection.hpp>
 #include <sstream>
+#include <stdexcept>
 
 // boost
 #include MAPNIK_MAKE_SHARED_INCLUDE
 
 Persistent<FunctionTemplate> Projection::constructor;
 
+// Batch transforms over the interleaved x,y pairs of a Float64Array, shared
+// by Projection#forwardMany/inverseMany and ProjTransform#forwardMany/backwardMany.
+// Exactly one of `p` and `tr` is set. proj4 handles must not be shared
+// between threads, so jobs on the threadpool use the worker's own cached
+// projections for `source_srs` and `dest_srs` instead of the object's.
+typedef struct {
+    uv_work_t request;
+    Projection* p;
+    ProjTransform* tr;
+    std::string source_srs;
+    std::string dest_srs;
+    bool forward;
+    double * src;
+    double * dest;
+    std::size_t length;
+    bool error;
+    std::string error_name;
+    Persistent<Object> src_obj;
+    Persistent<Object> dest_obj;
+    Persistent<Function> cb;
+} transform_many_baton_t;
+
+static bool get_float64_array(Local<Value> val, double *& data, std::size_t & length)
+{
+    if (!val->IsObject()) return false;
+    Local<Object> obj = val.As<Object>();
+    if (!obj->HasIndexedPropertiesInExternalArrayData() ||
+        obj->GetIndexedPropertiesExternalArrayDataType() != kExternalDoubleArray)
+    {
+        return false;
+    }
+    data = static_cast<double *>(obj->GetIndexedPropertiesExternalArrayData());
+    length = static_cast<std::size_t>(obj->GetIndexedPropertiesExternalArrayDataLength());
+    return true;
+}
+
+// Writes the transformed points of `src` to `dest`, which may be `src`.
+// Throws on the first point a ProjTransform cannot transform, leaving the
+// points before it written.
+static void transform_many(mapnik::projection const* proj,
+                           mapnik::proj_transform const* trans,
+                           bool forward,
+                           double const* src,
+                           double * dest,
+                           std::size_t length)
+{
+    for (std::size_t i = 0; i + 1 < length; i += 2)
+    {
+        double x = src[i];
+        double y = src[i+1];
+        if (proj)
+        {
+            if (forward) proj->forward(x,y);
+            else proj->inverse(x,y);
+        }
+        else
+        {
+            mapnik::proj_transform const& prj_trans = *trans;
+            double z = 0;
+            if (!(forward ? prj_trans.forward(x,y,z) : prj_trans.backward(x,y,z)))
+            {
+                std::ostringstream s;
+                s << (forward ? "Failed to forward project " : "Failed to back project ")
+                  << "point " << i/2 << " (" << src[i] << "," << src[i+1] << ") from "
+                  << (forward ? prj_trans.source().params() : prj_trans.dest().params()) << " to "
+                  << (forward ? prj_trans.dest().params() : prj_trans.source().params());
+                throw std::runtime_error(s.str());
+            }
+        }
+        dest[i] = x;
+        dest[i+1] = y;
+    }
+}
+
+static void EIO_TransformMany(uv_work_t* req)
+{
+    transform_many_baton_t *closure = static_cast<transform_many_baton_t *>(req->data);
+    try
+    {
+        if (closure->p)
+        {
+            std::shared_ptr<mapnik::projection const> proj = node_mapnik::cached_projection(closure->source_srs);
+            transform_many(proj.get(), NULL, closure->forward, closure->src, closure->dest, closure->length);
+        }
+        else
+        {
+            std::shared_ptr<node_mapnik::cached_transform const> trans = node_mapnik::cached_proj_transform(closure->source_srs,
+                                                                                                          closure->dest_srs);
+            transform_many(NULL, &trans->trans, closure->forward, closure->src, closure->dest, closure->length);
+        }
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+static void EIO_AfterTransformMany(uv_work_t* req)
+{
+    NanScope();
+    transform_many_baton_t *closure = static_cast<transform_many_baton_t *>(req->data);
+    if (closure->error)
+    {
+        Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    }
+    else
+    {
+        Local<Value> argv[2] = { NanNull(), NanNew(closure->dest_obj) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+    }
+    if (closure->p) closure->p->_unref();
+    if (closure->tr) closure->tr->_unref();
+    NanDisposePersistent(closure->src_obj);
+    NanDisposePersistent(closure->dest_obj);
+    NanDisposePersistent(closure->cb);
+    delete closure;
+}
+
+// (coords, [output], [callback]): transforms in place unless a Float64Array
+// of the same length is passed as output, on the threadpool if a callback
+// is given.
+static Local<Value> transform_many_args(_NAN_METHOD_ARGS, Projection* p, ProjTransform* tr, bool forward)
+{
+    NanEscapableScope();
+    int argc = args.Length();
+    Local<Value> callback;
+    if (argc > 0 && args[argc-1]->IsFunction())
+    {
+        callback = args[argc-1];
+        --argc;
+    }
+    double * src = NULL;
+    std::size_t length = 0;
+    if (argc < 1 || !get_float64_array(args[0], src, length))
+    {
+        NanThrowTypeError("first argument must be a Float64Array of interleaved x,y coordinates");
+        return NanEscapeScope(NanUndefined());
+    }
+    if (length % 2 != 0)
+    {
+        NanThrowError("Float64Array must hold an even number of values");
+        return NanEscapeScope(NanUndefined());
+    }
+    Local<Object> dest_obj = args[0].As<Object>();
+    double * dest = src;
+    if (argc > 1)
+    {
+        std::size_t dest_length = 0;
+        if (!get_float64_array(args[1], dest, dest_length))
+        {
+            NanThrowTypeError("optional second argument must be a Float64Array");
+            return NanEscapeScope(NanUndefined());
+        }
+        if (dest_length != length)
+        {
+            NanThrowError("output Float64Array must be the same length as the input");
+            return NanEscapeScope(NanUndefined());
+        }
+        dest_obj = args[1].As<Object>();
+    }
+    if (callback.IsEmpty())
+    {
+        try
+        {
+            transform_many(p ? p->get().get() : NULL,
+                           tr ? tr->get().get() : NULL,
+                           forward, src, dest, length);
+        }
+        catch (std::exception const& ex)
+        {
+            NanThrowError(ex.what());
+            return NanEscapeScope(NanUndefined());
+        }
+        return NanEscapeScope(dest_obj);
+    }
+    transform_many_baton_t *closure = new transform_many_baton_t();
+    closure->request.data = closure;
+    closure->p = p;
+    closure->tr = tr;
+    if (p)
+    {
+        closure->source_srs = p->get()->params();
+    }
+    else
+    {
+        closure->source_srs = tr->get()->source().params();
+        closure->dest_srs = tr->get()->dest().params();
+    }
+    closure->forward = forward;
+    closure->src = src;
+    closure->dest = dest;
+    closure->length = length;
+    closure->error = false;
+    // the arrays own the memory being written, so they are kept alive
+    NanAssignPersistent(closure->src_obj, args[0].As<Object>());
+    NanAssignPersistent(closure->dest_obj, dest_obj);
+    NanAssignPersistent(closure->cb, callback.As<Function>());
+    node_mapnik::queue_work(&closure->request, EIO_TransformMany, EIO_AfterTransformMany);
+    if (p) p->_ref();
+    if (tr) tr->_ref();
+    return NanEscapeScope(NanUndefined());
+}
+
 void Projection::Initialize(Handle<Object> target) {
 
     NanScope();
@@ -21,6 +229,8 @@ void Projection::Initialize(Handle<Object> target) {
 
     NODE_SET_PROTOTYPE_METHOD(lcons, "forward", forward);
     NODE_SET_PROTOTYPE_METHOD(lcons, "inverse", inverse);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "forwardMany", forwardMany);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "inverseMany", inverseMany);
 
     target->Set(NanNew("Projection"), lcons->GetFunction());
     NanAssignPersistent(constructor, lcons);
@@ -181,6 +391,20 @@ NAN_METHOD(Projection::inverse)
     }
 }
 
+NAN_METHOD(Projection::forwardMany)
+{
+    NanScope();
+    Projection* p = node::ObjectWrap::Unwrap<Projection>(args.Holder());
+    NanReturnValue(transform_many_args(args, p, NULL, true));
+}
+
+NAN_METHOD(Projection::inverseMany)
+{
+    NanScope();
+    Projection* p = node::ObjectWrap::Unwrap<Projection>(args.Holder());
+    NanReturnValue(transform_many_args(args, p, NULL, false));
+}
+
 Persistent<FunctionTemplate> ProjTransform::constructor;
 
 void ProjTransform::Initialize(Handle<Object> target) {
@@ -193,6 +417,8 @@ void ProjTransform::Initialize(Handle<Object> target) {
 
     NODE_SET_PROTOTYPE_METHOD(lcons, "forward", forward);
     NODE_SET_PROTOTYPE_METHOD(lcons, "backward", backward);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "forwardMany", forwardMany);
+    NODE_SET_PROTOTYPE_METHOD(lcons, "backwardMany", backwardMany);
 
     target->Set(NanNew("ProjTransform"), lcons->GetFunction());
     NanAssignPersistent(constructor, lcons);
@@ -375,3 +601,17 @@ NAN_METHOD(ProjTransform::backward)
         }
     }
 }
+
+NAN_METHOD(ProjTransform::forwardMany)
+{
+    NanScope();
+    ProjTransform* p = node::ObjectWrap::Unwrap<ProjTransform>(args.Holder());
+    NanReturnValue(transform_many_args(args, NULL, p, true));
+}
+
+NAN_METHOD(ProjTransform::backwardMany)
+{
+    NanScope();
+    ProjTransform* p = node::ObjectWrap::Unwrap<ProjTransform>(args.Holder());
+    NanReturnValue(transform_many_args(args, NULL, p, false));
+}
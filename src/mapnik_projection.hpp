@@ -27,12 +27,17 @@ public:
 
     static NAN_METHOD(inverse);
     static NAN_METHOD(forward);
+    static NAN_METHOD(forwardMany);
+    static NAN_METHOD(inverseMany);
     static bool HasInstance(Handle<Value> val);
 
     explicit Projection(std::string const& name);
 
     inline proj_ptr get() { return projection_; }
 
+    void _ref() { Ref(); }
+    void _unref() { Unref(); }
+
 private:
     ~Projection();
     proj_ptr projection_;
@@ -48,6 +53,8 @@ public:
 
     static NAN_METHOD(forward);
     static NAN_METHOD(backward);
+    static NAN_METHOD(forwardMany);
+    static NAN_METHOD(backwardMany);
 
     ProjTransform(mapnik::projection const& src,
                   mapnik::projection const& dest);
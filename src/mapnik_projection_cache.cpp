@@ -0,0 +1,118 @@
+#include "mapnik_projection_cache.hpp"
+
+// stl
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace node_mapnik {
+
+namespace {
+
+// Entries are only made by the main thread, the libuv threadpool and the
+// worker pool, and setThreadPool empties the cache when the worker pool's
+// threads change. This bound only guards against many distinct srs.
+const std::size_t max_entries = 256;
+
+template <typename Value>
+class per_thread_cache
+{
+public:
+    typedef std::pair<std::thread::id, std::string> key_type;
+    typedef std::shared_ptr<Value const> value_ptr;
+
+    template <typename Create>
+    value_ptr get(std::string const& key, Create const& create)
+    {
+        key_type k(std::this_thread::get_id(), key);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            typename std::map<key_type, value_ptr>::const_iterator itr = entries_.find(k);
+            if (itr != entries_.end())
+            {
+                return itr->second;
+            }
+        }
+        // created outside of the lock; only this thread uses the key
+        value_ptr value = create();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (entries_.size() >= max_entries)
+        {
+            entries_.clear();
+        }
+        entries_[k] = value;
+        return value;
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<key_type, value_ptr> entries_;
+};
+
+per_thread_cache<mapnik::projection> & projections()
+{
+    static per_thread_cache<mapnik::projection> instance;
+    return instance;
+}
+
+per_thread_cache<cached_transform> & transforms()
+{
+    static per_thread_cache<cached_transform> instance;
+    return instance;
+}
+
+struct projection_factory
+{
+    explicit projection_factory(std::string const& srs)
+      : srs_(srs) {}
+
+    std::shared_ptr<mapnik::projection const> operator()() const
+    {
+        return std::make_shared<mapnik::projection>(srs_, true);
+    }
+
+    std::string const& srs_;
+};
+
+struct transform_factory
+{
+    transform_factory(std::string const& source_srs, std::string const& dest_srs)
+      : source_srs_(source_srs),
+        dest_srs_(dest_srs) {}
+
+    std::shared_ptr<cached_transform const> operator()() const
+    {
+        return std::make_shared<cached_transform>(source_srs_, dest_srs_);
+    }
+
+    std::string const& source_srs_;
+    std::string const& dest_srs_;
+};
+
+}
+
+std::shared_ptr<mapnik::projection const> cached_projection(std::string const& srs)
+{
+    return projections().get(srs, projection_factory(srs));
+}
+
+std::shared_ptr<cached_transform const> cached_proj_transform(std::string const& source_srs,
+                                                              std::string const& dest_srs)
+{
+    return transforms().get(source_srs + '\0' + dest_srs, transform_factory(source_srs, dest_srs));
+}
+
+void clear_projection_cache()
+{
+    projections().clear();
+    transforms().clear();
+}
+
+}
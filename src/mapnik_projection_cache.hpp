@@ -0,0 +1,66 @@
+#ifndef __NODE_MAPNIK_PROJECTION_CACHE_H__
+#define __NODE_MAPNIK_PROJECTION_CACHE_H__
+
+// mapnik
+#include <mapnik/projection.hpp>        // for projection
+#include <mapnik/proj_transform.hpp>    // for proj_transform
+
+// stl
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+
+namespace node_mapnik {
+
+// Spherical mercator conversions written out, for the lon/lat <=> web
+// mercator pair that queries and GeoJSON export use all the time. Latitudes
+// are clamped to the mercator limit like mapnik's own lonlat2merc.
+inline void lonlat_to_merc(double & x, double & y)
+{
+    static const double pi = 3.14159265358979323846;
+    static const double max_extent = 20037508.342789244;
+    static const double max_latitude = 85.0511287798066;
+    double lon = std::max(-180.0, std::min(180.0, x));
+    double lat = std::max(-max_latitude, std::min(max_latitude, y));
+    x = lon * max_extent / 180.0;
+    y = std::log(std::tan((90.0 + lat) * pi / 360.0)) * max_extent / pi;
+}
+
+inline void merc_to_lonlat(double & x, double & y)
+{
+    static const double pi = 3.14159265358979323846;
+    static const double max_extent = 20037508.342789244;
+    double mx = std::max(-max_extent, std::min(max_extent, x));
+    double my = std::max(-max_extent, std::min(max_extent, y));
+    x = mx * 180.0 / max_extent;
+    y = (2.0 * std::atan(std::exp(my * pi / max_extent)) - pi / 2.0) * 180.0 / pi;
+}
+
+// A projection pair and the transform between them, kept together because
+// mapnik::proj_transform only holds references to its projections.
+struct cached_transform
+{
+    cached_transform(std::string const& source_srs, std::string const& dest_srs)
+      : source(source_srs, true),
+        dest(dest_srs, true),
+        trans(source, dest) {}
+
+    mapnik::projection source;
+    mapnik::projection dest;
+    mapnik::proj_transform trans;
+};
+
+// Projections and transforms keyed by srs, created on first use instead of
+// on every call. proj4 handles are not shared between threads, so each
+// thread gets its own entries; callers must not hand them to other threads.
+std::shared_ptr<mapnik::projection const> cached_projection(std::string const& srs);
+std::shared_ptr<cached_transform const> cached_proj_transform(std::string const& source_srs,
+                                                              std::string const& dest_srs);
+
+// drops all entries, called from mapnik.clearCache()
+void clear_projection_cache();
+
+}
+
+#endif
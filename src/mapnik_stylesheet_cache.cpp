@@ -0,0 +1,219 @@
+#include "mapnik_stylesheet_cache.hpp"
+#include "mapnik3x_compatibility.hpp"
+
+// mapnik
+#include <mapnik/load_map.hpp>          // for load_map, load_map_string
+#include <mapnik/map.hpp>               // for Map
+
+// boost
+#include MAPNIK_MAKE_SHARED_INCLUDE
+
+// stl
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+namespace node_mapnik {
+
+namespace {
+
+typedef MAPNIK_SHARED_PTR<mapnik::Map const> map_template_ptr;
+
+// the most recently used templates are kept, up to this many
+const std::size_t max_templates = 32;
+
+class stylesheet_cache
+{
+public:
+    map_template_ptr find(std::string const& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_type::const_iterator itr = index_.find(key);
+        if (itr == index_.end())
+        {
+            return map_template_ptr();
+        }
+        entries_.splice(entries_.begin(), entries_, itr->second);
+        return itr->second->second;
+    }
+
+    void insert(std::string const& key, map_template_ptr const& tmpl)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_type::iterator itr = index_.find(key);
+        if (itr != index_.end())
+        {
+            itr->second->second = tmpl;
+            entries_.splice(entries_.begin(), entries_, itr->second);
+            return;
+        }
+        entries_.push_front(entry_type(key, tmpl));
+        index_[key] = entries_.begin();
+        if (entries_.size() > max_templates)
+        {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index_.clear();
+        entries_.clear();
+    }
+
+private:
+    typedef std::pair<std::string, map_template_ptr> entry_type;
+    typedef std::list<entry_type> list_type;
+    typedef std::unordered_map<std::string, list_type::iterator> index_type;
+
+    std::mutex mutex_;
+    list_type entries_; // most recently used first
+    index_type index_;
+};
+
+stylesheet_cache & cache()
+{
+    static stylesheet_cache instance;
+    return instance;
+}
+
+// Only maps in the state the constructor leaves them in are loaded from a
+// template, because loading into anything else keeps or merges what the
+// caller set up, which a copy of the template can't do.
+bool is_pristine(mapnik::Map const& map)
+{
+    if (!map.layers().empty() || !map.styles().empty() || !map.fontsets().empty())
+    {
+        return false;
+    }
+    mapnik::Map fresh(map.width(), map.height(), map.srs());
+    return map.background() == fresh.background() &&
+           map.background_image() == fresh.background_image() &&
+           map.buffer_size() == fresh.buffer_size() &&
+           map.get_aspect_fix_mode() == fresh.get_aspect_fix_mode() &&
+           map.maximum_extent() == fresh.maximum_extent() &&
+           map.get_current_extent() == fresh.get_current_extent() &&
+           map.font_directory() == fresh.font_directory() &&
+           map.get_extra_parameters().empty();
+}
+
+// Everything that decides what loading produces: the stylesheet itself,
+// how it is parsed and the size and srs of the target map. The stylesheet
+// goes in as a hash and its length, so keys stay small.
+std::string make_key(mapnik::Map const& map,
+                     std::string const& source,
+                     std::string const& stylesheet,
+                     bool strict,
+                     std::string const& base_path)
+{
+    std::ostringstream s;
+    s << source << '\0'
+      << base_path << '\0'
+      << strict << '\0'
+      << map.width() << 'x' << map.height() << '\0'
+      << map.srs() << '\0'
+      << stylesheet.size() << ':' << std::hash<std::string>()(stylesheet);
+    return s.str();
+}
+
+template <typename Loader>
+void load_cached(mapnik::Map & map, std::string const& key, Loader const& load)
+{
+    map_template_ptr tmpl = cache().find(key);
+    if (!tmpl)
+    {
+        // parsed into a map of its own, so nothing else about the first
+        // target ends up in later loads; parsed outside of the lock, so two
+        // loads racing on the same stylesheet both parse it and the last
+        // one wins
+        MAPNIK_SHARED_PTR<mapnik::Map> parsed = MAPNIK_MAKE_SHARED<mapnik::Map>(map.width(), map.height(), map.srs());
+        load(*parsed);
+        cache().insert(key, parsed);
+        tmpl = parsed;
+    }
+    map = *tmpl;
+}
+
+struct string_loader
+{
+    string_loader(std::string const& stylesheet, bool strict, std::string const& base_path)
+      : stylesheet_(stylesheet),
+        strict_(strict),
+        base_path_(base_path) {}
+
+    void operator()(mapnik::Map & map) const
+    {
+        mapnik::load_map_string(map, stylesheet_, strict_, base_path_);
+    }
+
+    std::string const& stylesheet_;
+    bool strict_;
+    std::string const& base_path_;
+};
+
+struct file_loader
+{
+    file_loader(std::string const& filename, bool strict, std::string const& base_path)
+      : filename_(filename),
+        strict_(strict),
+        base_path_(base_path) {}
+
+    void operator()(mapnik::Map & map) const
+    {
+        mapnik::load_map(map, filename_, strict_, base_path_);
+    }
+
+    std::string const& filename_;
+    bool strict_;
+    std::string const& base_path_;
+};
+
+}
+
+void load_map_string_cached(mapnik::Map & map,
+                            std::string const& stylesheet,
+                            bool strict,
+                            std::string const& base_path)
+{
+    if (!is_pristine(map))
+    {
+        mapnik::load_map_string(map, stylesheet, strict, base_path);
+        return;
+    }
+    load_cached(map,
+                make_key(map, "string", stylesheet, strict, base_path),
+                string_loader(stylesheet, strict, base_path));
+}
+
+void load_map_cached(mapnik::Map & map,
+                     std::string const& filename,
+                     bool strict,
+                     std::string const& base_path)
+{
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!is_pristine(map) || !file)
+    {
+        // unreadable files are left to load_map to report
+        mapnik::load_map(map, filename, strict, base_path);
+        return;
+    }
+    // keyed on the contents too, so an edited stylesheet is parsed again
+    std::string stylesheet((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    load_cached(map,
+                make_key(map, "file:" + filename, stylesheet, strict, base_path),
+                file_loader(filename, strict, base_path));
+}
+
+void clear_stylesheet_cache()
+{
+    cache().clear();
+}
+
+}
@@ -0,0 +1,33 @@
+#ifndef __NODE_MAPNIK_STYLESHEET_CACHE_H__
+#define __NODE_MAPNIK_STYLESHEET_CACHE_H__
+
+// stl
+#include <string>
+
+namespace mapnik { class Map; }
+
+namespace node_mapnik {
+
+// Same as mapnik::load_map_string, but the parsed stylesheet is kept as a
+// template and later loads of the same xml, base path and strictness into
+// a new map of the same size and srs are copied from it instead of being
+// parsed again. Maps that have layers, styles or other settings already
+// are always parsed, because loading into them keeps or merges those. The
+// most recently used templates are kept.
+void load_map_string_cached(mapnik::Map & map,
+                            std::string const& stylesheet,
+                            bool strict,
+                            std::string const& base_path);
+
+// mapnik::load_map counterpart, keyed on the filename and file contents
+void load_map_cached(mapnik::Map & map,
+                     std::string const& filename,
+                     bool strict,
+                     std::string const& base_path);
+
+// drops all templates, called from mapnik.clearCache()
+void clear_stylesheet_cache();
+
+}
+
+#endif
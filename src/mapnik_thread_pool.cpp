@@ -0,0 +1,339 @@
+#include "mapnik_thread_pool.hpp"
+#include "mapnik_projection_cache.hpp"
+
+// stl
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace node_mapnik {
+
+namespace {
+
+// a run_tasks() call; shared with the helper jobs, which may only get to
+// run after the caller has returned
+struct task_group
+{
+    task_group(std::size_t _count, std::function<void(std::size_t)> const& _task)
+      : task(&_task),
+        count(_count),
+        next(0),
+        mutex(),
+        cond(),
+        finished(0),
+        error() {}
+
+    // claims and runs tasks until none are left
+    void work()
+    {
+        std::size_t i;
+        while ((i = next++) < count)
+        {
+            std::exception_ptr err;
+            try
+            {
+                (*task)(i);
+            }
+            catch (...)
+            {
+                err = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (err && !error)
+            {
+                error = err;
+            }
+            if (++finished == count)
+            {
+                cond.notify_all();
+            }
+        }
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return finished == count; });
+    }
+
+    std::function<void(std::size_t)> const* task;
+    std::size_t count;
+    std::atomic<std::size_t> next;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::size_t finished;
+    std::exception_ptr error;
+};
+
+// a queued request, a run_tasks() helper when `group` is set, or an exit
+// token when neither is
+struct job
+{
+    uv_work_t* req;
+    work_cb work;
+    work_cb after;
+    std::shared_ptr<task_group> group;
+};
+
+class worker_pool
+{
+public:
+    worker_pool()
+      : mutex_(),
+        cond_(),
+        queue_(),
+        done_mutex_(),
+        done_(),
+        threads_(),
+        exited_(),
+        size_(0),
+        pending_(0),
+        async_(),
+        async_init_(false) {}
+
+    unsigned size() const { return size_; }
+
+    // main thread only
+    void resize(unsigned size)
+    {
+        if (!async_init_)
+        {
+            uv_async_init(uv_default_loop(), &async_, on_complete);
+            uv_unref(reinterpret_cast<uv_handle_t*>(&async_));
+            async_.data = this;
+            async_init_ = true;
+        }
+        reap();
+        if (size > size_)
+        {
+            for (unsigned i = size_; i < size; ++i)
+            {
+                threads_.push_back(std::thread(&worker_pool::run, this));
+            }
+        }
+        else if (size < size_)
+        {
+            // exit tokens queue behind already submitted jobs so nothing is dropped
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (unsigned i = size; i < size_; ++i)
+            {
+                job token = { NULL, NULL, NULL, std::shared_ptr<task_group>() };
+                queue_.push_back(token);
+            }
+            cond_.notify_all();
+        }
+        size_ = size;
+    }
+
+    // main thread only
+    void submit(uv_work_t* req, work_cb work, work_cb after)
+    {
+        if (pending_++ == 0)
+        {
+            uv_ref(reinterpret_cast<uv_handle_t*>(&async_));
+        }
+        job j = { req, work, after, std::shared_ptr<task_group>() };
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(j);
+        }
+        cond_.notify_one();
+    }
+
+    // any thread; helpers queue behind submitted jobs and find nothing left
+    // to do if the caller got through the tasks first
+    void help(std::shared_ptr<task_group> const& group, std::size_t helpers)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (std::size_t i = 0; i < helpers; ++i)
+            {
+                job j = { NULL, NULL, NULL, group };
+                queue_.push_back(j);
+            }
+        }
+        cond_.notify_all();
+    }
+
+    void stop()
+    {
+        if (size_ > 0)
+        {
+            resize(0);
+        }
+        for (std::thread & t : threads_)
+        {
+            t.join();
+        }
+        threads_.clear();
+        exited_.clear();
+    }
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            job j;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait(lock, [this] { return !queue_.empty(); });
+                j = queue_.front();
+                queue_.pop_front();
+                if (j.req == NULL && !j.group)
+                {
+                    exited_.push_back(std::this_thread::get_id());
+                    return;
+                }
+            }
+            if (j.group)
+            {
+                j.group->work();
+                continue;
+            }
+            j.work(j.req);
+            {
+                std::lock_guard<std::mutex> lock(done_mutex_);
+                done_.push_back(j);
+            }
+            uv_async_send(&async_);
+        }
+    }
+
+    // join threads that consumed an exit token
+    void reap()
+    {
+        std::vector<std::thread::id> exited;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            exited.swap(exited_);
+        }
+        for (std::thread::id const& id : exited)
+        {
+            for (std::vector<std::thread>::iterator itr = threads_.begin(); itr != threads_.end(); ++itr)
+            {
+                if (itr->get_id() == id)
+                {
+                    itr->join();
+                    threads_.erase(itr);
+                    break;
+                }
+            }
+        }
+    }
+
+#if NODE_MODULE_VERSION > 0x000B
+    static void on_complete(uv_async_t* handle)
+#else
+    static void on_complete(uv_async_t* handle, int)
+#endif
+    {
+        worker_pool * pool = static_cast<worker_pool *>(handle->data);
+        std::deque<job> done;
+        {
+            std::lock_guard<std::mutex> lock(pool->done_mutex_);
+            done.swap(pool->done_);
+        }
+        for (job const& j : done)
+        {
+            j.after(j.req);
+            if (--pool->pending_ == 0)
+            {
+                uv_unref(reinterpret_cast<uv_handle_t*>(&pool->async_));
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<job> queue_;
+    std::mutex done_mutex_;
+    std::deque<job> done_;
+    std::vector<std::thread> threads_;
+    std::vector<std::thread::id> exited_;
+    // read by run_tasks() on any thread
+    std::atomic<unsigned> size_;
+    unsigned pending_;
+    uv_async_t async_;
+    bool async_init_;
+};
+
+worker_pool & pool()
+{
+    static worker_pool instance;
+    return instance;
+}
+
+}
+
+void queue_work(uv_work_t* req, work_cb work, work_cb after)
+{
+    worker_pool & p = pool();
+    if (p.size() == 0)
+    {
+        uv_queue_work(uv_default_loop(), req, work, (uv_after_work_cb)after);
+        return;
+    }
+    p.submit(req, work, after);
+}
+
+void run_tasks(std::size_t count, std::function<void(std::size_t)> const& task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    std::shared_ptr<task_group> group = std::make_shared<task_group>(count, task);
+    std::size_t helpers = std::min<std::size_t>(count - 1, pool().size());
+    if (helpers > 0)
+    {
+        pool().help(group, helpers);
+    }
+    group->work();
+    group->wait();
+    if (group->error)
+    {
+        std::rethrow_exception(group->error);
+    }
+}
+
+NAN_METHOD(set_thread_pool)
+{
+    NanScope();
+
+    if (args.Length() != 1 || !args[0]->IsObject()) {
+        NanThrowTypeError("requires one argument: an options object, eg {size: 8}");
+        NanReturnUndefined();
+    }
+
+    Local<Object> options = args[0]->ToObject();
+    if (!options->Has(NanNew("size"))) {
+        NanThrowTypeError("option 'size' is required");
+        NanReturnUndefined();
+    }
+
+    Local<Value> bind_opt = options->Get(NanNew("size"));
+    if (!bind_opt->IsNumber() || bind_opt->IntegerValue() < 0) {
+        NanThrowTypeError("option 'size' must be a non-negative integer");
+        NanReturnUndefined();
+    }
+
+    pool().resize(static_cast<unsigned>(bind_opt->IntegerValue()));
+    // cached projections are per thread, so drop the ones of threads that
+    // have exited
+    clear_projection_cache();
+    NanReturnUndefined();
+}
+
+void shutdown_thread_pool()
+{
+    pool().stop();
+}
+
+}
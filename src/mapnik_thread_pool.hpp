@@ -0,0 +1,39 @@
+#ifndef __NODE_MAPNIK_THREAD_POOL_H__
+#define __NODE_MAPNIK_THREAD_POOL_H__
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <nan.h>
+#pragma GCC diagnostic pop
+
+// stl
+#include <cstddef>
+#include <functional>
+
+using namespace v8;
+
+namespace node_mapnik {
+
+typedef void (*work_cb)(uv_work_t* req);
+
+// Queue CPU bound work on the node-mapnik worker pool, or on the libuv
+// threadpool when the worker pool is disabled (the default). `after` is
+// always called on the main thread.
+void queue_work(uv_work_t* req, work_cb work, work_cb after);
+
+// Runs task(i) for every i in [0, count) on the calling thread and, when the
+// worker pool is enabled, on pool threads alongside it. Returns once every
+// task is done and rethrows the first exception a task threw. The caller
+// always takes part, so this is safe from inside a pool job; with the pool
+// disabled the tasks run one after another on the calling thread.
+void run_tasks(std::size_t count, std::function<void(std::size_t)> const& task);
+
+// mapnik.setThreadPool({size: N}) - a size of 0 disables the pool
+NAN_METHOD(set_thread_pool);
+
+// joins all worker threads, called from mapnik.shutdown()
+void shutdown_thread_pool();
+
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "utils.hpp"
+#include "mapnik_thread_pool.hpp"
+#include "mapnik_cancel_token.hpp"
+#include "render_layers.hpp"
 #include "mapnik_map.hpp"
 #include "mapnik_image.hpp"
 #include "mapnik_grid.hpp"
@@ -11,6 +14,9 @@
 #include "mapnik_vector_tile.hpp"
 #include "vector_tile_projection.hpp"
 #include "vector_tile_datasource.hpp"
+#include "vector_tile_datasource_pbf.hpp"
+#include "layer_query_index.hpp"
+#include "mapnik_projection_cache.hpp"
 #include "vector_tile_util.hpp"
 #include "vector_tile.pb.h"
 #include "object_to_container.hpp"
@@ -44,27 +50,43 @@
 
 #include MAPNIK_MAKE_SHARED_INCLUDE
 
+#include <algorithm>                    // for min, max
 #include <set>                          // for set, etc
 #include <sstream>                      // for operator<<, basic_ostream, etc
 #include <string>                       // for string, char_traits, etc
 #include <exception>                    // for exception
+#include <stdexcept>                    // for runtime_error
+#include <utility>                      // for forward
 #include <vector>                       // for vector
 #include "pbf.hpp"
 
 // addGeoJSON
 #include "vector_tile_processor.hpp"
 #include "vector_tile_backend_pbf.hpp"
-#include <mapnik/datasource_cache.hpp>
+#include "geojson_features.hpp"
+#include "memory_index_datasource.hpp"
 
 #include <google/protobuf/io/coded_stream.h>
 
+// Reads vertices by position rather than through the path's own cursor, so
+// features cached for queries can be measured from several threads at once.
 template <typename PathType>
-double path_to_point_distance(PathType & path, double x, double y)
+unsigned path_vertex(PathType const& path, std::size_t & pos, double * x, double * y)
+{
+    if (pos >= path.size())
+    {
+        return mapnik::SEG_END;
+    }
+    return path.get_vertex(pos++, x, y);
+}
+
+template <typename PathType>
+double path_to_point_distance(PathType const& path, double x, double y)
 {
     double x0 = 0;
     double y0 = 0;
     double distance = -1;
-    path.rewind(0);
+    std::size_t pos = 0;
     MAPNIK_GEOM_TYPE geom_type = static_cast<MAPNIK_GEOM_TYPE>(path.type());
     switch(geom_type)
     {
@@ -72,7 +94,7 @@ double path_to_point_distance(PathType & path, double x, double y)
     {
         unsigned command;
         bool first = true;
-        while (mapnik::SEG_END != (command = path.vertex(&x0, &y0)))
+        while (mapnik::SEG_END != (command = path_vertex(path, pos, &x0, &y0)))
         {
             if (command == mapnik::SEG_CLOSE) continue;
             if (first)
@@ -92,9 +114,9 @@ double path_to_point_distance(PathType & path, double x, double y)
         double x1 = 0;
         double y1 = 0;
         bool inside = false;
-        unsigned command = path.vertex(&x0, &y0);
+        unsigned command = path_vertex(path, pos, &x0, &y0);
         if (command == mapnik::SEG_END) return distance;
-        while (mapnik::SEG_END != (command = path.vertex(&x1, &y1)))
+        while (mapnik::SEG_END != (command = path_vertex(path, pos, &x1, &y1)))
         {
             if (command == mapnik::SEG_CLOSE) continue;
             if (command == mapnik::SEG_MOVETO)
@@ -120,9 +142,9 @@ double path_to_point_distance(PathType & path, double x, double y)
         double x1 = 0;
         double y1 = 0;
         bool first = true;
-        unsigned command = path.vertex(&x0, &y0);
+        unsigned command = path_vertex(path, pos, &x0, &y0);
         if (command == mapnik::SEG_END) return distance;
-        while (mapnik::SEG_END != (command = path.vertex(&x1, &y1)))
+        while (mapnik::SEG_END != (command = path_vertex(path, pos, &x1, &y1)))
         {
             if (command == mapnik::SEG_CLOSE) continue;
             if (command == mapnik::SEG_MOVETO)
@@ -200,15 +222,92 @@ VectorTile::VectorTile(int z, int x, int y, unsigned w, unsigned h) :
     z_(z),
     x_(x),
     y_(y),
-    buffer_(),
     status_(VectorTile::LAZY_DONE),
     tiledata_(),
     width_(w),
     height_(h),
     painted_(false),
-    byte_size_(0) {}
+    byte_size_(0),
+    buffer_(),
+    borrowed_data_(NULL),
+    borrowed_size_(0),
+    borrowed_buffer_(),
+    in_use_(0),
+    layers_mutex_(),
+    lazy_layers_(),
+    query_indexes_(),
+    indexed_data_(NULL),
+    indexed_size_(0),
+    indexed_start_(0) {}
+
+VectorTile::~VectorTile()
+{
+    NanDisposePersistent(borrowed_buffer_);
+}
+
+void VectorTile::acquire()
+{
+    ++in_use_;
+}
+
+void VectorTile::release()
+{
+    --in_use_;
+}
+
+int VectorTile::active() const
+{
+    return in_use_;
+}
 
-VectorTile::~VectorTile() { }
+// Workers read the raw bytes in place, so they must not be replaced or
+// reallocated while async jobs are running. Returns the error, if any.
+static std::string check_not_in_use(VectorTile* d, char const* method)
+{
+    if (d->active() == 0)
+    {
+        return std::string();
+    }
+    std::ostringstream s;
+    s << method << ": this tile appears to be in use by "
+      << d->active()
+      << " async operation(s) and its data cannot be changed until they finish";
+    return s.str();
+}
+
+// Keeps a reference to the caller's Buffer instead of copying its bytes.
+// The Buffer must not be modified while the tile holds on to it.
+void VectorTile::borrow_data(Local<Object> const& obj)
+{
+    NanDisposePersistent(borrowed_buffer_);
+    NanAssignPersistent(borrowed_buffer_, obj);
+    borrowed_data_ = node::Buffer::Data(obj);
+    borrowed_size_ = node::Buffer::Length(obj);
+    buffer_.clear();
+    // a new Buffer can reuse the address and length of the old one
+    reset_layer_index();
+}
+
+// Appending copies any borrowed bytes into owned storage first so the
+// caller's Buffer is never written to.
+void VectorTile::append_data(const char * bytes, std::size_t length)
+{
+    if (borrowed_data_)
+    {
+        std::string owned;
+        owned.reserve(borrowed_size_ + length);
+        owned.append(borrowed_data_, borrowed_size_);
+        owned.append(bytes, length);
+        buffer_.swap(owned);
+        borrowed_data_ = NULL;
+        borrowed_size_ = 0;
+        NanDisposePersistent(borrowed_buffer_);
+    }
+    else
+    {
+        buffer_.append(bytes, length);
+    }
+}
 
 NAN_METHOD(VectorTile::New)
 {
@@ -276,10 +375,10 @@ NAN_METHOD(VectorTile::New)
 std::vector<std::string> VectorTile::lazy_names()
 {
     std::vector<std::string> names;
-    std::size_t bytes = buffer_.size();
+    std::size_t bytes = size();
     if (bytes > 0)
     {
-        pbf::message item(buffer_.data(),bytes);
+        pbf::message item(data(),bytes);
         while (item.next()) {
             if (item.tag == 3) {
                 uint64_t len = item.varint();
@@ -300,6 +399,153 @@ std::vector<std::string> VectorTile::lazy_names()
     return names;
 }
 
+void VectorTile::reset_layer_index()
+{
+    std::lock_guard<std::mutex> lock(layers_mutex_);
+    lazy_layers_.clear();
+    query_indexes_.clear();
+    indexed_data_ = NULL;
+    indexed_size_ = 0;
+    indexed_start_ = 0;
+}
+
+// Layers already decoded into tiledata_ come first. After setData none are,
+// and after addData or composite only the bytes past byte_size_ are new.
+std::size_t VectorTile::parsed_layer_count() const
+{
+    return status_ == LAZY_SET ? 0 : static_cast<std::size_t>(tiledata_.layers_size());
+}
+
+// Records where each layer not yet in tiledata_ sits in the raw bytes.
+// Must be called with layers_mutex_ held.
+void VectorTile::index_layers()
+{
+    const char * bytes = data();
+    std::size_t length = size();
+    std::size_t start = 0;
+    if (status_ == LAZY_DONE)
+    {
+        start = length;
+    }
+    else if (status_ == LAZY_MERGE && byte_size_ > 0)
+    {
+        start = std::min(length, static_cast<std::size_t>(byte_size_));
+    }
+    if (indexed_data_ == bytes && indexed_size_ == length && indexed_start_ == start)
+    {
+        return;
+    }
+    std::vector<lazy_layer> layers;
+    if (length > start)
+    {
+        pbf::message item(bytes + start, length - start);
+        while (item.next()) {
+            if (item.tag == 3) {
+                uint64_t len = item.varint();
+                lazy_layer entry;
+                entry.offset = item.getData() - bytes;
+                entry.length = static_cast<std::size_t>(len);
+                pbf::message layermsg(item.getData(),entry.length);
+                while (layermsg.next()) {
+                    if (layermsg.tag == 1) {
+                        entry.name = layermsg.string();
+                    } else {
+                        layermsg.skip();
+                    }
+                }
+                item.skipBytes(len);
+                layers.push_back(std::move(entry));
+            } else {
+                item.skip();
+            }
+        }
+    }
+    lazy_layers_.swap(layers);
+    indexed_data_ = bytes;
+    indexed_size_ = length;
+    indexed_start_ = start;
+}
+
+std::vector<std::string> VectorTile::layer_names()
+{
+    std::lock_guard<std::mutex> lock(layers_mutex_);
+    index_layers();
+    std::size_t parsed = parsed_layer_count();
+    std::vector<std::string> names;
+    names.reserve(parsed + lazy_layers_.size());
+    for (std::size_t i = 0; i < parsed; ++i)
+    {
+        names.push_back(tiledata_.layers(static_cast<int>(i)).name());
+    }
+    for (lazy_layer const& entry : lazy_layers_)
+    {
+        names.push_back(entry.name);
+    }
+    return names;
+}
+
+int VectorTile::find_layer(std::string const& name)
+{
+    std::vector<std::string> names = layer_names();
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        if (names[i] == name)
+        {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// does not own the layers of the parsed tile
+static void no_delete(vector_tile::Tile_Layer const*) {}
+
+std::shared_ptr<vector_tile::Tile_Layer const> VectorTile::layer(std::size_t idx)
+{
+    std::lock_guard<std::mutex> lock(layers_mutex_);
+    std::size_t parsed = parsed_layer_count();
+    if (idx < parsed)
+    {
+        return std::shared_ptr<vector_tile::Tile_Layer const>(&tiledata_.layers(static_cast<int>(idx)), no_delete);
+    }
+    index_layers();
+    if (idx - parsed >= lazy_layers_.size())
+    {
+        throw std::runtime_error("layer index out of range");
+    }
+    lazy_layer & entry = lazy_layers_[idx - parsed];
+    if (!entry.decoded)
+    {
+        std::shared_ptr<vector_tile::Tile_Layer> decoded = std::make_shared<vector_tile::Tile_Layer>();
+        if (!decoded->ParseFromArray(data() + entry.offset, entry.length))
+        {
+            throw std::runtime_error("could not parse layer '" + entry.name + "' as protobuf");
+        }
+        entry.decoded = decoded;
+    }
+    // shared, so re-indexing the tile does not free it under a caller
+    return entry.decoded;
+}
+
+bool VectorTile::raw_layer(std::size_t idx, const char *& bytes, std::size_t & length)
+{
+    std::lock_guard<std::mutex> lock(layers_mutex_);
+    std::size_t parsed = parsed_layer_count();
+    if (idx < parsed)
+    {
+        return false;
+    }
+    index_layers();
+    if (idx - parsed >= lazy_layers_.size())
+    {
+        throw std::runtime_error("layer index out of range");
+    }
+    lazy_layer const& entry = lazy_layers_[idx - parsed];
+    bytes = data() + entry.offset;
+    length = entry.length;
+    return true;
+}
+
 void VectorTile::parse_proto()
 {
     switch (status_)
@@ -312,15 +558,16 @@ void VectorTile::parse_proto()
     case LAZY_SET:
     {
         status_ = LAZY_DONE;
-        std::size_t bytes = buffer_.size();
+        std::size_t bytes = size();
         if (bytes == 0)
         {
             throw std::runtime_error("cannot parse 0 length buffer as protobuf");
         }
-        if (tiledata_.ParseFromArray(buffer_.data(), bytes))
+        if (tiledata_.ParseFromArray(data(), bytes))
         {
             painted(true);
             cache_bytesize();
+            reset_layer_index();
         }
         else
         {
@@ -331,20 +578,21 @@ void VectorTile::parse_proto()
     case LAZY_MERGE:
     {
         status_ = LAZY_DONE;
-        std::size_t bytes = buffer_.size();
+        std::size_t bytes = size();
         if (bytes == 0)
         {
             throw std::runtime_error("cannot parse 0 length buffer as protobuf");
         }
         unsigned remaining = bytes - byte_size_;
-        const char * data = buffer_.data() + byte_size_;
+        const char * merge_data = data() + byte_size_;
         google::protobuf::io::CodedInputStream input(
               reinterpret_cast<const google::protobuf::uint8*>(
-                  data), remaining);
+                  merge_data), remaining);
         if (tiledata_.MergeFromCodedStream(&input))
         {
             painted(true);
             cache_bytesize();
+            reset_layer_index();
         }
         else
         {
@@ -355,6 +603,249 @@ void VectorTile::parse_proto()
     }
 }
 
+// tile_datasource only keeps a reference to its layer, so this holds on to
+// the layer for as long as the datasource is around
+class pinned_tile_datasource : public mapnik::vector_tile_impl::tile_datasource
+{
+public:
+    template <typename... Args>
+    pinned_tile_datasource(std::shared_ptr<vector_tile::Tile_Layer const> const& layer,
+                           Args &&... args)
+      : mapnik::vector_tile_impl::tile_datasource(*layer, std::forward<Args>(args)...),
+        layer_(layer) {}
+private:
+    std::shared_ptr<vector_tile::Tile_Layer const> layer_;
+};
+
+// Datasource over layer `idx` of the tile. A layer still only held as raw
+// bytes is read in place, without building protobuf objects; parsed layers
+// and layers with raster features go through tile_datasource.
+static mapnik::datasource_ptr layer_datasource(VectorTile* d,
+                                               std::size_t idx,
+                                               mapnik::box2d<double> const& envelope = mapnik::box2d<double>())
+{
+    const char * bytes = NULL;
+    std::size_t length = 0;
+    if (d->raw_layer(idx, bytes, length))
+    {
+        MAPNIK_SHARED_PTR<node_mapnik::tile_datasource_pbf> ds = MAPNIK_MAKE_SHARED<
+                                        node_mapnik::tile_datasource_pbf>(
+                                            bytes,
+                                            length,
+                                            d->x_,
+                                            d->y_,
+                                            d->z_,
+                                            d->width()
+                                            );
+        if (!ds->has_raster())
+        {
+            if (envelope.valid()) ds->set_envelope(envelope);
+            return ds;
+        }
+    }
+    MAPNIK_SHARED_PTR<pinned_tile_datasource> ds = MAPNIK_MAKE_SHARED<
+                                    pinned_tile_datasource>(
+                                        d->layer(idx),
+                                        d->x_,
+                                        d->y_,
+                                        d->z_,
+                                        d->width()
+                                        );
+    if (envelope.valid()) ds->set_envelope(envelope);
+    return ds;
+}
+
+std::shared_ptr<node_mapnik::layer_query_index> VectorTile::query_index(std::size_t idx)
+{
+    {
+        std::lock_guard<std::mutex> lock(layers_mutex_);
+        auto itr = query_indexes_.find(idx);
+        if (itr != query_indexes_.end())
+        {
+            return itr->second;
+        }
+    }
+    // built without the lock, which layer_datasource() takes itself; if two
+    // queries race to build the same index the first one stored wins
+    mapnik::datasource_ptr ds = layer_datasource(this, idx);
+    std::shared_ptr<node_mapnik::layer_query_index> index = std::make_shared<node_mapnik::layer_query_index>(*ds);
+    std::lock_guard<std::mutex> lock(layers_mutex_);
+    return query_indexes_.insert(std::make_pair(idx, index)).first->second;
+}
+
+static bool layer_has_features(VectorTile* d, std::size_t idx)
+{
+    const char * bytes = NULL;
+    std::size_t length = 0;
+    if (d->raw_layer(idx, bytes, length))
+    {
+        pbf::message layermsg(bytes, length);
+        while (layermsg.next()) {
+            if (layermsg.tag == 2) {
+                return true;
+            }
+            layermsg.skip();
+        }
+        return false;
+    }
+    return d->layer(idx)->features_size() > 0;
+}
+
+// options needed for re-rendering tiles
+// unclear yet to what extent these need to be user
+// driven, but we expose here to avoid hardcoding
+struct composite_options {
+    composite_options()
+      : path_multiplier(16),
+        buffer_size(1),
+        scale_factor(1.0),
+        offset_x(0),
+        offset_y(0),
+        tolerance(8),
+        scale_denominator(0.0),
+        max_extent(-20037508.34,-20037508.34,20037508.34,20037508.34),
+        merc_srs("+init=epsg:3857") {}
+    unsigned path_multiplier;
+    int buffer_size;
+    double scale_factor;
+    unsigned offset_x;
+    unsigned offset_y;
+    unsigned tolerance;
+    double scale_denominator;
+    // not options yet, likely should never be....
+    mapnik::box2d<double> max_extent;
+    std::string merc_srs;
+};
+
+// What one source tile contributes to the target: either its raw bytes,
+// which are copied on the main thread, or an encoded message.
+struct composite_result {
+    composite_result()
+      : raw(false),
+        message() {}
+    bool raw;
+    std::string message;
+};
+
+// Prepares the contribution of `vt` to `target_vt` without touching either
+// tile, so several source tiles can be processed on worker threads at once.
+static void composite_tile(VectorTile* target_vt,
+                           VectorTile* vt,
+                           composite_options const& opts,
+                           composite_result & result)
+{
+    // TODO - handle name clashes
+    if (target_vt->z_ == vt->z_ &&
+        target_vt->x_ == vt->x_ &&
+        target_vt->y_ == vt->y_)
+    {
+        int bytes = static_cast<int>(vt->size());
+        if (bytes > 0 && vt->byte_size() <= bytes) {
+            result.raw = true;
+        }
+        else if (vt->byte_size() > 0)
+        {
+            vector_tile::Tile const& tiledata = vt->get_tile();
+            if (!tiledata.SerializeToString(&result.message))
+            {
+                throw std::runtime_error("could not serialize new data for vt");
+            }
+        }
+        return;
+    }
+    vector_tile::Tile new_tiledata;
+    // set up to render to new vtile
+    typedef mapnik::vector_tile_impl::backend_pbf backend_type;
+    typedef mapnik::vector_tile_impl::processor<backend_type> renderer_type;
+    backend_type backend(new_tiledata, opts.path_multiplier);
+
+    // get mercator extent of target tile
+    mapnik::vector_tile_impl::spherical_mercator merc(target_vt->width());
+    double minx,miny,maxx,maxy;
+    merc.xyz(target_vt->x_,target_vt->y_,target_vt->z_,minx,miny,maxx,maxy);
+    mapnik::box2d<double> map_extent(minx,miny,maxx,maxy);
+    // create request
+    mapnik::request m_req(target_vt->width(),target_vt->height(),map_extent);
+    m_req.set_buffer_size(opts.buffer_size);
+    // create map
+    mapnik::Map map(target_vt->width(),target_vt->height(),opts.merc_srs);
+    map.set_maximum_extent(opts.max_extent);
+    // layers that are not parsed are read straight from the raw bytes,
+    // so the source tile is never mutated
+    std::vector<std::string> names = vt->layer_names();
+    if (!names.empty())
+    {
+        for (std::size_t i=0; i < names.size(); ++i)
+        {
+            mapnik::layer lyr(names[i],opts.merc_srs);
+            lyr.set_datasource(layer_datasource(vt, i, m_req.get_buffered_extent()));
+            map.MAPNIK_ADD_LAYER(lyr);
+        }
+        renderer_type ren(backend,
+                          map,
+                          m_req,
+                          opts.scale_factor,
+                          opts.offset_x,
+                          opts.offset_y,
+                          opts.tolerance);
+        ren.apply(opts.scale_denominator);
+    }
+    if (!new_tiledata.SerializeToString(&result.message))
+    {
+        throw std::runtime_error("could not serialize new data for vt");
+    }
+}
+
+// main thread only, since it may grow the target's buffer
+static void append_composite_result(VectorTile* target_vt,
+                                    VectorTile* vt,
+                                    composite_result const& result)
+{
+    if (result.raw)
+    {
+        target_vt->append_data(vt->data(),vt->size());
+        target_vt->status_ = VectorTile::LAZY_MERGE;
+    }
+    else if (!result.message.empty())
+    {
+        target_vt->append_data(result.message.data(),result.message.size());
+        target_vt->status_ = VectorTile::LAZY_MERGE;
+    }
+}
+
+struct vector_tile_composite_baton_t;
+
+// one source tile, re-rendered as its own job on the worker pool
+struct vector_tile_composite_job {
+    uv_work_t request;
+    vector_tile_composite_baton_t *closure;
+    std::size_t index;
+    bool error;
+    std::string error_name;
+    vector_tile_composite_job() :
+      closure(NULL),
+      index(0),
+      error(false),
+      error_name() {}
+};
+
+struct vector_tile_composite_baton_t {
+    VectorTile* d;
+    std::vector<VectorTile*> tiles;
+    composite_options opts;
+    std::vector<composite_result> results;
+    std::vector<vector_tile_composite_job> jobs;
+    std::size_t remaining; // jobs still running, main thread only
+    Persistent<Function> cb;
+    vector_tile_composite_baton_t() :
+      d(NULL),
+      tiles(),
+      opts(),
+      results(),
+      jobs(),
+      remaining(0) {}
+};
+
 NAN_METHOD(VectorTile::composite)
 {
     NanScope();
@@ -369,23 +860,15 @@ NAN_METHOD(VectorTile::composite)
         NanReturnUndefined();
     }
 
-    // options needed for re-rendering tiles
-    // unclear yet to what extent these need to be user
-    // driven, but we expose here to avoid hardcoding
-    unsigned path_multiplier = 16;
-    int buffer_size = 1;
-    double scale_factor = 1.0;
-    unsigned offset_x = 0;
-    unsigned offset_y = 0;
-    unsigned tolerance = 8;
-    double scale_denominator = 0.0;
-    // not options yet, likely should never be....
-    mapnik::box2d<double> max_extent(-20037508.34,-20037508.34,20037508.34,20037508.34);
-    std::string merc_srs("+init=epsg:3857");
+    // an optional trailing callback composites on the threadpool
+    Local<Value> callback = args[args.Length() - 1];
+    bool async = args.Length() > 1 && callback->IsFunction();
+    int num_args = async ? args.Length() - 1 : args.Length();
 
+    composite_options opts;
     Local<Object> options = NanNew<Object>();
 
-    if (args.Length() > 1) {
+    if (num_args > 1) {
         // options object
         if (!args[1]->IsObject())
         {
@@ -401,7 +884,7 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("option 'path_multiplier' must be an unsigned integer");
                 NanReturnUndefined();
             }
-            path_multiplier = param_val->NumberValue();
+            opts.path_multiplier = param_val->NumberValue();
         }
         if (options->Has(NanNew("tolerance")))
         {
@@ -411,7 +894,7 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("tolerance value must be a number");
                 NanReturnUndefined();
             }
-            tolerance = tol->NumberValue();
+            opts.tolerance = tol->NumberValue();
         }
         if (options->Has(NanNew("buffer_size"))) {
             Local<Value> bind_opt = options->Get(NanNew("buffer_size"));
@@ -420,7 +903,7 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("optional arg 'buffer_size' must be a number");
                 NanReturnUndefined();
             }
-            buffer_size = bind_opt->IntegerValue();
+            opts.buffer_size = bind_opt->IntegerValue();
         }
         if (options->Has(NanNew("scale"))) {
             Local<Value> bind_opt = options->Get(NanNew("scale"));
@@ -429,7 +912,7 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("optional arg 'scale' must be a number");
                 NanReturnUndefined();
             }
-            scale_factor = bind_opt->NumberValue();
+            opts.scale_factor = bind_opt->NumberValue();
         }
         if (options->Has(NanNew("scale_denominator")))
         {
@@ -439,7 +922,7 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("optional arg 'scale_denominator' must be a number");
                 NanReturnUndefined();
             }
-            scale_denominator = bind_opt->NumberValue();
+            opts.scale_denominator = bind_opt->NumberValue();
         }
         if (options->Has(NanNew("offset_x"))) {
             Local<Value> bind_opt = options->Get(NanNew("offset_x"));
@@ -448,7 +931,7 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("optional arg 'offset_x' must be a number");
                 NanReturnUndefined();
             }
-            offset_x = bind_opt->IntegerValue();
+            opts.offset_x = bind_opt->IntegerValue();
         }
         if (options->Has(NanNew("offset_y"))) {
             Local<Value> bind_opt = options->Get(NanNew("offset_y"));
@@ -457,13 +940,19 @@ NAN_METHOD(VectorTile::composite)
                 NanThrowTypeError("optional arg 'offset_y' must be a number");
                 NanReturnUndefined();
             }
-            offset_y = bind_opt->IntegerValue();
+            opts.offset_y = bind_opt->IntegerValue();
         }
     }
 
     VectorTile* target_vt = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
-    vector_tile::Tile new_tiledata;
-    vector_tile::Tile new_tiledata2;
+    std::string in_use = check_not_in_use(target_vt, "composite");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        NanReturnUndefined();
+    }
+    std::vector<VectorTile*> tiles;
+    tiles.reserve(num_tiles);
     for (unsigned i=0;i < num_tiles;++i) {
         Local<Value> val = vtiles->Get(i);
         if (!val->IsObject()) {
@@ -475,143 +964,132 @@ NAN_METHOD(VectorTile::composite)
             NanThrowTypeError("must provide an array of VectorTile objects");
             NanReturnUndefined();
         }
-        VectorTile* vt = node::ObjectWrap::Unwrap<VectorTile>(tile_obj);
-        // TODO - handle name clashes
-        if (target_vt->z_ == vt->z_ &&
-            target_vt->x_ == vt->x_ &&
-            target_vt->y_ == vt->y_)
+        tiles.push_back(node::ObjectWrap::Unwrap<VectorTile>(tile_obj));
+    }
+
+    if (async)
+    {
+        vector_tile_composite_baton_t *closure = new vector_tile_composite_baton_t();
+        closure->d = target_vt;
+        closure->tiles = tiles;
+        closure->opts = opts;
+        closure->results.resize(num_tiles);
+        closure->jobs.resize(num_tiles);
+        closure->remaining = num_tiles;
+        NanAssignPersistent(closure->cb, callback.As<Function>());
+        // the target is held too, so its data is not changed before the
+        // results are merged
+        target_vt->acquire();
+        target_vt->Ref();
+        for (VectorTile* vt : tiles)
         {
-            int bytes = static_cast<int>(vt->buffer_.size());
-            if (bytes > 0 && vt->byte_size_ <= bytes) {
-                target_vt->buffer_.append(vt->buffer_.data(),vt->buffer_.size());
-                target_vt->status_ = VectorTile::LAZY_MERGE;
-            }
-            else if (vt->byte_size_ > 0)
-            {
-                std::string new_message;
-                vector_tile::Tile const& tiledata = vt->get_tile();
-                if (!tiledata.SerializeToString(&new_message))
-                {
-                    NanThrowTypeError("could not serialize new data for vt");
-                    NanReturnUndefined();
-                }
-                if (!new_message.empty())
-                {
-                    target_vt->buffer_.append(new_message.data(),new_message.size());
-                    target_vt->status_ = VectorTile::LAZY_MERGE;
-                }
-            }
+            vt->acquire();
+            vt->Ref();
         }
-        else
+        // re-rendering a source tile only reads it, so each tile is queued
+        // as its own job and the results are merged once all are done
+        for (std::size_t i = 0; i < num_tiles; ++i)
         {
-            new_tiledata.Clear();
-            // set up to render to new vtile
-            typedef mapnik::vector_tile_impl::backend_pbf backend_type;
-            typedef mapnik::vector_tile_impl::processor<backend_type> renderer_type;
-            backend_type backend(new_tiledata, path_multiplier);
-
-            // get mercator extent of target tile
-            mapnik::vector_tile_impl::spherical_mercator merc(target_vt->width());
-            double minx,miny,maxx,maxy;
-            merc.xyz(target_vt->x_,target_vt->y_,target_vt->z_,minx,miny,maxx,maxy);
-            mapnik::box2d<double> map_extent(minx,miny,maxx,maxy);
-            // create request
-            mapnik::request m_req(target_vt->width(),target_vt->height(),map_extent);
-            m_req.set_buffer_size(buffer_size);
-            // create map
-            mapnik::Map map(target_vt->width(),target_vt->height(),merc_srs);
-            map.set_maximum_extent(max_extent);
-            // ensure data is in tile object
-            if (vt->status_ == LAZY_DONE) // tile is already parsed, we're good
-            {
-                vector_tile::Tile const& tiledata = vt->get_tile();
-                unsigned num_layers = tiledata.layers_size();
-                if (num_layers > 0)
-                {
-                    for (int i=0; i < tiledata.layers_size(); ++i)
-                    {
-                        vector_tile::Tile_Layer const& layer = tiledata.layers(i);
-                        mapnik::layer lyr(layer.name(),merc_srs);
-                        MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                                        mapnik::vector_tile_impl::tile_datasource>(
-                                                            layer,
-                                                            vt->x_,
-                                                            vt->y_,
-                                                            vt->z_,
-                                                            vt->width()
-                                                            );
-                        ds->set_envelope(m_req.get_buffered_extent());
-                        lyr.set_datasource(ds);
-                        map.MAPNIK_ADD_LAYER(lyr);
-                    }
-                    renderer_type ren(backend,
-                                      map,
-                                      m_req,
-                                      scale_factor,
-                                      offset_x,
-                                      offset_y,
-                                      tolerance);
-                    ren.apply(scale_denominator);
-                }
-            }
-            else // tile is not pre-parsed so parse into new object to avoid needing to mutate input
-            {
-                std::size_t bytes = vt->buffer_.size();
-                if (bytes > 1) // throw instead?
-                {
-                    if (new_tiledata2.ParseFromArray(vt->buffer_.data(), bytes))
-                    {
-                        unsigned num_layers = new_tiledata2.layers_size();
-                        if (num_layers > 0)
-                        {
-                            for (int i=0; i < new_tiledata2.layers_size(); ++i)
-                            {
-                                vector_tile::Tile_Layer const& layer = new_tiledata2.layers(i);
-                                mapnik::layer lyr(layer.name(),merc_srs);
-                                MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                                                mapnik::vector_tile_impl::tile_datasource>(
-                                                                    layer,
-                                                                    vt->x_,
-                                                                    vt->y_,
-                                                                    vt->z_,
-                                                                    vt->width()
-                                                                    );
-                                ds->set_envelope(m_req.get_buffered_extent());
-                                lyr.set_datasource(ds);
-                                map.MAPNIK_ADD_LAYER(lyr);
-                            }
-                            renderer_type ren(backend,
-                                              map,
-                                              m_req,
-                                              scale_factor,
-                                              offset_x,
-                                              offset_y,
-                                              tolerance);
-                            ren.apply(scale_denominator);
-                        }
-                    }
-                    else
-                    {
-                        // throw here?
-                    }
-                }
-            }
-            std::string new_message;
-            if (!new_tiledata.SerializeToString(&new_message))
-            {
-                NanThrowError("could not serialize new data for vt");
-                NanReturnUndefined();
-            }
-            if (!new_message.empty())
-            {
-                target_vt->buffer_.append(new_message.data(),new_message.size());
-                target_vt->status_ = VectorTile::LAZY_MERGE;
-            }
+            vector_tile_composite_job & job = closure->jobs[i];
+            job.request.data = &job;
+            job.closure = closure;
+            job.index = i;
+            node_mapnik::queue_work(&job.request, EIO_Composite, EIO_AfterComposite);
+        }
+        NanReturnUndefined();
+    }
+
+    try
+    {
+        for (VectorTile* vt : tiles)
+        {
+            composite_result result;
+            composite_tile(target_vt, vt, opts, result);
+            append_composite_result(target_vt, vt, result);
         }
     }
+    catch (std::exception const& ex)
+    {
+        NanThrowError(ex.what());
+        NanReturnUndefined();
+    }
     NanReturnUndefined();
 }
 
+void VectorTile::EIO_Composite(uv_work_t* req)
+{
+    vector_tile_composite_job *job = static_cast<vector_tile_composite_job *>(req->data);
+    vector_tile_composite_baton_t *closure = job->closure;
+    try
+    {
+        composite_tile(closure->d,
+                       closure->tiles[job->index],
+                       closure->opts,
+                       closure->results[job->index]);
+    }
+    catch (std::exception const& ex)
+    {
+        job->error = true;
+        job->error_name = ex.what();
+    }
+}
+
+void VectorTile::EIO_AfterComposite(uv_work_t* req)
+{
+    NanScope();
+    vector_tile_composite_job *job = static_cast<vector_tile_composite_job *>(req->data);
+    vector_tile_composite_baton_t *closure = job->closure;
+    if (--closure->remaining > 0)
+    {
+        return;
+    }
+    for (VectorTile* vt : closure->tiles)
+    {
+        vt->release();
+    }
+    closure->d->release();
+
+    // the first failed tile in the order they were passed
+    std::string const* error_name = NULL;
+    for (vector_tile_composite_job const& tile_job : closure->jobs)
+    {
+        if (tile_job.error)
+        {
+            error_name = &tile_job.error_name;
+            break;
+        }
+    }
+    // other async jobs may have started reading the target meanwhile
+    std::string in_use = check_not_in_use(closure->d, "composite");
+    if (!error_name && !in_use.empty())
+    {
+        error_name = &in_use;
+    }
+    if (error_name)
+    {
+        Local<Value> argv[1] = { NanError(error_name->c_str()) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    }
+    else
+    {
+        // results are merged in order on the main thread, which owns the
+        // target's buffer
+        for (std::size_t i = 0; i < closure->tiles.size(); ++i)
+        {
+            append_composite_result(closure->d, closure->tiles[i], closure->results[i]);
+        }
+        Local<Value> argv[2] = { NanNull(), NanObjectWrapHandle(closure->d) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+    }
+    for (VectorTile* vt : closure->tiles)
+    {
+        vt->Unref();
+    }
+    closure->d->Unref();
+    NanDisposePersistent(closure->cb);
+    delete closure;
+}
+
 #ifdef PROTOBUF_FULL
 NAN_METHOD(VectorTile::toString)
 {
@@ -626,7 +1104,7 @@ NAN_METHOD(VectorTile::names)
 {
     NanScope();
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
-    int raw_size = d->buffer_.size();
+    int raw_size = d->size();
     if (raw_size > 0 && d->byte_size_ <= raw_size)
     {
         std::vector<std::string> names = d->lazy_names();
@@ -652,10 +1130,10 @@ NAN_METHOD(VectorTile::names)
 
 bool VectorTile::lazy_empty()
 {
-    std::size_t bytes = buffer_.size();
+    std::size_t bytes = size();
     if (bytes > 0)
     {
-        pbf::message item(buffer_.data(),bytes);
+        pbf::message item(data(),bytes);
         while (item.next()) {
             if (item.tag == 3) {
                 uint64_t len = item.varint();
@@ -682,7 +1160,7 @@ NAN_METHOD(VectorTile::empty)
 {
     NanScope();
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
-    int raw_size = d->buffer_.size();
+    int raw_size = d->size();
     if (raw_size > 0 && d->byte_size_ <= raw_size)
     {
         NanReturnValue(NanNew<Boolean>(d->lazy_empty()));
@@ -806,7 +1284,8 @@ NAN_METHOD(VectorTile::query)
         closure->d = d;
         closure->error = false;
         NanAssignPersistent(closure->cb, callback.As<Function>());
-        uv_queue_work(uv_default_loop(), &closure->request, EIO_Query, (uv_after_work_cb)EIO_AfterQuery);
+        node_mapnik::queue_work(&closure->request, EIO_Query, EIO_AfterQuery);
+        d->acquire();
         d->Ref();
         NanReturnUndefined();
     }
@@ -830,6 +1309,7 @@ void VectorTile::EIO_AfterQuery(uv_work_t* req)
 {
     NanScope();
     vector_tile_query_baton_t *closure = static_cast<vector_tile_query_baton_t *>(req->data);
+    closure->d->release();
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
@@ -849,120 +1329,58 @@ void VectorTile::EIO_AfterQuery(uv_work_t* req)
 
 std::vector<query_result> VectorTile::_query(VectorTile* d, double lon, double lat, double tolerance, std::string const& layer_name) {
     std::vector<query_result> arr;
-    mapnik::projection wgs84("+init=epsg:4326",true);
-    mapnik::projection merc("+init=epsg:3857",true);
-    mapnik::proj_transform tr(wgs84,merc);
     double x = lon;
     double y = lat;
-    double z = 0;
-    if (!tr.forward(x,y,z))
-    {
-        throw std::runtime_error("could not reproject lon/lat to mercator");
-    }
-    vector_tile::Tile const& tiledata = d->get_tile();
-    mapnik::coord2d pt(x,y);
+    node_mapnik::lonlat_to_merc(x,y);
+    mapnik::box2d<double> bbox(x - tolerance, y - tolerance, x + tolerance, y + tolerance);
+    std::vector<std::size_t> layer_indexes;
+    std::vector<std::string> names = d->layer_names();
     if (!layer_name.empty())
     {
-        int layer_idx = -1;
-        for (int j=0; j < tiledata.layers_size(); ++j)
-        {
-            vector_tile::Tile_Layer const& layer = tiledata.layers(j);
-            if (layer_name == layer.name())
-            {
-                layer_idx = j;
-                break;
-            }
-        }
+        int layer_idx = d->find_layer(layer_name);
         if (layer_idx > -1)
         {
-            vector_tile::Tile_Layer const& layer = tiledata.layers(layer_idx);
-            MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                        mapnik::vector_tile_impl::tile_datasource>(
-                                            layer,
-                                            d->x_,
-                                            d->y_,
-                                            d->z_,
-                                            d->width()
-                                            );
-            mapnik::featureset_ptr fs = ds->features_at_point(pt,tolerance);
-            if (fs)
-            {
-                mapnik::feature_ptr feature;
-                while ((feature = fs->next()))
-                {
-                    double distance = -1;
-                    for (mapnik::geometry_type const& geom : feature->paths())
-                    {
-                        double d = path_to_point_distance(geom,x,y);
-                        if (d >= 0)
-                        {
-                            if (distance >= 0)
-                            {
-                                if (d < distance) distance = d;
-                            }
-                            else
-                            {
-                                distance = d;
-                            }
-                        }
-                    }
-                    if (distance >= 0)
-                    {
-                        query_result res;
-                        res.distance = distance;
-                        res.layer = layer.name();
-                        res.feature = feature;
-                        arr.push_back(std::move(res));
-                    }
-                }
-            }
+            layer_indexes.push_back(layer_idx);
         }
     }
     else
     {
-        for (int i=0; i < tiledata.layers_size(); ++i)
+        for (std::size_t i=0; i < names.size(); ++i)
         {
-            vector_tile::Tile_Layer const& layer = tiledata.layers(i);
-            MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                        mapnik::vector_tile_impl::tile_datasource>(
-                                            layer,
-                                            d->x_,
-                                            d->y_,
-                                            d->z_,
-                                            d->width()
-                                            );
-            mapnik::featureset_ptr fs = ds->features_at_point(pt,tolerance);
-            if (fs)
+            layer_indexes.push_back(i);
+        }
+    }
+    for (std::size_t i : layer_indexes)
+    {
+        // only features whose bounding box is within tolerance are measured
+        std::vector<node_mapnik::layer_query_index::entry> candidates = d->query_index(i)->query(bbox);
+        for (node_mapnik::layer_query_index::entry const& candidate : candidates)
+        {
+            mapnik::feature_ptr const& feature = candidate.feature;
+            double distance = -1;
+            for (mapnik::geometry_type const& geom : feature->paths())
             {
-                mapnik::feature_ptr feature;
-                while ((feature = fs->next()))
+                double d = path_to_point_distance(geom,x,y);
+                if (d >= 0)
                 {
-                    double distance = -1;
-                    for (mapnik::geometry_type const& geom : feature->paths())
+                    if (distance >= 0)
                     {
-                        double d = path_to_point_distance(geom,x,y);
-                        if (d >= 0)
-                        {
-                            if (distance >= 0)
-                            {
-                                if (d < distance) distance = d;
-                            }
-                            else
-                            {
-                                distance = d;
-                            }
-                        }
+                        if (d < distance) distance = d;
                     }
-                    if (distance >= 0)
+                    else
                     {
-                        query_result res;
-                        res.distance = distance;
-                        res.layer = layer.name();
-                        res.feature = feature;
-                        arr.push_back(std::move(res));
+                        distance = d;
                     }
                 }
             }
+            if (distance >= 0)
+            {
+                query_result res;
+                res.distance = distance;
+                res.layer = names[i];
+                res.feature = feature;
+                arr.push_back(std::move(res));
+            }
         }
     }
     std::sort(arr.begin(), arr.end(), _querySort);
@@ -993,6 +1411,7 @@ typedef struct {
     double tolerance;
     std::string layer_name;
     std::vector<std::string> fields;
+    bool all_points;
     queryMany_result result;
     bool error;
     std::string error_name;
@@ -1012,6 +1431,7 @@ NAN_METHOD(VectorTile::queryMany)
     double tolerance = 0.0; // meters
     std::string layer_name("");
     std::vector<std::string> fields;
+    bool all_points = true;
     std::vector<query_lonlat> query;
 
     // Convert v8 queryArray to a std vector
@@ -1087,6 +1507,16 @@ NAN_METHOD(VectorTile::queryMany)
                 ++i;
             }
         }
+        if (options->Has(NanNew("all_points")))
+        {
+            Local<Value> param_val = options->Get(NanNew("all_points"));
+            if (!param_val->IsBoolean())
+            {
+                NanThrowTypeError("option 'all_points' must be a boolean");
+                NanReturnUndefined();
+            }
+            all_points = param_val->BooleanValue();
+        }
     }
 
     if (layer_name.empty())
@@ -1100,7 +1530,7 @@ NAN_METHOD(VectorTile::queryMany)
     // If last argument is not a function go with sync call.
     if (!args[args.Length()-1]->IsFunction()) {
         try  {
-            queryMany_result result = _queryMany(d, query, tolerance, layer_name, fields);
+            queryMany_result result = _queryMany(d, query, tolerance, layer_name, fields, all_points);
             Local<Object> result_obj = _queryManyResultToV8(result);
             NanReturnValue(result_obj);
         }
@@ -1117,149 +1547,162 @@ NAN_METHOD(VectorTile::queryMany)
         closure->tolerance = tolerance;
         closure->layer_name = layer_name;
         closure->fields = fields;
+        closure->all_points = all_points;
         closure->error = false;
         closure->request.data = closure;
         NanAssignPersistent(closure->cb, callback.As<Function>());
-        uv_queue_work(uv_default_loop(), &closure->request, EIO_QueryMany, (uv_after_work_cb)EIO_AfterQueryMany);
+        node_mapnik::queue_work(&closure->request, EIO_QueryMany, EIO_AfterQueryMany);
+        d->acquire();
         d->Ref();
         NanReturnUndefined();
     }
 }
 
-queryMany_result VectorTile::_queryMany(VectorTile* d, std::vector<query_lonlat> const& query, double tolerance, std::string const& layer_name, std::vector<std::string> const& fields) {
-    vector_tile::Tile const& tiledata = d->get_tile();
-    int layer_idx = -1;
-    for (int j=0; j < tiledata.layers_size(); ++j)
+// A copy of `feature` that only carries the attributes in `ctx`.
+static mapnik::feature_ptr feature_with_fields(mapnik::feature_impl const& feature,
+                                               mapnik::context_ptr const& ctx,
+                                               std::vector<std::string> const& fields)
+{
+    mapnik::feature_ptr result(mapnik::feature_factory::create(ctx,feature.id()));
+    for (mapnik::geometry_type const& geom : feature.paths())
     {
-        vector_tile::Tile_Layer const& layer = tiledata.layers(j);
-        if (layer_name == layer.name())
+        mapnik::geometry_type * copy = new mapnik::geometry_type(geom.type());
+        for (std::size_t i = 0; i < geom.size(); ++i)
         {
-            layer_idx = j;
-            break;
+            double gx = 0;
+            double gy = 0;
+            unsigned cmd = geom.get_vertex(i, &gx, &gy);
+            copy->push_vertex(gx, gy, static_cast<mapnik::CommandType>(cmd));
+        }
+        result->add_geometry(copy);
+    }
+    for (std::string const& name : fields)
+    {
+        if (feature.has_key(name))
+        {
+            result->put(name, feature.get(name));
         }
     }
+    return result;
+}
+
+// With `all_points` every feature near any of the points is measured
+// against all of them, so far away hits are reported too. Otherwise, like
+// query() for each point, a feature is only measured against the points
+// within `tolerance` of its bounding box, which the grid finds without
+// looking at the others.
+queryMany_result VectorTile::_queryMany(VectorTile* d, std::vector<query_lonlat> const& query, double tolerance, std::string const& layer_name, std::vector<std::string> const& fields, bool all_points) {
+    int layer_idx = d->find_layer(layer_name);
     if (layer_idx == -1)
     {
         throw std::runtime_error("Could not find layer in vector tile");
     }
 
-    std::map<unsigned,query_result> features;
-    std::map<unsigned,std::vector<query_hit> > hits;
+    queryMany_result result;
+    result.hits.resize(query.size());
 
     // Reproject query => mercator points
     mapnik::box2d<double> bbox;
-    mapnik::projection wgs84("+init=epsg:4326",true);
-    mapnik::projection merc("+init=epsg:3857",true);
-    mapnik::proj_transform tr(wgs84,merc);
     std::vector<mapnik::coord2d> points;
     points.reserve(query.size());
     for (std::size_t p = 0; p < query.size(); ++p) {
         double x = query[p].lon;
         double y = query[p].lat;
-        double z = 0;
-        if (!tr.forward(x,y,z))
-        {
-            throw std::runtime_error("could not reproject lon/lat to mercator");
-        }
+        node_mapnik::lonlat_to_merc(x,y);
         mapnik::coord2d pt(x,y);
         bbox.expand_to_include(pt);
         points.emplace_back(std::move(pt));
     }
     bbox.pad(tolerance);
+    node_mapnik::query_point_grid grid(points);
 
-    vector_tile::Tile_Layer const& layer = tiledata.layers(layer_idx);
-    MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                mapnik::vector_tile_impl::tile_datasource>(
-                                    layer,
-                                    d->x_,
-                                    d->y_,
-                                    d->z_,
-                                    d->width()
-                                    );
-    mapnik::query q(bbox);
-    if (fields.empty())
+    // restricting attributes to `fields` means copying the cached
+    // features, so only features that are hit get copied
+    mapnik::context_ptr ctx;
+    if (!fields.empty())
     {
-        // request all data attributes
-        for (int i = 0; i < layer.keys_size(); ++i)
+        ctx = MAPNIK_MAKE_SHARED<mapnik::context_type>();
+        for (std::string const& name : fields)
         {
-            q.add_property_name(layer.keys(i));
+            ctx->push(name);
         }
     }
-    else
+    std::vector<node_mapnik::layer_query_index::entry> candidates = d->query_index(layer_idx)->query(bbox);
+    std::vector<std::size_t> every_point;
+    if (all_points)
     {
-        for ( std::string const& name : fields)
+        every_point.resize(points.size());
+        for (std::size_t p = 0; p < points.size(); ++p)
         {
-            q.add_property_name(name);
+            every_point[p] = p;
         }
     }
-    mapnik::featureset_ptr fs = ds->features(q);
-
-    if (fs)
+    std::vector<std::size_t> grid_points;
+    for (node_mapnik::layer_query_index::entry const& candidate : candidates)
     {
-        mapnik::feature_ptr feature;
-        unsigned idx = 0;
-        while ((feature = fs->next()))
+        mapnik::feature_ptr const& feature = candidate.feature;
+        // a polygon only hits points inside it, so even with `all_points`
+        // only the points the grid finds in its bounding box are measured
+        bool polygons_only = !feature->paths().empty();
+        for (mapnik::geometry_type const& geom : feature->paths())
         {
-            unsigned has_hit = 0;
-            for (std::size_t p = 0; p < points.size(); ++p) {
-                mapnik::coord2d const& pt = points[p];
-                double distance = -1;
-                for (mapnik::geometry_type const& geom : feature->paths())
+            if (static_cast<MAPNIK_GEOM_TYPE>(geom.type()) != MAPNIK_POLYGON)
+            {
+                polygons_only = false;
+                break;
+            }
+        }
+        std::vector<std::size_t> const* tested = &every_point;
+        if (!all_points || polygons_only)
+        {
+            mapnik::box2d<double> envelope = candidate.envelope;
+            envelope.pad(tolerance);
+            grid.query(envelope, grid_points);
+            tested = &grid_points;
+        }
+        bool has_hit = false;
+        unsigned feature_id = static_cast<unsigned>(result.features.size());
+        for (std::size_t p : *tested) {
+            mapnik::coord2d const& pt = points[p];
+            double distance = -1;
+            for (mapnik::geometry_type const& geom : feature->paths())
+            {
+                double d = path_to_point_distance(geom,pt.x,pt.y);
+                if (d >= 0)
                 {
-                    double d = path_to_point_distance(geom,pt.x,pt.y);
-                    if (d >= 0)
+                    if (distance >= 0)
                     {
-                        if (distance >= 0)
-                        {
-                            if (d < distance) distance = d;
-                        }
-                        else
-                        {
-                            distance = d;
-                        }
+                        if (d < distance) distance = d;
                     }
-                }
-                if (distance >= 0)
-                {
-                    has_hit = 1;
-                    query_result res;
-                    res.feature = feature;
-                    res.distance = 0;
-                    res.layer = layer.name();
-
-                    query_hit hit;
-                    hit.distance = distance;
-                    hit.feature_id = idx;
-
-                    features.insert(std::make_pair(idx, res));
-
-                    std::map<unsigned,std::vector<query_hit> >::iterator hits_it;
-                    hits_it = hits.find(p);
-                    if (hits_it == hits.end()) {
-                        std::vector<query_hit> pointHits;
-                        pointHits.reserve(1);
-                        pointHits.push_back(std::move(hit));
-                        hits.insert(std::make_pair(p, pointHits));
-                    } else {
-                        hits_it->second.push_back(std::move(hit));
+                    else
+                    {
+                        distance = d;
                     }
                 }
             }
-            if (has_hit > 0) {
-                idx++;
+            if (distance >= 0)
+            {
+                has_hit = true;
+                query_hit hit;
+                hit.distance = distance;
+                hit.feature_id = feature_id;
+                result.hits[p].push_back(std::move(hit));
             }
         }
+        if (has_hit)
+        {
+            query_result res;
+            res.feature = ctx ? feature_with_fields(*feature, ctx, fields) : feature;
+            res.distance = 0;
+            res.layer = layer_name;
+            result.features.push_back(std::move(res));
+        }
     }
 
     // Sort each group of hits by distance.
-    typedef std::map<unsigned,std::vector<query_hit> >::iterator hits_it_type;
-    for (hits_it_type it = hits.begin(); it != hits.end(); it++) {
-        std::sort(it->second.begin(), it->second.end(), _queryManySort);
+    for (std::vector<query_hit> & point_hits : result.hits) {
+        std::sort(point_hits.begin(), point_hits.end(), _queryManySort);
     }
-
-    queryMany_result result;
-    result.hits = hits;
-    result.features = features;
     return result;
 }
 
@@ -1275,25 +1718,27 @@ Local<Object> VectorTile::_queryManyResultToV8(queryMany_result const& result) {
     results->Set(NanNew("features"), features);
 
     // result.features => features
-    typedef std::map<unsigned,query_result>::const_iterator features_it_type;
-    for (features_it_type it = result.features.begin(); it != result.features.end(); it++) {
-        Handle<Value> feat = Feature::New(it->second.feature);
+    for (std::size_t i = 0; i < result.features.size(); ++i) {
+        Handle<Value> feat = Feature::New(result.features[i].feature);
         Local<Object> feat_obj = feat->ToObject();
-        feat_obj->Set(NanNew("layer"),NanNew(it->second.layer.c_str()));
-        features->Set(it->first, feat_obj);
+        feat_obj->Set(NanNew("layer"),NanNew(result.features[i].layer.c_str()));
+        features->Set(i, feat_obj);
     }
 
-    // result.hits => hits
-    typedef std::map<unsigned,std::vector<query_hit> >::const_iterator results_it_type;
-    for (results_it_type it = result.hits.begin(); it != result.hits.end(); it++) {
-        Local<Array> point_hits = NanNew<Array>();
-        for (std::size_t i = 0; i < it->second.size(); ++i) {
+    // result.hits => hits, leaving points without hits unset
+    for (std::size_t p = 0; p < result.hits.size(); ++p) {
+        std::vector<query_hit> const& point_hits = result.hits[p];
+        if (point_hits.empty()) {
+            continue;
+        }
+        Local<Array> hits_arr = NanNew<Array>(point_hits.size());
+        for (std::size_t i = 0; i < point_hits.size(); ++i) {
             Local<Object> hit_obj = NanNew<Object>();
-            hit_obj->Set(NanNew("distance"), NanNew<Number>(it->second[i].distance));
-            hit_obj->Set(NanNew("feature_id"), NanNew<Number>(it->second[i].feature_id));
-            point_hits->Set(i, hit_obj);
+            hit_obj->Set(NanNew("distance"), NanNew<Number>(point_hits[i].distance));
+            hit_obj->Set(NanNew("feature_id"), NanNew<Number>(point_hits[i].feature_id));
+            hits_arr->Set(i, hit_obj);
         }
-        hits->Set(it->first, point_hits);
+        hits->Set(p, hits_arr);
     }
 
     return results;
@@ -1304,7 +1749,7 @@ void VectorTile::EIO_QueryMany(uv_work_t* req)
     vector_tile_queryMany_baton_t *closure = static_cast<vector_tile_queryMany_baton_t *>(req->data);
     try
     {
-        closure->result = _queryMany(closure->d, closure->query, closure->tolerance, closure->layer_name, closure->fields);
+        closure->result = _queryMany(closure->d, closure->query, closure->tolerance, closure->layer_name, closure->fields, closure->all_points);
     }
     catch (std::exception const& ex)
     {
@@ -1317,13 +1762,14 @@ void VectorTile::EIO_AfterQueryMany(uv_work_t* req)
 {
     NanScope();
     vector_tile_queryMany_baton_t *closure = static_cast<vector_tile_queryMany_baton_t *>(req->data);
+    closure->d->release();
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
     }
     else
     {
-        queryMany_result result = closure->result;
+        queryMany_result const& result = closure->result;
         Local<Object> obj = _queryManyResultToV8(result);
         Local<Value> argv[2] = { NanNull(), obj };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
@@ -1423,22 +1869,11 @@ NAN_METHOD(VectorTile::toJSON)
     NanReturnValue(arr);
 }
 
-static bool layer_to_geojson(vector_tile::Tile_Layer const& layer,
-                             std::string & result,
-                             unsigned x,
-                             unsigned y,
-                             unsigned z,
-                             unsigned width)
+static bool datasource_to_geojson(mapnik::datasource const& ds,
+                                  std::string & result)
 {
-    mapnik::vector_tile_impl::tile_datasource ds(layer,
-                                                 x,
-                                                 y,
-                                                 z,
-                                                 width,
-                                                 true);
-    mapnik::projection wgs84("+init=epsg:4326",true);
-    mapnik::projection merc("+init=epsg:3857",true);
-    mapnik::proj_transform prj_trans(merc,wgs84);
+    std::shared_ptr<node_mapnik::cached_transform const> tr = node_mapnik::cached_proj_transform("+init=epsg:3857","+init=epsg:4326");
+    mapnik::proj_transform const& prj_trans = tr->trans;
     mapnik::query q(ds.envelope());
     mapnik::layer_descriptor ld = ds.get_descriptor();
     for (auto const& item : ld.get_descriptors())
@@ -1507,6 +1942,36 @@ static bool layer_to_geojson(vector_tile::Tile_Layer const& layer,
     }
 }
 
+// Raw layers are read in place; see layer_datasource().
+static bool layer_to_geojson(VectorTile* v,
+                             std::size_t idx,
+                             std::string & result)
+{
+    const char * bytes = NULL;
+    std::size_t length = 0;
+    if (v->raw_layer(idx, bytes, length))
+    {
+        node_mapnik::tile_datasource_pbf ds(bytes,
+                                            length,
+                                            v->x_,
+                                            v->y_,
+                                            v->z_,
+                                            v->width());
+        if (!ds.has_raster())
+        {
+            return datasource_to_geojson(ds, result);
+        }
+    }
+    std::shared_ptr<vector_tile::Tile_Layer const> layer = v->layer(idx);
+    mapnik::vector_tile_impl::tile_datasource ds(*layer,
+                                                 v->x_,
+                                                 v->y_,
+                                                 v->z_,
+                                                 v->width(),
+                                                 true);
+    return datasource_to_geojson(ds, result);
+}
+
 NAN_METHOD(VectorTile::toGeoJSONSync)
 {
     NanScope();
@@ -1514,13 +1979,13 @@ NAN_METHOD(VectorTile::toGeoJSONSync)
 }
 
 void handle_to_geojson_args(Local<Value> const& layer_id,
-                            vector_tile::Tile const& tiledata,
+                            std::vector<std::string> const& layer_names,
                             bool & all_array,
                             bool & all_flattened,
                             std::string & error_msg,
                             int & layer_idx)
 {
-    unsigned layer_num = tiledata.layers_size();
+    unsigned layer_num = layer_names.size();
     if (layer_id->IsString())
     {
         std::string layer_name = TOSTR(layer_id);
@@ -1538,8 +2003,7 @@ void handle_to_geojson_args(Local<Value> const& layer_id,
             unsigned int idx(0);
             for (unsigned i=0; i < layer_num; ++i)
             {
-                vector_tile::Tile_Layer const& layer = tiledata.layers(i);
-                if (layer.name() == layer_name)
+                if (layer_names[i] == layer_name)
                 {
                     found = true;
                     layer_idx = idx;
@@ -1595,21 +2059,20 @@ void write_geojson_to_string(std::string & result,
                              int layer_idx,
                              VectorTile * v)
 {
-    vector_tile::Tile const& tiledata = v->get_tile();
+    std::vector<std::string> names = v->layer_names();
     if (array)
     {
-        unsigned layer_num = tiledata.layers_size();
+        unsigned layer_num = names.size();
         result += "[";
         bool first = true;
         for (unsigned i=0;i<layer_num;++i)
         {
-            vector_tile::Tile_Layer const& layer = tiledata.layers(i);
             if (first) first = false;
             else result += ",";
             result += "{\"type\":\"FeatureCollection\",";
-            result += "\"name\":\"" + layer.name() + "\",\"features\":[";
+            result += "\"name\":\"" + names[i] + "\",\"features\":[";
             std::string features;
-            bool hit = layer_to_geojson(layer,features,v->x_,v->y_,v->z_,v->width());
+            bool hit = layer_to_geojson(v,i,features);
             if (hit)
             {
                 result += features;
@@ -1624,12 +2087,11 @@ void write_geojson_to_string(std::string & result,
         {
             result += "{\"type\":\"FeatureCollection\",\"features\":[";
             bool first = true;
-            unsigned layer_num = tiledata.layers_size();
+            unsigned layer_num = names.size();
             for (unsigned i=0;i<layer_num;++i)
             {
-                vector_tile::Tile_Layer const& layer = tiledata.layers(i);
                 std::string features;
-                bool hit = layer_to_geojson(layer,features,v->x_,v->y_,v->z_,v->width());
+                bool hit = layer_to_geojson(v,i,features);
                 if (hit)
                 {
                     if (first) first = false;
@@ -1641,10 +2103,13 @@ void write_geojson_to_string(std::string & result,
         }
         else
         {
-            vector_tile::Tile_Layer const& layer = tiledata.layers(layer_idx);
+            if (layer_idx < 0 || layer_idx >= static_cast<int>(names.size()))
+            {
+                throw std::runtime_error("layer index out of range");
+            }
             result += "{\"type\":\"FeatureCollection\",";
-            result += "\"name\":\"" + layer.name() + "\",\"features\":[";
-            layer_to_geojson(layer,result,v->x_,v->y_,v->z_,v->width());
+            result += "\"name\":\"" + names[layer_idx] + "\",\"features\":[";
+            layer_to_geojson(v,layer_idx,result);
             result += "]}";
         }
     }
@@ -1663,7 +2128,6 @@ Local<Value> VectorTile::_toGeoJSONSync(_NAN_METHOD_ARGS) {
     }
 
     VectorTile* v = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
-    vector_tile::Tile const& tiledata = v->get_tile();
     int layer_idx = -1;
     bool all_array = false;
     bool all_flattened = false;
@@ -1672,7 +2136,7 @@ Local<Value> VectorTile::_toGeoJSONSync(_NAN_METHOD_ARGS) {
     try
     {
         handle_to_geojson_args(layer_id,
-                               tiledata,
+                               v->layer_names(),
                                all_array,
                                all_flattened,
                                error_msg,
@@ -1718,7 +2182,17 @@ NAN_METHOD(VectorTile::toGeoJSON)
     closure->all_flattened = false;
 
     std::string error_msg;
-    vector_tile::Tile const& tiledata = closure->v->get_tile();
+    std::vector<std::string> layer_names;
+    try
+    {
+        layer_names = closure->v->layer_names();
+    }
+    catch (std::exception const& ex)
+    {
+        delete closure;
+        NanThrowError(ex.what());
+        NanReturnUndefined();
+    }
 
     Local<Value> layer_id = args[0];
     if (! (layer_id->IsString() || layer_id->IsNumber()) ) {
@@ -1728,7 +2202,7 @@ NAN_METHOD(VectorTile::toGeoJSON)
     }
 
     handle_to_geojson_args(layer_id,
-                           tiledata,
+                           layer_names,
                            closure->all_array,
                            closure->all_flattened,
                            error_msg,
@@ -1741,7 +2215,8 @@ NAN_METHOD(VectorTile::toGeoJSON)
     }
     Local<Value> callback = args[args.Length()-1];
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, to_geojson, (uv_after_work_cb)after_to_geojson);
+    node_mapnik::queue_work(&closure->request, to_geojson, after_to_geojson);
+    closure->v->acquire();
     closure->v->Ref();
     NanReturnUndefined();
 }
@@ -1764,6 +2239,7 @@ void VectorTile::after_to_geojson(uv_work_t* req)
 {
     NanScope();
     to_geojson_baton *closure = static_cast<to_geojson_baton *>(req->data);
+    closure->v->release();
     if (closure->error)
     {
         Local<Value> argv[1] = { NanError(closure->result.c_str()) };
@@ -1790,6 +2266,12 @@ Local<Value> VectorTile::_parseSync(_NAN_METHOD_ARGS)
 {
     NanEscapableScope();
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
+    std::string in_use = check_not_in_use(d, "parse");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        return NanEscapeScope(NanUndefined());
+    }
     try
     {
         d->parse_proto();
@@ -1825,12 +2307,19 @@ NAN_METHOD(VectorTile::parse)
     }
 
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
+    std::string in_use = check_not_in_use(d, "parse");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        NanReturnUndefined();
+    }
     vector_tile_parse_baton_t *closure = new vector_tile_parse_baton_t();
     closure->request.data = closure;
     closure->d = d;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_Parse, (uv_after_work_cb)EIO_AfterParse);
+    node_mapnik::queue_work(&closure->request, EIO_Parse, EIO_AfterParse);
+    d->acquire();
     d->Ref();
     NanReturnUndefined();
 }
@@ -1853,6 +2342,7 @@ void VectorTile::EIO_AfterParse(uv_work_t* req)
 {
     NanScope();
     vector_tile_parse_baton_t *closure = static_cast<vector_tile_parse_baton_t *>(req->data);
+    closure->d->release();
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
         NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
@@ -1868,6 +2358,62 @@ void VectorTile::EIO_AfterParse(uv_work_t* req)
     delete closure;
 }
 
+// Encodes GeoJSON features (in WGS84) into a new layer of the tile. The
+// GeoJSON is parsed natively into an in-memory datasource rather than
+// through the OGR plugin, so this is safe to call from the threadpool.
+static void add_geojson_layer(VectorTile* d,
+                              std::string const& geojson_string,
+                              std::string const& geojson_name,
+                              unsigned tolerance,
+                              unsigned path_multiplier)
+{
+    typedef mapnik::vector_tile_impl::backend_pbf backend_type;
+    typedef mapnik::vector_tile_impl::processor<backend_type> renderer_type;
+    mapnik::parameters p;
+    p["type"]="memory";
+    MAPNIK_SHARED_PTR<node_mapnik::memory_index_datasource> ds = MAPNIK_MAKE_SHARED<node_mapnik::memory_index_datasource>(p);
+    std::vector<mapnik::feature_ptr> features;
+    unsigned id = 1;
+    node_mapnik::parse_geojson_features(geojson_string.data(), geojson_string.size(), ds->context(), id, features);
+    for (mapnik::feature_ptr const& feature : features)
+    {
+        ds->push(feature);
+    }
+    backend_type backend(d->get_tile_nonconst(),path_multiplier);
+    mapnik::Map map(d->width(),d->height(),"+init=epsg:3857");
+    mapnik::vector_tile_impl::spherical_mercator merc(d->width());
+    double minx,miny,maxx,maxy;
+    merc.xyz(d->x_,d->y_,d->z_,minx,miny,maxx,maxy);
+    map.zoom_to_box(mapnik::box2d<double>(minx,miny,maxx,maxy));
+    mapnik::request m_req(map.width(),map.height(),map.get_current_extent());
+    m_req.set_buffer_size(8);
+    mapnik::layer lyr(geojson_name,"+init=epsg:4326");
+    lyr.set_datasource(ds);
+    map.MAPNIK_ADD_LAYER(lyr);
+    renderer_type ren(backend,
+                      map,
+                      m_req,
+                      1,
+                      0,
+                      0,
+                      tolerance);
+    ren.apply();
+    d->painted(ren.painted());
+    d->cache_bytesize();
+}
+
+typedef struct {
+    uv_work_t request;
+    VectorTile* d;
+    std::string geojson;
+    std::string name;
+    unsigned tolerance;
+    unsigned path_multiplier;
+    bool error;
+    std::string error_name;
+    Persistent<Function> cb;
+} vector_tile_add_geojson_baton_t;
+
 NAN_METHOD(VectorTile::addGeoJSON)
 {
     NanScope();
@@ -1883,11 +2429,16 @@ NAN_METHOD(VectorTile::addGeoJSON)
     std::string geojson_string = TOSTR(args[0]);
     std::string geojson_name = TOSTR(args[1]);
 
+    // an optional trailing callback runs the parse and encode on the threadpool
+    Local<Value> callback = args[args.Length() - 1];
+    bool async = args.Length() > 2 && callback->IsFunction();
+    int num_args = async ? args.Length() - 1 : args.Length();
+
     Local<Object> options = NanNew<Object>();
     unsigned tolerance = 1;
     unsigned path_multiplier = 16;
 
-    if (args.Length() > 2) {
+    if (num_args > 2) {
         // options object
         if (!args[2]->IsObject()) {
             NanThrowError("optional third argument must be an options object");
@@ -1915,36 +2466,35 @@ NAN_METHOD(VectorTile::addGeoJSON)
         }
     }
 
+    // the new layer is written into the tile, so async jobs reading it must
+    // be done first
+    std::string in_use = check_not_in_use(d, "addGeoJSON");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        NanReturnUndefined();
+    }
+
+    if (async)
+    {
+        vector_tile_add_geojson_baton_t *closure = new vector_tile_add_geojson_baton_t();
+        closure->request.data = closure;
+        closure->d = d;
+        closure->geojson.swap(geojson_string);
+        closure->name = geojson_name;
+        closure->tolerance = tolerance;
+        closure->path_multiplier = path_multiplier;
+        closure->error = false;
+        NanAssignPersistent(closure->cb, callback.As<Function>());
+        node_mapnik::queue_work(&closure->request, EIO_AddGeoJSON, EIO_AfterAddGeoJSON);
+        d->acquire();
+        d->Ref();
+        NanReturnUndefined();
+    }
+
     try
     {
-        typedef mapnik::vector_tile_impl::backend_pbf backend_type;
-        typedef mapnik::vector_tile_impl::processor<backend_type> renderer_type;
-        backend_type backend(d->get_tile_nonconst(),path_multiplier);
-        mapnik::Map map(d->width_,d->height_,"+init=epsg:3857");
-        mapnik::vector_tile_impl::spherical_mercator merc(d->width_);
-        double minx,miny,maxx,maxy;
-        merc.xyz(d->x_,d->y_,d->z_,minx,miny,maxx,maxy);
-        map.zoom_to_box(mapnik::box2d<double>(minx,miny,maxx,maxy));
-        mapnik::request m_req(map.width(),map.height(),map.get_current_extent());
-        m_req.set_buffer_size(8);
-        mapnik::parameters p;
-        // TODO - use mapnik core GeoJSON parser
-        p["type"]="ogr";
-        p["file"]=geojson_string;
-        p["layer_by_index"]="0";
-        mapnik::layer lyr(geojson_name,"+init=epsg:4326");
-        lyr.set_datasource(mapnik::datasource_cache::instance().create(p));
-        map.MAPNIK_ADD_LAYER(lyr);
-        renderer_type ren(backend,
-                          map,
-                          m_req,
-                          1,
-                          0,
-                          0,
-                          tolerance);
-        ren.apply();
-        d->painted(ren.painted());
-        d->cache_bytesize();
+        add_geojson_layer(d, geojson_string, geojson_name, tolerance, path_multiplier);
         NanReturnValue(NanTrue());
     }
     catch (std::exception const& ex)
@@ -1954,6 +2504,40 @@ NAN_METHOD(VectorTile::addGeoJSON)
     }
 }
 
+void VectorTile::EIO_AddGeoJSON(uv_work_t* req)
+{
+    vector_tile_add_geojson_baton_t *closure = static_cast<vector_tile_add_geojson_baton_t *>(req->data);
+    try
+    {
+        add_geojson_layer(closure->d, closure->geojson, closure->name, closure->tolerance, closure->path_multiplier);
+    }
+    catch (std::exception const& ex)
+    {
+        closure->error = true;
+        closure->error_name = ex.what();
+    }
+}
+
+void VectorTile::EIO_AfterAddGeoJSON(uv_work_t* req)
+{
+    NanScope();
+    vector_tile_add_geojson_baton_t *closure = static_cast<vector_tile_add_geojson_baton_t *>(req->data);
+    closure->d->release();
+    if (closure->error)
+    {
+        Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    }
+    else
+    {
+        Local<Value> argv[1] = { NanNull() };
+        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+    }
+    closure->d->Unref();
+    NanDisposePersistent(closure->cb);
+    delete closure;
+}
+
 NAN_METHOD(VectorTile::addImage)
 {
     NanScope();
@@ -2016,7 +2600,13 @@ NAN_METHOD(VectorTile::addData)
         NanThrowError("cannot accept empty buffer as protobuf");
         NanReturnUndefined();
     }
-    d->buffer_.append(node::Buffer::Data(obj),buffer_size);
+    std::string in_use = check_not_in_use(d, "addData");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        NanReturnUndefined();
+    }
+    d->append_data(node::Buffer::Data(obj),buffer_size);
     d->status_ = VectorTile::LAZY_MERGE;
     NanReturnUndefined();
 }
@@ -2046,21 +2636,65 @@ Local<Value> VectorTile::_setDataSync(_NAN_METHOD_ARGS)
         NanThrowError("cannot accept empty buffer as protobuf");
         return NanEscapeScope(NanUndefined());
     }
-    d->buffer_ = std::string(node::Buffer::Data(obj),buffer_size);
+    std::string in_use = check_not_in_use(d, "setData");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        return NanEscapeScope(NanUndefined());
+    }
+    d->borrow_data(obj);
     d->status_ = VectorTile::LAZY_SET;
     return NanEscapeScope(NanUndefined());
 }
 
-typedef struct {
-    uv_work_t request;
+// An async setData call. The Buffer is borrowed on the main thread, so
+// there is no work to queue; the callback runs from a check handle, like
+// setImmediate, and the idle handle keeps the loop from blocking in poll
+// before the check phase.
+struct vector_tile_setdata_baton_t {
+    uv_check_t check;
+    uv_idle_t idle;
+    int open_handles;
     VectorTile* d;
-    const char *data;
-    size_t dataLength;
     bool error;
     std::string error_name;
     Persistent<Function> cb;
-    Persistent<Object> buffer;
-} vector_tile_setdata_baton_t;
+};
+
+static void on_setdata_closed(uv_handle_t* handle)
+{
+    vector_tile_setdata_baton_t *closure = static_cast<vector_tile_setdata_baton_t *>(handle->data);
+    if (--closure->open_handles == 0)
+    {
+        delete closure;
+    }
+}
+
+#if NODE_MODULE_VERSION > 0x000B
+static void on_setdata_idle(uv_idle_t*) {}
+static void on_setdata_check(uv_check_t* handle)
+#else
+static void on_setdata_idle(uv_idle_t*, int) {}
+static void on_setdata_check(uv_check_t* handle, int)
+#endif
+{
+    NanScope();
+    vector_tile_setdata_baton_t *closure = static_cast<vector_tile_setdata_baton_t *>(handle->data);
+    uv_check_stop(&closure->check);
+    uv_idle_stop(&closure->idle);
+    uv_close(reinterpret_cast<uv_handle_t*>(&closure->check), on_setdata_closed);
+    uv_close(reinterpret_cast<uv_handle_t*>(&closure->idle), on_setdata_closed);
+    Local<Function> cb = NanNew(closure->cb);
+    NanDisposePersistent(closure->cb);
+    closure->d->_unref();
+    if (closure->error) {
+        Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
+        NanMakeCallback(NanGetCurrentContext()->Global(), cb, 1, argv);
+    } else {
+        Local<Value> argv[1] = { NanNull() };
+        NanMakeCallback(NanGetCurrentContext()->Global(), cb, 1, argv);
+    }
+}
 
 NAN_METHOD(VectorTile::setData)
 {
@@ -2090,66 +2724,87 @@ NAN_METHOD(VectorTile::setData)
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
 
     vector_tile_setdata_baton_t *closure = new vector_tile_setdata_baton_t();
-    closure->request.data = closure;
     closure->d = d;
     closure->error = false;
-    NanAssignPersistent(closure->cb, callback.As<Function>());
-    NanAssignPersistent(closure->buffer, obj.As<Object>());
-    closure->data = node::Buffer::Data(obj);
-    closure->dataLength = node::Buffer::Length(obj);
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_SetData, (uv_after_work_cb)EIO_AfterSetData);
-    d->Ref();
-    NanReturnUndefined();
-}
-
-void VectorTile::EIO_SetData(uv_work_t* req)
-{
-    vector_tile_setdata_baton_t *closure = static_cast<vector_tile_setdata_baton_t *>(req->data);
-
-    try
+    closure->open_handles = 2;
+    std::string in_use = check_not_in_use(d, "setData");
+    if (node::Buffer::Length(obj) <= 0)
     {
-        closure->d->buffer_ = std::string(closure->data,closure->dataLength);
-        closure->d->status_ = VectorTile::LAZY_SET;
+        closure->error = true;
+        closure->error_name = "cannot accept empty buffer as protobuf";
     }
-    catch (std::exception const& ex)
+    else if (!in_use.empty())
     {
         closure->error = true;
-        closure->error_name = ex.what();
-    }
-}
-
-void VectorTile::EIO_AfterSetData(uv_work_t* req)
-{
-    NanScope();
-
-    vector_tile_setdata_baton_t *closure = static_cast<vector_tile_setdata_baton_t *>(req->data);
-
-    if (closure->error) {
-        Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
-        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+        closure->error_name = in_use;
     }
     else
     {
-        Local<Value> argv[1] = { NanNull() };
-        NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 1, argv);
+        d->borrow_data(obj);
+        d->status_ = VectorTile::LAZY_SET;
     }
-
-    closure->d->Unref();
-    NanDisposePersistent(closure->cb);
-    NanDisposePersistent(closure->buffer);
-    delete closure;
+    NanAssignPersistent(closure->cb, callback.As<Function>());
+    uv_check_init(uv_default_loop(), &closure->check);
+    uv_idle_init(uv_default_loop(), &closure->idle);
+    closure->check.data = closure;
+    closure->idle.data = closure;
+    uv_check_start(&closure->check, on_setdata_check);
+    uv_idle_start(&closure->idle, on_setdata_idle);
+    d->Ref();
+    NanReturnUndefined();
 }
 
 NAN_METHOD(VectorTile::getData)
 {
     NanScope();
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
+    bool release = false;
+    if (args.Length() > 0)
+    {
+        if (!args[0]->IsObject())
+        {
+            NanThrowTypeError("first argument must be an options object");
+            NanReturnUndefined();
+        }
+        Local<Object> options = args[0]->ToObject();
+        if (options->Has(NanNew("release")))
+        {
+            Local<Value> param_val = options->Get(NanNew("release"));
+            if (!param_val->IsBoolean())
+            {
+                NanThrowTypeError("option 'release' must be a boolean");
+                NanReturnUndefined();
+            }
+            release = param_val->BooleanValue();
+        }
+    }
+    if (release)
+    {
+        std::string in_use = check_not_in_use(d, "getData");
+        if (!in_use.empty())
+        {
+            NanThrowError(in_use.c_str());
+            NanReturnUndefined();
+        }
+    }
     try {
-        // shortcut: return raw data and avoid trip through proto object
-        // TODO  - safe for null string?
-        int raw_size = static_cast<int>(d->buffer_.size());
+        // shortcut: return raw data and avoid trip through proto object.
+        // The bytes are copied so that writes to the Buffer can't change
+        // the tile, unless the tile gives them up.
+        int raw_size = static_cast<int>(d->size());
         if (raw_size > 0 && d->byte_size_ <= raw_size) {
-            NanReturnValue(NanNewBufferHandle((char*)d->buffer_.data(),raw_size));
+            if (!release) {
+                NanReturnValue(NanNewBufferHandle(d->data(), d->size()));
+            }
+            Local<Object> retbuf;
+            if (d->borrowed_data_) {
+                retbuf = NanNew(d->borrowed_buffer_);
+                NanDisposePersistent(d->borrowed_buffer_);
+            } else {
+                retbuf = node_mapnik::string_to_buffer(d->buffer_);
+            }
+            d->clear();
+            NanReturnValue(retbuf);
         } else {
             if (d->byte_size_ <= 0) {
                 NanReturnValue(NanNewBufferHandle(0));
@@ -2168,6 +2823,9 @@ NAN_METHOD(VectorTile::getData)
                     NanThrowError("serialization failed, possible race condition");
                     NanReturnUndefined();
                 }
+                if (release) {
+                    d->clear();
+                }
                 NanReturnValue(retbuf);
             }
         }
@@ -2201,6 +2859,10 @@ struct vector_tile_render_baton_t {
     Persistent<Function> cb;
     std::string result;
     bool use_cairo;
+    node_mapnik::render_cancel cancel;
+    bool collect_stats;
+    node_mapnik::render_stats stats;
+    node_mapnik::layer_mask layers;
     vector_tile_render_baton_t() :
         request(),
         m(NULL),
@@ -2220,7 +2882,11 @@ struct vector_tile_render_baton_t {
         scale_factor(1.0),
         scale_denominator(0.0),
         variables(),
-        use_cairo(true) {}
+        use_cairo(true),
+        cancel(),
+        collect_stats(false),
+        stats(),
+        layers() {}
 };
 
 NAN_METHOD(VectorTile::render)
@@ -2325,6 +2991,30 @@ NAN_METHOD(VectorTile::render)
             }
             object_to_container(closure->variables,bind_opt->ToObject());
         }
+        if (!node_mapnik::parse_cancel_options(options, closure->cancel))
+        {
+            delete closure;
+            NanReturnUndefined();
+        }
+        if (options->Has(NanNew("stats")))
+        {
+            Local<Value> bind_opt = options->Get(NanNew("stats"));
+            if (!bind_opt->IsBoolean())
+            {
+                delete closure;
+                NanThrowTypeError("optional arg 'stats' must be a boolean");
+                NanReturnUndefined();
+            }
+            closure->collect_stats = bind_opt->BooleanValue();
+        }
+        if (options->Has(NanNew("layers")))
+        {
+            if (!node_mapnik::parse_layers_option(options->Get(NanNew("layers")), *m->get(), closure->layers))
+            {
+                delete closure;
+                NanReturnUndefined();
+            }
+        }
     }
 
     closure->layer_idx = 0;
@@ -2476,8 +3166,9 @@ NAN_METHOD(VectorTile::render)
     closure->m = m;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
-    uv_queue_work(uv_default_loop(), &closure->request, EIO_RenderTile, (uv_after_work_cb)EIO_AfterRenderTile);
+    node_mapnik::queue_work(&closure->request, EIO_RenderTile, EIO_AfterRenderTile);
     m->_ref();
+    d->acquire();
     d->Ref();
     NanReturnUndefined();
 }
@@ -2487,33 +3178,43 @@ template <typename Renderer> void process_layers(Renderer & ren,
                                             mapnik::projection const& map_proj,
                                             std::vector<mapnik::layer> const& layers,
                                             double scale_denom,
-                                            vector_tile::Tile const& tiledata,
                                             vector_tile_render_baton_t *closure)
 {
     // loop over layers in map and match by name
-    // with layers in the vector tile
+    // with layers in the vector tile, decoding only the matches
     unsigned layers_size = layers.size();
+    std::vector<std::string> tile_layer_names = closure->d->layer_names();
+    bool collect_stats = closure->collect_stats;
+    // layer_stats are referenced by the wrapped datasources, so never reallocate
+    if (collect_stats) closure->stats.layers.reserve(layers_size);
     for (unsigned i=0; i < layers_size; ++i)
     {
+        closure->cancel.check();
         mapnik::layer const& lyr = layers[i];
-        if (lyr.visible(scale_denom))
+        if (node_mapnik::layer_selected(closure->layers, i) && lyr.visible(scale_denom))
         {
-            for (int j=0; j < tiledata.layers_size(); ++j)
+            node_mapnik::layer_stats * ls = NULL;
+            if (collect_stats)
+            {
+                closure->stats.layers.push_back(node_mapnik::layer_stats(lyr.name()));
+                ls = &closure->stats.layers.back();
+            }
+            node_mapnik::stats_clock::time_point layer_start = node_mapnik::stats_clock::now();
+            for (std::size_t j=0; j < tile_layer_names.size(); ++j)
             {
-                vector_tile::Tile_Layer const& layer = tiledata.layers(j);
-                if (lyr.name() == layer.name())
+                if (lyr.name() == tile_layer_names[j])
                 {
                     mapnik::layer lyr_copy(lyr);
-                    MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                                    mapnik::vector_tile_impl::tile_datasource>(
-                                                        layer,
-                                                        closure->d->x_,
-                                                        closure->d->y_,
-                                                        closure->d->z_,
-                                                        closure->d->width()
-                                                        );
-                    ds->set_envelope(m_req.get_buffered_extent());
-                    lyr_copy.set_datasource(ds);
+                    lyr_copy.set_datasource(layer_datasource(closure->d, j, m_req.get_buffered_extent()));
+                    if (closure->cancel.enabled() || ls)
+                    {
+                        lyr_copy = node_mapnik::wrap_layer(lyr_copy,
+                                                           closure->cancel,
+                                                           ls,
+                                                           *closure->m->get(),
+                                                           scale_denom,
+                                                           closure->variables);
+                    }
                     std::set<std::string> names;
                     ren.apply_to_layer(lyr_copy,
                                        ren,
@@ -2527,6 +3228,7 @@ template <typename Renderer> void process_layers(Renderer & ren,
                                        names);
                 }
             }
+            if (ls) ls->time = node_mapnik::elapsed_ms(layer_start);
         }
     }
 }
@@ -2535,6 +3237,8 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
     vector_tile_render_baton_t *closure = static_cast<vector_tile_render_baton_t *>(req->data);
 
     try {
+        // drop renders that were cancelled or timed out while queued
+        closure->cancel.check();
         mapnik::Map const& map_in = *closure->m->get();
         mapnik::vector_tile_impl::spherical_mercator merc(closure->d->width_);
         double minx,miny,maxx,maxy;
@@ -2546,7 +3250,8 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
         mapnik::box2d<double> map_extent(minx,miny,maxx,maxy);
         mapnik::request m_req(closure->width,closure->height,map_extent);
         m_req.set_buffer_size(closure->buffer_size);
-        mapnik::projection map_proj(map_in.srs(),true);
+        std::shared_ptr<mapnik::projection const> cached_map_proj = node_mapnik::cached_projection(map_in.srs());
+        mapnik::projection const& map_proj = *cached_map_proj;
         double scale_denom = closure->scale_denominator;
         if (scale_denom <= 0.0)
         {
@@ -2554,7 +3259,7 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
         }
         scale_denom *= closure->scale_factor;
         std::vector<mapnik::layer> const& layers = map_in.layers();
-        vector_tile::Tile const& tiledata = closure->d->get_tile();
+        node_mapnik::stats_clock::time_point render_start = node_mapnik::stats_clock::now();
         // render grid for layer
         if (closure->g)
         {
@@ -2568,20 +3273,10 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
             mapnik::layer const& lyr = layers[closure->layer_idx];
             if (lyr.visible(scale_denom))
             {
-                int layer_idx = -1;
-                for (int j=0; j < tiledata.layers_size(); ++j)
-                {
-                    vector_tile::Tile_Layer const& layer = tiledata.layers(j);
-                    if (lyr.name() == layer.name())
-                    {
-                        layer_idx = j;
-                        break;
-                    }
-                }
+                int layer_idx = closure->d->find_layer(lyr.name());
                 if (layer_idx > -1)
                 {
-                    vector_tile::Tile_Layer const& layer = tiledata.layers(layer_idx);
-                    if (layer.features_size() <= 0)
+                    if (!layer_has_features(closure->d, layer_idx))
                     {
                         return;
                     }
@@ -2602,16 +3297,16 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                     }
 
                     mapnik::layer lyr_copy(lyr);
-                    MAPNIK_SHARED_PTR<mapnik::vector_tile_impl::tile_datasource> ds = MAPNIK_MAKE_SHARED<
-                                                    mapnik::vector_tile_impl::tile_datasource>(
-                                                        layer,
-                                                        closure->d->x_,
-                                                        closure->d->y_,
-                                                        closure->d->z_,
-                                                        closure->d->width_
-                                                        );
-                    ds->set_envelope(m_req.get_buffered_extent());
-                    lyr_copy.set_datasource(ds);
+                    lyr_copy.set_datasource(layer_datasource(closure->d, layer_idx, m_req.get_buffered_extent()));
+                    if (closure->cancel.enabled())
+                    {
+                        lyr_copy = node_mapnik::wrap_layer(lyr_copy,
+                                                           closure->cancel,
+                                                           NULL,
+                                                           map_in,
+                                                           scale_denom,
+                                                           closure->variables);
+                    }
                     ren.apply_to_layer(lyr_copy,
                                        ren,
                                        map_proj,
@@ -2644,7 +3339,7 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                                                                 closure->variables,
                                                                 c_context,closure->scale_factor);
                 ren.start_map_processing(map_in);
-                process_layers(ren,m_req,map_proj,layers,scale_denom,tiledata,closure);
+                process_layers(ren,m_req,map_proj,layers,scale_denom,closure);
                 ren.end_map_processing(map_in);
 #else
                 closure->error = true;
@@ -2660,7 +3355,7 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                             closure->variables,
                             output_stream_iterator, closure->scale_factor);
                 ren.start_map_processing(map_in);
-                process_layers(ren,m_req,map_proj,layers,scale_denom,tiledata,closure);
+                process_layers(ren,m_req,map_proj,layers,scale_denom,closure);
                 ren.end_map_processing(map_in);
 #else
                 closure->error = true;
@@ -2675,9 +3370,10 @@ void VectorTile::EIO_RenderTile(uv_work_t* req)
                                                     closure->variables,
                                                     *closure->im->get(),closure->scale_factor);
             ren.start_map_processing(map_in);
-            process_layers(ren,m_req,map_proj,layers,scale_denom,tiledata,closure);
+            process_layers(ren,m_req,map_proj,layers,scale_denom,closure);
             ren.end_map_processing(map_in);
         }
+        closure->stats.render_time = node_mapnik::elapsed_ms(render_start);
     }
     catch (std::exception const& ex)
     {
@@ -2691,6 +3387,7 @@ void VectorTile::EIO_AfterRenderTile(uv_work_t* req)
     NanScope();
 
     vector_tile_render_baton_t *closure = static_cast<vector_tile_render_baton_t *>(req->data);
+    closure->d->release();
 
     if (closure->error) {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
@@ -2698,19 +3395,27 @@ void VectorTile::EIO_AfterRenderTile(uv_work_t* req)
     }
     else
     {
+        Local<Value> result;
         if (closure->im)
         {
-            Local<Value> argv[2] = { NanNull(), NanObjectWrapHandle(closure->im) };
-            NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+            result = NanObjectWrapHandle(closure->im);
         }
         else if (closure->g)
         {
-            Local<Value> argv[2] = { NanNull(), NanObjectWrapHandle(closure->g) };
-            NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
+            result = NanObjectWrapHandle(closure->g);
         }
-        else if (closure->c)
+        else
+        {
+            result = NanObjectWrapHandle(closure->c);
+        }
+        if (closure->collect_stats)
+        {
+            Local<Value> argv[3] = { NanNull(), result, node_mapnik::stats_to_object(closure->stats) };
+            NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 3, argv);
+        }
+        else
         {
-            Local<Value> argv[2] = { NanNull(), NanObjectWrapHandle(closure->c) };
+            Local<Value> argv[2] = { NanNull(), result };
             NanMakeCallback(NanGetCurrentContext()->Global(), NanNew(closure->cb), 2, argv);
         }
     }
@@ -2732,6 +3437,12 @@ Local<Value> VectorTile::_clearSync(_NAN_METHOD_ARGS)
 {
     NanEscapableScope();
     VectorTile* d = node::ObjectWrap::Unwrap<VectorTile>(args.Holder());
+    std::string in_use = check_not_in_use(d, "clear");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        return NanEscapeScope(NanUndefined());
+    }
     d->clear();
     return NanEscapeScope(NanUndefined());
 }
@@ -2759,12 +3470,19 @@ NAN_METHOD(VectorTile::clear)
         NanThrowTypeError("last argument must be a callback function");
         NanReturnUndefined();
     }
+    std::string in_use = check_not_in_use(d, "clear");
+    if (!in_use.empty())
+    {
+        NanThrowError(in_use.c_str());
+        NanReturnUndefined();
+    }
     clear_vector_tile_baton_t *closure = new clear_vector_tile_baton_t();
     closure->request.data = closure;
     closure->d = d;
     closure->error = false;
     NanAssignPersistent(closure->cb, callback.As<Function>());
     uv_queue_work(uv_default_loop(), &closure->request, EIO_Clear, (uv_after_work_cb)EIO_AfterClear);
+    d->acquire();
     d->Ref();
     NanReturnUndefined();
 }
@@ -2787,6 +3505,7 @@ void VectorTile::EIO_AfterClear(uv_work_t* req)
 {
     NanScope();
     clear_vector_tile_baton_t *closure = static_cast<clear_vector_tile_baton_t *>(req->data);
+    closure->d->release();
     if (closure->error)
     {
         Local<Value> argv[1] = { NanError(closure->error_name.c_str()) };
@@ -7,12 +7,17 @@
 #include "vector_tile.pb.h"
 #pragma GCC diagnostic pop
 
+#include <map>
 #include <vector>
 #include <string>
+#include <memory>
+#include <mutex>
 #include <mapnik/feature.hpp>
 
 using namespace v8;
 
+namespace node_mapnik { class layer_query_index; }
+
 struct query_lonlat {
     double lon;
     double lat;
@@ -29,9 +34,10 @@ struct query_hit {
     unsigned feature_id;
 };
 
+// features are numbered by their position, hits are listed per query point
 struct queryMany_result {
-    std::map<unsigned,query_result> features;
-    std::map<unsigned,std::vector<query_hit> > hits;
+    std::vector<query_result> features;
+    std::vector<std::vector<query_hit> > hits;
 };
 
 class VectorTile: public node::ObjectWrap {
@@ -54,7 +60,7 @@ public:
     static bool _querySort(query_result const& a, query_result const& b);
     static Local<Array> _queryResultToV8(std::vector<query_result> const& result);
     static NAN_METHOD(queryMany);
-    static queryMany_result _queryMany(VectorTile* d, std::vector<query_lonlat> const& query, double tolerance, std::string const& layer_name, std::vector<std::string> const& fields);
+    static queryMany_result _queryMany(VectorTile* d, std::vector<query_lonlat> const& query, double tolerance, std::string const& layer_name, std::vector<std::string> const& fields, bool all_points);
     static bool _queryManySort(query_hit const& a, query_hit const& b);
     static Local<Object> _queryManyResultToV8(queryMany_result const& result);
     static void EIO_QueryMany(uv_work_t* req);
@@ -66,6 +72,8 @@ public:
     static void to_geojson(uv_work_t* req);
     static void after_to_geojson(uv_work_t* req);
     static NAN_METHOD(addGeoJSON);
+    static void EIO_AddGeoJSON(uv_work_t* req);
+    static void EIO_AfterAddGeoJSON(uv_work_t* req);
     static NAN_METHOD(addImage);
 #ifdef PROTOBUF_FULL
     static NAN_METHOD(toString);
@@ -73,8 +81,6 @@ public:
     static void EIO_RenderTile(uv_work_t* req);
     static void EIO_AfterRenderTile(uv_work_t* req);
     static NAN_METHOD(setData);
-    static void EIO_SetData(uv_work_t* req);
-    static void EIO_AfterSetData(uv_work_t* req);
     static Local<Value> _setDataSync(_NAN_METHOD_ARGS);
     static NAN_METHOD(setDataSync);
     static NAN_METHOD(parse);
@@ -84,6 +90,8 @@ public:
     static Local<Value> _parseSync(_NAN_METHOD_ARGS);
     static NAN_METHOD(addData);
     static NAN_METHOD(composite);
+    static void EIO_Composite(uv_work_t* req);
+    static void EIO_AfterComposite(uv_work_t* req);
     // methods common to mapnik.Image
     static NAN_METHOD(width);
     static NAN_METHOD(height);
@@ -102,11 +110,16 @@ public:
 
     VectorTile(int z, int x, int y, unsigned w, unsigned h);
 
+    // may run on a worker thread, so a borrowed Buffer is only dropped
+    // here and released on the main thread by the next borrow_data()
     void clear() {
         tiledata_.Clear();
         buffer_.clear();
+        borrowed_data_ = NULL;
+        borrowed_size_ = 0;
         painted(false);
         byte_size_ = 0;
+        reset_layer_index();
     }
     vector_tile::Tile & get_tile_nonconst() {
         return tiledata_;
@@ -117,6 +130,23 @@ public:
     vector_tile::Tile const& get_tile() {
         return tiledata_;
     }
+    // Layers by position, whether or not the tile has been parsed. Layers
+    // only held as raw bytes are decoded one at a time on first use, so a
+    // call that needs a few layers of a big tile does not decode the rest.
+    // Safe to call from worker threads: a decoded layer stays alive while
+    // the caller holds it, even if the tile is parsed or re-indexed. Layers
+    // of the parsed tile are not owned and live as long as its data.
+    std::vector<std::string> layer_names();
+    int find_layer(std::string const& name);
+    std::shared_ptr<vector_tile::Tile_Layer const> layer(std::size_t idx);
+    // the encoded bytes of a layer that has not been parsed, if any
+    bool raw_layer(std::size_t idx, const char *& bytes, std::size_t & length);
+    // spatial index over a layer's features for query and queryMany,
+    // built on first use and kept until the tile's data changes
+    std::shared_ptr<node_mapnik::layer_query_index> query_index(std::size_t idx);
+    int byte_size() const {
+        return byte_size_;
+    }
     void cache_bytesize() {
         byte_size_ = tiledata_.ByteSize();
     }
@@ -132,12 +162,27 @@ public:
     unsigned height() const {
         return height_;
     }
+    // raw protobuf bytes: either a Buffer passed to setData or owned bytes
+    const char * data() const {
+        return borrowed_data_ ? borrowed_data_ : buffer_.data();
+    }
+    std::size_t size() const {
+        return borrowed_data_ ? borrowed_size_ : buffer_.size();
+    }
+    // main thread only
+    void borrow_data(Local<Object> const& obj);
+    void append_data(const char * data, std::size_t size);
+    // Async jobs that read the raw bytes on a worker hold the tile, and
+    // calls that would replace or grow the bytes are refused meanwhile.
+    // Main thread only.
+    void acquire();
+    void release();
+    int active() const;
     void _ref() { Ref(); }
     void _unref() { Unref(); }
     int z_;
     int x_;
     int y_;
-    std::string buffer_;
     parsing_status status_;
 private:
     ~VectorTile();
@@ -146,6 +191,27 @@ private:
     unsigned height_;
     bool painted_;
     int byte_size_;
+    std::string buffer_;
+    const char * borrowed_data_;
+    std::size_t borrowed_size_;
+    Persistent<Object> borrowed_buffer_;
+    int in_use_;
+    // offsets of the layers in the raw bytes that are not in tiledata_
+    struct lazy_layer {
+        std::string name;
+        std::size_t offset;
+        std::size_t length;
+        std::shared_ptr<vector_tile::Tile_Layer const> decoded;
+    };
+    std::size_t parsed_layer_count() const;
+    void index_layers();
+    void reset_layer_index();
+    std::mutex layers_mutex_;
+    std::vector<lazy_layer> lazy_layers_;
+    std::map<std::size_t, std::shared_ptr<node_mapnik::layer_query_index> > query_indexes_;
+    const char * indexed_data_;
+    std::size_t indexed_size_;
+    std::size_t indexed_start_;
 };
 
 #endif // __NODE_MAPNIK_VECTOR_TILE_H__
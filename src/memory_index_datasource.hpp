@@ -0,0 +1,202 @@
+#ifndef __NODE_MAPNIK_MEMORY_INDEX_DATASOURCE_H__
+#define __NODE_MAPNIK_MEMORY_INDEX_DATASOURCE_H__
+
+#include "mapnik3x_compatibility.hpp"
+
+// mapnik
+#include <mapnik/box2d.hpp>             // for box2d
+#include <mapnik/datasource.hpp>        // for datasource, featureset_ptr
+#include <mapnik/feature.hpp>           // for feature_ptr, context_ptr
+#include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
+#include <mapnik/featureset.hpp>        // for Featureset
+#include <mapnik/params.hpp>            // for parameters
+#include <mapnik/query.hpp>             // for query
+
+// boost
+#include <boost/geometry.hpp>
+#include <boost/geometry/geometries/box.hpp>
+#include <boost/geometry/geometries/point.hpp>
+#include <boost/geometry/index/rtree.hpp>
+#include <boost/optional/optional.hpp>
+#include MAPNIK_MAKE_SHARED_INCLUDE
+
+// stl
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace node_mapnik {
+
+// Hands out a snapshot of the features matched by a query.
+class memory_index_featureset : public mapnik::Featureset
+{
+public:
+    memory_index_featureset(std::vector<mapnik::feature_ptr> && features)
+      : features_(std::move(features)),
+        pos_(0) {}
+
+    mapnik::feature_ptr next()
+    {
+        if (pos_ < features_.size())
+        {
+            return features_[pos_++];
+        }
+        return mapnik::feature_ptr();
+    }
+
+private:
+    std::vector<mapnik::feature_ptr> features_;
+    std::size_t pos_;
+};
+
+// Drop-in replacement for mapnik::memory_datasource that answers bbox and
+// point queries from an R-tree instead of scanning every feature. The tree
+// is bulk loaded on the first query, so loading many features and then
+// querying costs a single build; features pushed after that are inserted
+// into it one at a time. Features share one context so attribute names are
+// stored once.
+class memory_index_datasource : public mapnik::datasource
+{
+public:
+    typedef boost::geometry::model::point<double, 2, boost::geometry::cs::cartesian> point_type;
+    typedef boost::geometry::model::box<point_type> box_type;
+    // the index into features_ keeps results in insertion (drawing) order
+    typedef std::pair<box_type, std::size_t> value_type;
+    typedef boost::geometry::index::rtree<value_type, boost::geometry::index::rstar<16> > rtree_type;
+
+    memory_index_datasource(mapnik::parameters const& params)
+      : mapnik::datasource(params),
+        desc_(*params.get<std::string>("type"), *params.get<std::string>("encoding","utf-8")),
+        bbox_check_(*params.get<mapnik::boolean>("bbox_check", true)),
+        ctx_(MAPNIK_MAKE_SHARED<mapnik::context_type>()),
+        mutex_(),
+        features_(),
+        boxes_(),
+        extent_(),
+        index_() {}
+
+    // context to create features with before they are pushed
+    mapnik::context_ptr const& context() const
+    {
+        return ctx_;
+    }
+
+    void push(mapnik::feature_ptr const& feature)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        mapnik::box2d<double> box = feature->envelope();
+        if (features_.empty())
+        {
+            extent_ = box;
+        }
+        else
+        {
+            extent_.expand_to_include(box);
+        }
+        features_.push_back(feature);
+        boxes_.push_back(to_box(box));
+        if (index_)
+        {
+            index_->insert(value_type(boxes_.back(), features_.size() - 1));
+        }
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return features_.size();
+    }
+
+    datasource_t type() const
+    {
+        return mapnik::datasource::Vector;
+    }
+
+    mapnik::featureset_ptr features(mapnik::query const& q) const
+    {
+        return query_box(q.get_bbox());
+    }
+
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt, double tol = 0) const
+    {
+        return query_box(mapnik::box2d<double>(pt.x - tol, pt.y - tol, pt.x + tol, pt.y + tol));
+    }
+
+    mapnik::box2d<double> envelope() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return extent_;
+    }
+
+    boost::optional<mapnik::datasource::geometry_t> get_geometry_type() const
+    {
+        return boost::optional<mapnik::datasource::geometry_t>();
+    }
+
+    mapnik::layer_descriptor get_descriptor() const
+    {
+        return desc_;
+    }
+
+private:
+    static box_type to_box(mapnik::box2d<double> const& box)
+    {
+        return box_type(point_type(box.minx(), box.miny()), point_type(box.maxx(), box.maxy()));
+    }
+
+    // main thread pushes while workers query, so the index is built and
+    // updated under the same lock that guards features_
+    mapnik::featureset_ptr query_box(mapnik::box2d<double> const& box) const
+    {
+        std::vector<mapnik::feature_ptr> result;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!bbox_check_)
+        {
+            result = features_;
+            return MAPNIK_MAKE_SHARED<memory_index_featureset>(std::move(result));
+        }
+        if (!index_)
+        {
+            std::vector<value_type> values;
+            values.reserve(boxes_.size());
+            for (std::size_t i = 0; i < boxes_.size(); ++i)
+            {
+                values.push_back(value_type(boxes_[i], i));
+            }
+            // the range constructor packs the tree, which is much faster
+            // than inserting features one at a time
+            index_.reset(new rtree_type(values.begin(), values.end()));
+        }
+        std::vector<value_type> hits;
+        index_->query(boost::geometry::index::intersects(to_box(box)), std::back_inserter(hits));
+        std::vector<std::size_t> ids;
+        ids.reserve(hits.size());
+        for (value_type const& hit : hits)
+        {
+            ids.push_back(hit.second);
+        }
+        std::sort(ids.begin(), ids.end());
+        result.reserve(ids.size());
+        for (std::size_t id : ids)
+        {
+            result.push_back(features_[id]);
+        }
+        return MAPNIK_MAKE_SHARED<memory_index_featureset>(std::move(result));
+    }
+
+    mapnik::layer_descriptor desc_;
+    bool bbox_check_;
+    mapnik::context_ptr ctx_;
+    mutable std::mutex mutex_;
+    std::vector<mapnik::feature_ptr> features_;
+    std::vector<box_type> boxes_; // envelope of each feature, worked out in push
+    mapnik::box2d<double> extent_;
+    mutable std::unique_ptr<rtree_type> index_;
+};
+
+}
+
+#endif
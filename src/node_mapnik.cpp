@@ -3,6 +3,7 @@
 // node-mapnik
 #include "mapnik_vector_tile.hpp"
 #include "mapnik_map.hpp"
+#include "mapnik_map_pool.hpp"
 #include "mapnik_color.hpp"
 #include "mapnik_geometry.hpp"
 #include "mapnik_logger.hpp"
@@ -23,6 +24,10 @@
 #include "mapnik_expression.hpp"
 #include "utils.hpp"
 #include "blend.hpp"
+#include "mapnik_thread_pool.hpp"
+#include "mapnik_cancel_token.hpp"
+#include "mapnik_stylesheet_cache.hpp"
+#include "mapnik_projection_cache.hpp"
 
 // mapnik
 #include <mapnik/config.hpp> // for MAPNIK_DECL
@@ -72,12 +77,15 @@ static NAN_METHOD(clearCache)
     mapnik::marker_cache::instance().clear();
     mapnik::mapped_memory_cache::instance().clear();
 #endif
+    node_mapnik::clear_stylesheet_cache();
+    node_mapnik::clear_projection_cache();
     NanReturnUndefined();
 }
 
 static NAN_METHOD(shutdown)
 {
     NanScope();
+    node_mapnik::shutdown_thread_pool();
     google::protobuf::ShutdownProtobufLibrary();
     NanReturnUndefined();
 }
@@ -107,10 +115,13 @@ extern "C" {
         NODE_SET_METHOD(target, "clearCache", clearCache);
         NODE_SET_METHOD(target, "gc", gc);
         NODE_SET_METHOD(target, "shutdown",shutdown);
+        NODE_SET_METHOD(target, "setThreadPool", node_mapnik::set_thread_pool);
 
         // Classes
         VectorTile::Initialize(target);
         Map::Initialize(target);
+        MapPool::Initialize(target);
+        CancelToken::Initialize(target);
         Color::Initialize(target);
         Geometry::Initialize(target);
         Feature::Initialize(target);
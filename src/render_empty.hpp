@@ -0,0 +1,185 @@
+#ifndef __NODE_MAPNIK_RENDER_EMPTY_H__
+#define __NODE_MAPNIK_RENDER_EMPTY_H__
+
+#include "mapnik_projection_cache.hpp"
+#include "render_layers.hpp"
+
+// mapnik
+#include <mapnik/attribute_collector.hpp>  // for attribute_collector
+#include <mapnik/box2d.hpp>             // for box2d
+#include <mapnik/color.hpp>             // for color
+#include <mapnik/feature_type_style.hpp>  // for feature_type_style
+#include <mapnik/graphics.hpp>          // for image_32
+#include <mapnik/image_util.hpp>        // for save_to_string
+#include <mapnik/layer.hpp>             // for layer
+#include <mapnik/map.hpp>               // for Map
+#include <mapnik/proj_transform.hpp>    // for proj_transform
+#include <mapnik/projection.hpp>        // for projection
+#include <mapnik/query.hpp>             // for query
+#include <mapnik/request.hpp>           // for request
+#include <mapnik/rule.hpp>              // for rule
+
+// boost
+#include <boost/optional/optional.hpp>
+
+// stl
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace node_mapnik {
+
+// Adds the attributes that the active rules of `lyr` use in filters and
+// symbolizers to `names`, like feature_style_processor does before querying.
+inline void collect_rule_attributes(mapnik::Map const& map,
+                                    mapnik::layer const& lyr,
+                                    double scale_denom,
+                                    std::set<std::string> & names)
+{
+    mapnik::attribute_collector collector(names);
+    for (std::string const& style_name : lyr.styles())
+    {
+        boost::optional<mapnik::feature_type_style const&> style = map.find_style(style_name);
+        if (!style) continue;
+        for (mapnik::rule const& r : style->get_rules())
+        {
+            if (r.active(scale_denom))
+            {
+                collector(r);
+            }
+        }
+    }
+    std::string const& group_by = lyr.group_by();
+    if (!group_by.empty())
+    {
+        names.insert(group_by);
+    }
+}
+
+// True if any visible layer in `mask` has a feature in the buffered extent of `m_req`
+// that one of its active rules would draw. Layers whose extent cannot be
+// projected into the layer srs are assumed to have features.
+inline bool map_has_features(mapnik::Map const& map,
+                             mapnik::request const& m_req,
+                             double scale_denom,
+                             double scale_factor,
+                             mapnik::attributes const& variables,
+                             layer_mask const& mask = layer_mask())
+{
+    std::shared_ptr<mapnik::projection const> cached_proj0 = cached_projection(map.srs());
+    mapnik::projection const& proj0 = *cached_proj0;
+    scale_denom = effective_scale_denominator(m_req, proj0, scale_denom, scale_factor);
+    mapnik::box2d<double> const& extent = m_req.extent();
+    double qw = extent.width() > 0 ? extent.width() : 1;
+    double qh = extent.height() > 0 ? extent.height() : 1;
+    mapnik::query::resolution_type res(m_req.width() / qw, m_req.height() / qh);
+    std::vector<mapnik::layer> const& layers = map.layers();
+    for (std::size_t i = 0; i < layers.size(); ++i)
+    {
+        mapnik::layer const& lyr = layers[i];
+        mapnik::datasource_ptr ds = lyr.datasource();
+        if (!ds || !layer_selected(mask, i) || !lyr.visible(scale_denom))
+        {
+            continue;
+        }
+        rule_matcher matcher(map, lyr, scale_denom, variables);
+        if (matcher.empty())
+        {
+            continue;
+        }
+        mapnik::box2d<double> query_ext(extent);
+        boost::optional<int> const& layer_buffer_size = lyr.buffer_size();
+        // the renderer queries with the map's buffer size, not the request's
+        double buffer_padding = 2.0 * m_req.scale() * (layer_buffer_size ? *layer_buffer_size : map.buffer_size());
+        query_ext.width(extent.width() + buffer_padding);
+        query_ext.height(extent.height() + buffer_padding);
+        boost::optional<mapnik::box2d<double> > const& maximum_extent = map.maximum_extent();
+        if (maximum_extent)
+        {
+            query_ext.clip(*maximum_extent);
+        }
+        std::shared_ptr<cached_transform const> tr = cached_proj_transform(map.srs(), lyr.srs());
+        mapnik::proj_transform const& prj_trans = tr->trans;
+        if (!prj_trans.forward(query_ext, PROJ_ENVELOPE_POINTS))
+        {
+            return true;
+        }
+        mapnik::box2d<double> layer_ext = lyr.envelope();
+        if (!query_ext.intersects(layer_ext))
+        {
+            continue;
+        }
+        layer_ext.clip(query_ext);
+        mapnik::query q(layer_ext, res, scale_denom, extent);
+        // without them plugins such as shape and postgis return features
+        // without attributes, which no rule filter would match
+        std::set<std::string> names;
+        collect_rule_attributes(map, lyr, scale_denom, names);
+        for (std::string const& name : names)
+        {
+            q.add_property_name(name);
+        }
+        mapnik::featureset_ptr fs = ds->features(q);
+        if (!fs)
+        {
+            continue;
+        }
+        mapnik::feature_ptr feature;
+        while ((feature = fs->next()))
+        {
+            if (matcher(*feature))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Fills `im` the way the renderer's setup would for a map without features.
+inline void render_background(mapnik::Map const& map, mapnik::image_32 & im)
+{
+    boost::optional<mapnik::color> const& bg = map.background();
+    if (bg)
+    {
+        im.set_background(*bg);
+    }
+}
+
+// Encoded tiles of nothing but the map background are the same for every
+// empty render of a map, so they are kept per format, size and colour.
+inline std::string encoded_background(mapnik::Map const& map,
+                                      std::string const& format)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::string> tiles;
+    std::ostringstream key;
+    key << format << '|' << map.width() << 'x' << map.height() << '|';
+    boost::optional<mapnik::color> const& bg = map.background();
+    if (bg)
+    {
+        key << bg->rgba();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::string>::const_iterator itr = tiles.find(key.str());
+    if (itr != tiles.end())
+    {
+        return itr->second;
+    }
+    // a handful of formats and tile sizes is the norm, so a runaway mix of
+    // them just starts over rather than growing without bound
+    if (tiles.size() >= 64)
+    {
+        tiles.clear();
+    }
+    mapnik::image_32 im(map.width(), map.height());
+    render_background(map, im);
+    return tiles[key.str()] = mapnik::save_to_string(im, format);
+}
+
+}
+
+#endif
@@ -0,0 +1,503 @@
+#ifndef __NODE_MAPNIK_RENDER_LAYERS_H__
+#define __NODE_MAPNIK_RENDER_LAYERS_H__
+
+#include "mapnik3x_compatibility.hpp"
+#include "mapnik_cancel_token.hpp"
+#include "mapnik_projection_cache.hpp"
+#include "utils.hpp"
+
+// mapnik
+#include <mapnik/attribute.hpp>         // for attributes
+#include <mapnik/datasource.hpp>        // for datasource, featureset_ptr
+#include <mapnik/expression_evaluator.hpp>  // for evaluate
+#include <mapnik/feature.hpp>           // for feature_impl
+#include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
+#include <mapnik/feature_type_style.hpp>  // for feature_type_style
+#include <mapnik/featureset.hpp>        // for Featureset
+#include <mapnik/layer.hpp>             // for layer
+#include <mapnik/map.hpp>               // for Map
+#include <mapnik/projection.hpp>        // for projection
+#include <mapnik/query.hpp>             // for query
+#include <mapnik/request.hpp>           // for request
+#include <mapnik/rule.hpp>              // for rule
+#include <mapnik/scale_denominator.hpp>  // for scale_denominator
+#include <mapnik/value.hpp>             // for value_type
+
+// boost
+#include <boost/optional/optional.hpp>
+#include MAPNIK_MAKE_SHARED_INCLUDE
+
+// stl
+#include <chrono>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace node_mapnik {
+
+struct layer_stats
+{
+    layer_stats(std::string const& _name)
+      : name(_name),
+        time(0.0),
+        features_read(0),
+        features_drawn(0) {}
+    std::string name;
+    double time; // milliseconds
+    std::size_t features_read;
+    std::size_t features_drawn;
+};
+
+// collected on the worker with {stats:true} and handed to the callback
+struct render_stats
+{
+    render_stats()
+      : layers(),
+        render_time(0.0),
+        encode_time(0.0) {}
+    std::vector<layer_stats> layers;
+    double render_time; // milliseconds
+    double encode_time; // milliseconds
+};
+
+typedef std::chrono::steady_clock stats_clock;
+
+inline double elapsed_ms(stats_clock::time_point const& start)
+{
+    return std::chrono::duration<double, std::milli>(stats_clock::now() - start).count();
+}
+
+inline Local<Object> stats_to_object(render_stats const& stats)
+{
+    NanEscapableScope();
+    Local<Object> obj = NanNew<Object>();
+    Local<Array> layers = NanNew<Array>(stats.layers.size());
+    for (std::size_t i = 0; i < stats.layers.size(); ++i)
+    {
+        layer_stats const& ls = stats.layers[i];
+        Local<Object> layer = NanNew<Object>();
+        layer->Set(NanNew("name"), NanNew(ls.name.c_str()));
+        layer->Set(NanNew("time"), NanNew<Number>(ls.time));
+        layer->Set(NanNew("features_read"), NanNew<Number>(ls.features_read));
+        layer->Set(NanNew("features_drawn"), NanNew<Number>(ls.features_drawn));
+        layers->Set(i, layer);
+    }
+    obj->Set(NanNew("layers"), layers);
+    obj->Set(NanNew("render_time"), NanNew<Number>(stats.render_time));
+    obj->Set(NanNew("encode_time"), NanNew<Number>(stats.encode_time));
+    return NanEscapeScope(obj);
+}
+
+// Decides whether a feature would be drawn by a layer: it has to match the
+// filter of at least one active rule, or fall through to an else rule.
+// Active also-filter rules count as matching every feature, so a layer that
+// only has those is never reported as drawing nothing.
+class rule_matcher
+{
+public:
+    rule_matcher(mapnik::Map const& map,
+                 mapnik::layer const& lyr,
+                 double scale_denom,
+                 mapnik::attributes const& variables)
+      : filters_(),
+        matches_all_(false),
+        variables_(variables)
+    {
+        for (std::string const& style_name : lyr.styles())
+        {
+            boost::optional<mapnik::feature_type_style const&> style = map.find_style(style_name);
+            if (!style) continue;
+            for (mapnik::rule const& r : style->get_rules())
+            {
+                if (!r.active(scale_denom)) continue;
+                if (r.has_else_filter() || r.has_also_filter())
+                {
+                    matches_all_ = true;
+                }
+                else
+                {
+                    filters_.push_back(r.get_filter());
+                }
+            }
+        }
+    }
+
+    bool operator()(mapnik::feature_impl const& feature) const
+    {
+        typedef mapnik::evaluate<mapnik::feature_impl,mapnik::value_type,mapnik::attributes> evaluator_type;
+        for (mapnik::expression_ptr const& filter : filters_)
+        {
+            mapnik::value_type result = MAPNIK_APPLY_VISITOR(evaluator_type(feature,variables_), *filter);
+            if (result.to_bool())
+            {
+                return true;
+            }
+        }
+        return matches_all_;
+    }
+
+    // no active rule at this scale, so nothing would ever be drawn
+    bool empty() const
+    {
+        return filters_.empty() && !matches_all_;
+    }
+
+private:
+    std::vector<mapnik::expression_ptr> filters_;
+    bool matches_all_;
+    mapnik::attributes variables_;
+};
+
+typedef MAPNIK_SHARED_PTR<rule_matcher const> rule_matcher_ptr;
+
+// Stops handing out features once the render has been cancelled and
+// optionally counts the features read and drawn for a layer.
+class layer_featureset : public mapnik::Featureset
+{
+public:
+    layer_featureset(mapnik::featureset_ptr const& fs,
+                     render_cancel const& cancel,
+                     layer_stats * stats,
+                     rule_matcher_ptr const& matcher)
+      : fs_(fs),
+        cancel_(cancel),
+        stats_(stats),
+        matcher_(matcher) {}
+
+    mapnik::feature_ptr next()
+    {
+        if (cancel_.cancelled())
+        {
+            return mapnik::feature_ptr();
+        }
+        mapnik::feature_ptr feature = fs_->next();
+        if (feature && stats_)
+        {
+            ++stats_->features_read;
+            if (matcher_ && (*matcher_)(*feature))
+            {
+                ++stats_->features_drawn;
+            }
+        }
+        return feature;
+    }
+
+private:
+    mapnik::featureset_ptr fs_;
+    render_cancel cancel_;
+    layer_stats * stats_;
+    rule_matcher_ptr matcher_;
+};
+
+// forwards to the layer's datasource, wrapping each featureset it returns
+class layer_datasource : public mapnik::datasource
+{
+public:
+    layer_datasource(mapnik::datasource_ptr const& ds,
+                     render_cancel const& cancel,
+                     layer_stats * stats,
+                     rule_matcher_ptr const& matcher)
+      : mapnik::datasource(ds->params()),
+        ds_(ds),
+        cancel_(cancel),
+        stats_(stats),
+        matcher_(matcher) {}
+
+    datasource_t type() const
+    {
+        return ds_->type();
+    }
+
+    mapnik::processor_context_ptr get_context(mapnik::feature_style_context_map & ctx) const
+    {
+        return ds_->get_context(ctx);
+    }
+
+    mapnik::featureset_ptr features_with_context(mapnik::query const& q,
+                                                 mapnik::processor_context_ptr ctx) const
+    {
+        return wrap(ds_->features_with_context(q, ctx));
+    }
+
+    mapnik::featureset_ptr features(mapnik::query const& q) const
+    {
+        return wrap(ds_->features(q));
+    }
+
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt, double tol) const
+    {
+        return wrap(ds_->features_at_point(pt, tol));
+    }
+
+    mapnik::box2d<double> envelope() const
+    {
+        return ds_->envelope();
+    }
+
+    boost::optional<mapnik::datasource::geometry_t> get_geometry_type() const
+    {
+        return ds_->get_geometry_type();
+    }
+
+    mapnik::layer_descriptor get_descriptor() const
+    {
+        return ds_->get_descriptor();
+    }
+
+private:
+    mapnik::featureset_ptr wrap(mapnik::featureset_ptr const& fs) const
+    {
+        if (!fs)
+        {
+            return fs;
+        }
+        return MAPNIK_MAKE_SHARED<layer_featureset>(fs, cancel_, stats_, matcher_);
+    }
+
+    mapnik::datasource_ptr ds_;
+    render_cancel cancel_;
+    layer_stats * stats_;
+    rule_matcher_ptr matcher_;
+};
+
+// Copy of `lyr` whose datasource honours `cancel` and, when `stats` is
+// given, counts features read and drawn at `scale_denom`.
+inline mapnik::layer wrap_layer(mapnik::layer const& lyr,
+                                render_cancel const& cancel,
+                                layer_stats * stats,
+                                mapnik::Map const& map,
+                                double scale_denom,
+                                mapnik::attributes const& variables)
+{
+    mapnik::layer lyr_copy(lyr);
+    mapnik::datasource_ptr ds = lyr.datasource();
+    if (ds)
+    {
+        rule_matcher_ptr matcher;
+        if (stats)
+        {
+            matcher = MAPNIK_MAKE_SHARED<rule_matcher>(map, lyr, scale_denom, variables);
+        }
+        lyr_copy.set_datasource(MAPNIK_MAKE_SHARED<layer_datasource>(ds, cancel, stats, matcher));
+    }
+    return lyr_copy;
+}
+
+// [first, last) indexes into map.layers()
+typedef std::pair<std::size_t, std::size_t> layer_range;
+typedef std::vector<layer_range> layer_ranges;
+
+// one flag per map layer, or empty to render every layer
+typedef std::vector<bool> layer_mask;
+
+inline bool layer_selected(layer_mask const& mask, std::size_t i)
+{
+    return mask.empty() || (i < mask.size() && mask[i]);
+}
+
+// Reads the 'layers' render option, an array of layer names or indexes, into
+// `mask`. Throws a JS TypeError and returns false if the option is invalid.
+inline bool parse_layers_option(Local<Value> const& opt,
+                                mapnik::Map const& map,
+                                layer_mask & mask)
+{
+    if (!opt->IsArray())
+    {
+        NanThrowTypeError("optional arg 'layers' must be an array of layer names or indexes");
+        return false;
+    }
+    std::vector<mapnik::layer> const& layers = map.layers();
+    Local<Array> layer_list = Local<Array>::Cast(opt);
+    mask.assign(layers.size(), false);
+    for (unsigned i = 0; i < layer_list->Length(); ++i)
+    {
+        Local<Value> layer_id = layer_list->Get(i);
+        if (layer_id->IsString())
+        {
+            std::string layer_name = TOSTR(layer_id);
+            std::size_t idx = 0;
+            while (idx < layers.size() && layers[idx].name() != layer_name)
+            {
+                ++idx;
+            }
+            if (idx == layers.size())
+            {
+                std::string s("layer '");
+                s += layer_name + "' named in 'layers' does not exist";
+                NanThrowTypeError(s.c_str());
+                return false;
+            }
+            mask[idx] = true;
+        }
+        else if (layer_id->IsNumber())
+        {
+            int64_t idx = layer_id->IntegerValue();
+            if (idx < 0 || idx >= static_cast<int64_t>(layers.size()))
+            {
+                std::ostringstream s;
+                s << "layer index " << idx << " in 'layers' is out of range";
+                NanThrowTypeError(s.str().c_str());
+                return false;
+            }
+            mask[idx] = true;
+        }
+        else
+        {
+            NanThrowTypeError("optional arg 'layers' must be an array of layer names or indexes");
+            return false;
+        }
+    }
+    return true;
+}
+
+// the scale denominator feature_style_processor::apply() would use
+inline double effective_scale_denominator(mapnik::request const& m_req,
+                                          mapnik::projection const& proj,
+                                          double scale_denom,
+                                          double scale_factor)
+{
+    if (scale_denom <= 0.0)
+    {
+        scale_denom = mapnik::scale_denominator(m_req.scale(),proj.is_geographic());
+    }
+    return scale_denom * scale_factor;
+}
+
+// Renders the layers in `range` without starting or ending map processing.
+// `stats->layers` must already have room for every layer in the range.
+// Layers are queried with the map's buffer size, as ren.apply() does.
+template <typename Renderer>
+void render_layer_range(Renderer & ren,
+                        mapnik::Map const& map,
+                        mapnik::request const& m_req,
+                        mapnik::projection const& proj,
+                        double scale_denom,
+                        mapnik::attributes const& variables,
+                        render_cancel const& cancel,
+                        render_stats * stats,
+                        layer_range const& range,
+                        layer_mask const& mask = layer_mask())
+{
+    std::vector<mapnik::layer> const& layers = map.layers();
+    for (std::size_t i = range.first; i < range.second; ++i)
+    {
+        cancel.check();
+        mapnik::layer const& lyr = layers[i];
+        if (layer_selected(mask, i) && lyr.visible(scale_denom))
+        {
+            layer_stats * ls = NULL;
+            if (stats)
+            {
+                stats->layers.push_back(layer_stats(lyr.name()));
+                ls = &stats->layers.back();
+            }
+            stats_clock::time_point layer_start = stats_clock::now();
+            std::set<std::string> names;
+            ren.apply_to_layer(wrap_layer(lyr, cancel, ls, map, scale_denom, variables),
+                               ren,
+                               proj,
+                               m_req.scale(),
+                               scale_denom,
+                               m_req.width(),
+                               m_req.height(),
+                               m_req.extent(),
+                               map.buffer_size(),
+                               names);
+            if (ls) ls->time = elapsed_ms(layer_start);
+        }
+    }
+}
+
+// Equivalent of feature_style_processor::apply() for agg/cairo/svg renderers
+// that renders layer by layer so that the render can be abandoned between
+// layers and features, so that per layer stats can be collected and so that
+// only the layers in `mask` are drawn. Without a cancel token, timeout,
+// stats or mask this is simply ren.apply().
+template <typename Renderer>
+void render_layers(Renderer & ren,
+                   mapnik::Map const& map,
+                   mapnik::request const& m_req,
+                   double scale_denom,
+                   double scale_factor,
+                   mapnik::attributes const& variables,
+                   render_cancel const& cancel,
+                   render_stats * stats,
+                   layer_mask const& mask = layer_mask())
+{
+    stats_clock::time_point render_start = stats_clock::now();
+    if (!cancel.enabled() && !stats && mask.empty())
+    {
+        ren.apply(scale_denom);
+        return;
+    }
+    std::shared_ptr<mapnik::projection const> cached_proj = cached_projection(map.srs());
+    mapnik::projection const& proj = *cached_proj;
+    scale_denom = effective_scale_denominator(m_req, proj, scale_denom, scale_factor);
+    // layer_stats are referenced by the wrapped datasources, so never reallocate
+    if (stats) stats->layers.reserve(map.layers().size());
+    ren.start_map_processing(map);
+    render_layer_range(ren, map, m_req, proj, scale_denom, variables, cancel, stats,
+                       layer_range(0, map.layers().size()), mask);
+    cancel.check();
+    ren.end_map_processing(map);
+    if (stats) stats->render_time = elapsed_ms(render_start);
+}
+
+// Same as render_layers for the vector tile processor, which has its own
+// apply_to_layer signature.
+template <typename Processor>
+void process_map_layers(Processor & ren,
+                        mapnik::Map const& map,
+                        mapnik::request const& m_req,
+                        double scale_denom,
+                        double scale_factor,
+                        mapnik::attributes const& variables,
+                        render_cancel const& cancel,
+                        render_stats * stats,
+                        layer_mask const& mask = layer_mask())
+{
+    stats_clock::time_point render_start = stats_clock::now();
+    if (!cancel.enabled() && !stats && mask.empty())
+    {
+        ren.apply(scale_denom);
+        return;
+    }
+    std::shared_ptr<mapnik::projection const> cached_proj = cached_projection(map.srs());
+    mapnik::projection const& proj = *cached_proj;
+    scale_denom = effective_scale_denominator(m_req, proj, scale_denom, scale_factor);
+    if (stats) stats->layers.reserve(map.layers().size());
+    std::vector<mapnik::layer> const& layers = map.layers();
+    for (std::size_t i = 0; i < layers.size(); ++i)
+    {
+        cancel.check();
+        mapnik::layer const& lyr = layers[i];
+        if (layer_selected(mask, i) && lyr.visible(scale_denom))
+        {
+            layer_stats * ls = NULL;
+            if (stats)
+            {
+                stats->layers.push_back(layer_stats(lyr.name()));
+                ls = &stats->layers.back();
+            }
+            stats_clock::time_point layer_start = stats_clock::now();
+            ren.apply_to_layer(wrap_layer(lyr, cancel, ls, map, scale_denom, variables),
+                               proj,
+                               m_req.scale(),
+                               scale_denom,
+                               m_req.width(),
+                               m_req.height(),
+                               m_req.extent(),
+                               m_req.buffer_size());
+            if (ls) ls->time = elapsed_ms(layer_start);
+        }
+    }
+    cancel.check();
+    if (stats) stats->render_time = elapsed_ms(render_start);
+}
+
+}
+
+#endif
@@ -0,0 +1,213 @@
+#ifndef __NODE_MAPNIK_RENDER_PARALLEL_H__
+#define __NODE_MAPNIK_RENDER_PARALLEL_H__
+
+#include "mapnik_thread_pool.hpp"
+#include "render_layers.hpp"
+#include "utils.hpp"
+
+// mapnik
+#include <mapnik/agg_renderer.hpp>      // for agg_renderer
+#include <mapnik/color.hpp>             // for color
+#include <mapnik/graphics.hpp>          // for image_32
+#include <mapnik/image_compositing.hpp>  // for composite
+#include <mapnik/map.hpp>               // for Map
+
+// stl
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace node_mapnik {
+
+// Reads the 'parallel' render option into runs of consecutive layers that
+// are rendered independently of each other. `true` gives every layer its
+// own group; an array of layer name arrays groups layers explicitly and
+// any layer left out gets a group of its own. Throws a JS TypeError and
+// returns false if the option is invalid.
+inline bool parse_parallel_option(Local<Value> const& opt,
+                                  mapnik::Map const& map,
+                                  layer_ranges & groups)
+{
+    std::vector<mapnik::layer> const& layers = map.layers();
+    if (opt->IsBoolean())
+    {
+        if (opt->BooleanValue())
+        {
+            for (std::size_t i = 0; i < layers.size(); ++i)
+            {
+                groups.push_back(layer_range(i, i + 1));
+            }
+        }
+        return true;
+    }
+    if (!opt->IsArray())
+    {
+        NanThrowTypeError("optional arg 'parallel' must be a boolean or an array of layer name arrays");
+        return false;
+    }
+    Local<Array> group_list = Local<Array>::Cast(opt);
+    std::vector<int> group_of(layers.size(), -1);
+    for (unsigned g = 0; g < group_list->Length(); ++g)
+    {
+        Local<Value> names = group_list->Get(g);
+        if (!names->IsArray())
+        {
+            NanThrowTypeError("optional arg 'parallel' must be a boolean or an array of layer name arrays");
+            return false;
+        }
+        Local<Array> name_list = Local<Array>::Cast(names);
+        for (unsigned j = 0; j < name_list->Length(); ++j)
+        {
+            Local<Value> name = name_list->Get(j);
+            if (!name->IsString())
+            {
+                NanThrowTypeError("optional arg 'parallel' must be a boolean or an array of layer name arrays");
+                return false;
+            }
+            std::string layer_name = TOSTR(name);
+            std::size_t idx = 0;
+            while (idx < layers.size() && layers[idx].name() != layer_name)
+            {
+                ++idx;
+            }
+            if (idx == layers.size())
+            {
+                std::string s("layer '");
+                s += layer_name + "' named in 'parallel' does not exist";
+                NanThrowTypeError(s.c_str());
+                return false;
+            }
+            if (group_of[idx] != -1)
+            {
+                std::string s("layer '");
+                s += layer_name + "' is named more than once in 'parallel'";
+                NanThrowTypeError(s.c_str());
+                return false;
+            }
+            group_of[idx] = static_cast<int>(g);
+        }
+    }
+    // a group is composited as one image, so it must not have another
+    // group's layers stacked in between its own
+    std::vector<bool> closed(group_list->Length(), false);
+    int current = -1;
+    for (std::size_t i = 0; i < layers.size(); ++i)
+    {
+        int g = group_of[i];
+        if (g >= 0 && g == current)
+        {
+            groups.back().second = i + 1;
+            continue;
+        }
+        if (current >= 0)
+        {
+            closed[current] = true;
+        }
+        if (g >= 0 && closed[g])
+        {
+            NanThrowTypeError("layers in a 'parallel' group must be consecutive in the map");
+            return false;
+        }
+        groups.push_back(layer_range(i, i + 1));
+        current = g;
+    }
+    return true;
+}
+
+// Renders each group of layers into its own scratch image, spread over the
+// worker pool with run_tasks(), then composites the groups over `im` in map
+// order. Labels are only collision checked against labels in the same group.
+inline void render_parallel(mapnik::Map const& map,
+                            mapnik::request const& m_req,
+                            mapnik::attributes const& variables,
+                            mapnik::image_32 & im,
+                            double scale_denom,
+                            double scale_factor,
+                            unsigned offset_x,
+                            unsigned offset_y,
+                            layer_ranges const& groups,
+                            render_cancel const& cancel,
+                            render_stats * stats,
+                            layer_mask const& mask = layer_mask())
+{
+    stats_clock::time_point render_start = stats_clock::now();
+    if (groups.empty() || groups.back().second > map.layers().size())
+    {
+        throw std::runtime_error("map layers changed after render was called");
+    }
+
+    // the background belongs to the target only, so scratch renders use a
+    // copy of the map without it
+    std::unique_ptr<mapnik::Map> layers_only;
+    mapnik::Map const* layer_map = &map;
+    if (map.background())
+    {
+        layers_only.reset(new mapnik::Map(map));
+        layers_only->set_background(mapnik::color(0,0,0,0));
+        layer_map = layers_only.get();
+    }
+
+    std::size_t count = groups.size();
+    std::vector<std::unique_ptr<mapnik::image_32> > images(count);
+    std::vector<render_stats> group_stats(count);
+    run_tasks(count, [&](std::size_t i)
+    {
+        // proj4 handles are not shared between threads, so each task looks
+        // up the one for the thread it runs on
+        std::shared_ptr<mapnik::projection const> cached_proj = cached_projection(layer_map->srs());
+        mapnik::projection const& proj = *cached_proj;
+        double denom = effective_scale_denominator(m_req, proj, scale_denom, scale_factor);
+        images[i].reset(new mapnik::image_32(im.width(),im.height()));
+        render_stats * gs = NULL;
+        if (stats)
+        {
+            gs = &group_stats[i];
+            gs->layers.reserve(groups[i].second - groups[i].first);
+        }
+        mapnik::agg_renderer<mapnik::image_32> ren(*layer_map,
+                                                   m_req,
+                                                   variables,
+                                                   *images[i],
+                                                   scale_factor,
+                                                   offset_x,
+                                                   offset_y);
+        ren.start_map_processing(*layer_map);
+        render_layer_range(ren, *layer_map, m_req, proj, denom, variables, cancel, gs, groups[i], mask);
+        // end_map_processing() is skipped so the scratch image stays
+        // premultiplied, which is what composite() expects
+    });
+    cancel.check();
+
+    // the target gets the background from the renderer's setup, then each
+    // group is laid over it in map order
+    mapnik::agg_renderer<mapnik::image_32> ren(map,
+                                               m_req,
+                                               variables,
+                                               im,
+                                               scale_factor,
+                                               offset_x,
+                                               offset_y);
+    ren.start_map_processing(map);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        mapnik::composite(im.data(), images[i]->data(), mapnik::src_over, 1.0f, 0, 0);
+        if (images[i]->painted())
+        {
+            im.painted(true);
+        }
+    }
+    ren.end_map_processing(map);
+
+    if (stats)
+    {
+        for (render_stats const& gs : group_stats)
+        {
+            stats->layers.insert(stats->layers.end(), gs.layers.begin(), gs.layers.end());
+        }
+        stats->render_time = elapsed_ms(render_start);
+    }
+}
+
+}
+
+#endif
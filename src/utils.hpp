@@ -130,5 +130,20 @@ struct value_converter: public MAPNIK_STATIC_VISITOR<Handle<Value> >
     }
 };
 
+inline void release_string(char *, void * hint)
+{
+    delete static_cast<std::string *>(hint);
+}
+
+// Hands the bytes of `s` to a new Buffer without copying them. `s` is left
+// empty and the bytes are freed when the Buffer is garbage collected.
+inline Local<Object> string_to_buffer(std::string & s)
+{
+    NanEscapableScope();
+    std::string * owned = new std::string();
+    owned->swap(s);
+    return NanEscapeScope(NanNewBufferHandle(&(*owned)[0], owned->size(), release_string, owned));
+}
+
 }
 #endif
@@ -0,0 +1,404 @@
+#ifndef __NODE_MAPNIK_VECTOR_TILE_DATASOURCE_PBF_H__
+#define __NODE_MAPNIK_VECTOR_TILE_DATASOURCE_PBF_H__
+
+#include "mapnik3x_compatibility.hpp"
+#include "pbf.hpp"
+
+// mapnik
+#include <mapnik/box2d.hpp>             // for box2d
+#include <mapnik/datasource.hpp>        // for datasource, featureset_ptr
+#include <mapnik/feature.hpp>           // for feature_ptr, context_ptr
+#include <mapnik/feature_factory.hpp>   // for feature_factory
+#include <mapnik/feature_layer_desc.hpp>  // for layer_descriptor
+#include <mapnik/featureset.hpp>        // for Featureset
+#include <mapnik/geometry.hpp>          // for geometry_type
+#include <mapnik/params.hpp>            // for parameters
+#include <mapnik/query.hpp>             // for query
+#include <mapnik/unicode.hpp>           // for transcoder
+#include <mapnik/value.hpp>             // for value
+#include <mapnik/well_known_srs.hpp>    // for EARTH_CIRCUMFERENCE
+
+// boost
+#include <boost/optional/optional.hpp>
+#include MAPNIK_MAKE_SHARED_INCLUDE
+
+// stl
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace node_mapnik {
+
+// Header of an encoded layer: where each feature starts and the decoded
+// keys and values the features' tags point into.
+struct tile_layer_pbf
+{
+    typedef std::pair<const char *, std::size_t> span_type;
+    std::vector<span_type> features;
+    std::vector<std::string> keys;
+    std::vector<mapnik::value> values;
+};
+
+// Reads the features of one encoded vector tile layer without building
+// protobuf objects. Geometries and attributes are decoded from the raw
+// bytes as each feature is handed out.
+class tile_featureset_pbf : public mapnik::Featureset
+{
+public:
+    typedef tile_layer_pbf::span_type span_type;
+
+    tile_featureset_pbf(MAPNIK_SHARED_PTR<tile_layer_pbf const> const& layer,
+                        std::set<std::string> const& attribute_names,
+                        mapnik::box2d<double> const& filter,
+                        double tile_x,
+                        double tile_y,
+                        double scale)
+      : layer_(layer),
+        features_(layer->features),
+        keys_(layer->keys),
+        values_(layer->values),
+        filter_(filter),
+        tile_x_(tile_x),
+        tile_y_(tile_y),
+        scale_(scale),
+        itr_(0),
+        ctx_(MAPNIK_MAKE_SHARED<mapnik::context_type>())
+    {
+        for (std::string const& name : attribute_names)
+        {
+            ctx_->push(name);
+        }
+    }
+
+    mapnik::feature_ptr next()
+    {
+        while (itr_ < features_.size())
+        {
+            span_type const& span = features_[itr_];
+            mapnik::value_integer feature_id = itr_++;
+            int type = 0;
+            const char * tags = NULL;
+            std::size_t tags_length = 0;
+            const char * geometry = NULL;
+            std::size_t geometry_length = 0;
+            pbf::message item(span.first, span.second);
+            while (item.next())
+            {
+                if (item.tag == 1)
+                {
+                    feature_id = static_cast<mapnik::value_integer>(item.varint());
+                }
+                else if (item.tag == 2)
+                {
+                    tags_length = static_cast<std::size_t>(item.varint());
+                    tags = item.getData();
+                    item.skipBytes(tags_length);
+                }
+                else if (item.tag == 3)
+                {
+                    type = static_cast<int>(item.varint());
+                }
+                else if (item.tag == 4)
+                {
+                    geometry_length = static_cast<std::size_t>(item.varint());
+                    geometry = item.getData();
+                    item.skipBytes(geometry_length);
+                }
+                else
+                {
+                    item.skip();
+                }
+            }
+            if (geometry_length == 0)
+            {
+                continue;
+            }
+            mapnik::box2d<double> envelope;
+            std::unique_ptr<mapnik::geometry_type> geom(decode_geometry(type, geometry, geometry_length, envelope));
+            if (!envelope.valid() || !filter_.intersects(envelope))
+            {
+                continue;
+            }
+            mapnik::feature_ptr feature(mapnik::feature_factory::create(ctx_,feature_id));
+            feature->add_geometry(geom.release());
+            if (tags_length > 0)
+            {
+                pbf::message packed(tags, tags_length);
+                const char * end = tags + tags_length;
+                while (packed.getData() < end)
+                {
+                    std::size_t key = static_cast<std::size_t>(packed.varint());
+                    if (packed.getData() >= end)
+                    {
+                        break;
+                    }
+                    std::size_t value = static_cast<std::size_t>(packed.varint());
+                    if (key < keys_.size() && value < values_.size() && feature->has_key(keys_[key]))
+                    {
+                        feature->put(keys_[key], values_[value]);
+                    }
+                }
+            }
+            return feature;
+        }
+        return mapnik::feature_ptr();
+    }
+
+private:
+    // Commands and zigzag encoded deltas as written by the vector tile
+    // encoder, in tile coordinates relative to the tile's top left corner.
+    mapnik::geometry_type * decode_geometry(int type,
+                                            const char * data,
+                                            std::size_t length,
+                                            mapnik::box2d<double> & envelope) const
+    {
+        const int cmd_bits = 3;
+        std::unique_ptr<mapnik::geometry_type> geom(new mapnik::geometry_type(static_cast<MAPNIK_GEOM_TYPE>(type)));
+        pbf::message packed(data, length);
+        const char * end = data + length;
+        double x = tile_x_;
+        double y = tile_y_;
+        bool first = true;
+        while (packed.getData() < end)
+        {
+            uint32_t cmd_length = static_cast<uint32_t>(packed.varint());
+            int cmd = cmd_length & ((1 << cmd_bits) - 1);
+            uint32_t count = cmd_length >> cmd_bits;
+            if (cmd == mapnik::SEG_MOVETO || cmd == mapnik::SEG_LINETO)
+            {
+                for (uint32_t i = 0; i < count; ++i)
+                {
+                    int32_t dx = static_cast<int32_t>(packed.varint());
+                    int32_t dy = static_cast<int32_t>(packed.varint());
+                    dx = ((dx >> 1) ^ (-(dx & 1)));
+                    dy = ((dy >> 1) ^ (-(dy & 1)));
+                    x += static_cast<double>(dx) / scale_;
+                    y -= static_cast<double>(dy) / scale_;
+                    if (first)
+                    {
+                        envelope.init(x,y,x,y);
+                        first = false;
+                    }
+                    else
+                    {
+                        envelope.expand_to_include(x,y);
+                    }
+                    geom->push_vertex(x, y, static_cast<mapnik::CommandType>(cmd));
+                }
+            }
+            else if (cmd == (mapnik::SEG_CLOSE & ((1 << cmd_bits) - 1)))
+            {
+                geom->close_path();
+            }
+            else
+            {
+                std::ostringstream s;
+                s << "Unknown command type: " << cmd;
+                throw std::runtime_error(s.str());
+            }
+        }
+        return geom.release();
+    }
+
+    MAPNIK_SHARED_PTR<tile_layer_pbf const> layer_;
+    std::vector<span_type> const& features_;
+    std::vector<std::string> const& keys_;
+    std::vector<mapnik::value> const& values_;
+    mapnik::box2d<double> filter_;
+    double tile_x_;
+    double tile_y_;
+    double scale_;
+    std::size_t itr_;
+    mapnik::context_ptr ctx_;
+};
+
+// Counterpart of mapnik::vector_tile_impl::tile_datasource that reads an
+// encoded layer in place. The layer header (keys, values and where each
+// feature starts) is read once; the bytes must outlive the datasource and
+// any featureset it returns.
+class tile_datasource_pbf : public mapnik::datasource
+{
+public:
+    tile_datasource_pbf(const char * data,
+                        std::size_t length,
+                        unsigned x,
+                        unsigned y,
+                        unsigned z,
+                        unsigned tile_size)
+      : mapnik::datasource(mapnik::parameters()),
+        desc_("in-memory PBF encoded datasource","utf-8"),
+        name_(),
+        layer_(MAPNIK_MAKE_SHARED<tile_layer_pbf>()),
+        extent_(4096),
+        has_raster_(false),
+        tile_x_(0.0),
+        tile_y_(0.0),
+        scale_(0.0),
+        envelope_()
+    {
+        mapnik::transcoder tr("utf-8");
+        pbf::message item(data, length);
+        while (item.next())
+        {
+            switch (item.tag)
+            {
+            case 1:
+                name_ = item.string();
+                break;
+            case 2:
+            {
+                std::size_t len = static_cast<std::size_t>(item.varint());
+                const char * feature = item.getData();
+                item.skipBytes(len);
+                layer_->features.push_back(tile_layer_pbf::span_type(feature, len));
+                pbf::message fields(feature, len);
+                while (fields.next())
+                {
+                    if (fields.tag == 5)
+                    {
+                        has_raster_ = true;
+                    }
+                    fields.skip();
+                }
+                break;
+            }
+            case 3:
+                layer_->keys.push_back(item.string());
+                break;
+            case 4:
+            {
+                std::size_t len = static_cast<std::size_t>(item.varint());
+                pbf::message value(item.getData(), len);
+                item.skipBytes(len);
+                layer_->values.push_back(decode_value(value, tr));
+                break;
+            }
+            case 5:
+                extent_ = static_cast<unsigned>(item.varint());
+                break;
+            default:
+                item.skip();
+                break;
+            }
+        }
+        double resolution = mapnik::EARTH_CIRCUMFERENCE/(1 << z);
+        tile_x_ = -0.5 * mapnik::EARTH_CIRCUMFERENCE + x * resolution;
+        tile_y_ =  0.5 * mapnik::EARTH_CIRCUMFERENCE - y * resolution;
+        scale_ = (static_cast<double>(extent_) / tile_size) * tile_size/resolution;
+        envelope_.init(tile_x_, tile_y_ - resolution, tile_x_ + resolution, tile_y_);
+        desc_.set_name(name_);
+        for (std::string const& key : layer_->keys)
+        {
+            // the value types are only known once features are read
+            desc_.add_descriptor(mapnik::attribute_descriptor(key, mapnik::Object));
+        }
+    }
+
+    // raster features need the image decoding of the protobuf datasource
+    bool has_raster() const
+    {
+        return has_raster_;
+    }
+
+    std::string const& name() const
+    {
+        return name_;
+    }
+
+    void set_envelope(mapnik::box2d<double> const& bbox)
+    {
+        envelope_ = bbox;
+    }
+
+    datasource_t type() const
+    {
+        return mapnik::datasource::Vector;
+    }
+
+    mapnik::featureset_ptr features(mapnik::query const& q) const
+    {
+        return MAPNIK_MAKE_SHARED<tile_featureset_pbf>(layer_, q.property_names(), q.get_bbox(),
+                                                       tile_x_, tile_y_, scale_);
+    }
+
+    mapnik::featureset_ptr features_at_point(mapnik::coord2d const& pt, double tol = 0) const
+    {
+        std::set<std::string> names(layer_->keys.begin(), layer_->keys.end());
+        mapnik::box2d<double> filter(pt.x - tol, pt.y - tol, pt.x + tol, pt.y + tol);
+        return MAPNIK_MAKE_SHARED<tile_featureset_pbf>(layer_, names, filter,
+                                                       tile_x_, tile_y_, scale_);
+    }
+
+    mapnik::box2d<double> envelope() const
+    {
+        return envelope_;
+    }
+
+    boost::optional<mapnik::datasource::geometry_t> get_geometry_type() const
+    {
+        return boost::optional<mapnik::datasource::geometry_t>();
+    }
+
+    mapnik::layer_descriptor get_descriptor() const
+    {
+        return desc_;
+    }
+
+private:
+    static mapnik::value decode_value(pbf::message & item, mapnik::transcoder const& tr)
+    {
+        mapnik::value result;
+        while (item.next())
+        {
+            switch (item.tag)
+            {
+            case 1:
+            {
+                std::string str = item.string();
+                result = tr.transcode(str.data(), str.length());
+                break;
+            }
+            case 2:
+                result = static_cast<mapnik::value_double>(item.float32());
+                break;
+            case 3:
+                result = static_cast<mapnik::value_double>(item.float64());
+                break;
+            case 4:
+                result = static_cast<mapnik::value_integer>(item.int64());
+                break;
+            case 5:
+                result = static_cast<mapnik::value_integer>(item.varint());
+                break;
+            case 6:
+                result = static_cast<mapnik::value_integer>(item.svarint());
+                break;
+            case 7:
+                result = static_cast<mapnik::value_bool>(item.varint() != 0);
+                break;
+            default:
+                item.skip();
+                break;
+            }
+        }
+        return result;
+    }
+
+    mapnik::layer_descriptor desc_;
+    std::string name_;
+    MAPNIK_SHARED_PTR<tile_layer_pbf> layer_;
+    unsigned extent_;
+    bool has_raster_;
+    double tile_x_;
+    double tile_y_;
+    double scale_;
+    mapnik::box2d<double> envelope_;
+};
+
+}
+
+#endif
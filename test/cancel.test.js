@@ -0,0 +1,113 @@
+"use strict";
+
+var mapnik = require('../');
+var assert = require('assert');
+var fs = require('fs');
+var path = require('path');
+
+mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
+
+describe('mapnik.CancelToken', function() {
+    it('should throw with invalid usage', function() {
+        assert.throws(function() { mapnik.CancelToken(); });
+        var map = new mapnik.Map(256, 256);
+        var im = new mapnik.Image(256, 256);
+        assert.throws(function() { map.render(im, {cancel:{}}, function() {}); });
+        assert.throws(function() { map.render(im, {timeout:-1}, function() {}); });
+        assert.throws(function() { map.render(im, {timeout:'1'}, function() {}); });
+    });
+
+    it('should track cancellation', function() {
+        var token = new mapnik.CancelToken();
+        assert.equal(token.cancelled(), false);
+        token.cancel();
+        assert.equal(token.cancelled(), true);
+    });
+
+    it('should drop a cancelled render', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        var token = new mapnik.CancelToken();
+        token.cancel();
+        map.render(new mapnik.Image(256, 256), {cancel: token}, function(err, im) {
+            assert.ok(err);
+            assert.equal(err.message, 'render cancelled');
+            assert.ok(!im);
+            // the same map renders normally without the token
+            map.render(new mapnik.Image(256, 256), {cancel: new mapnik.CancelToken()}, function(err, im) {
+                if (err) throw err;
+                assert.ok(im);
+                done();
+            });
+        });
+    });
+
+    it('should cancel a multi layer render that is under way', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        var layer = map.get_layer(0);
+        for (var i = 0; i < 99; ++i) {
+            map.add_layer(layer);
+        }
+        map.zoomAll();
+        var start = Date.now();
+        map.render(new mapnik.Image(256, 256), {cancel: new mapnik.CancelToken()}, function(err, im) {
+            if (err) throw err;
+            assert.ok(im);
+            var full = Date.now() - start;
+            var token = new mapnik.CancelToken();
+            start = Date.now();
+            map.render(new mapnik.Image(256, 256), {cancel: token}, function(err, im) {
+                assert.ok(err);
+                assert.equal(err.message, 'render cancelled');
+                assert.ok(!im);
+                // the remaining layers were skipped
+                assert.ok(Date.now() - start < full);
+                done();
+            });
+            // about half way through the layers
+            setTimeout(function() { token.cancel(); }, full / 2);
+        });
+    });
+
+    it('should time out a render', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        map.render('png', {timeout: 0}, function(err, buffer) {
+            assert.ok(err);
+            assert.equal(err.message, 'render timed out');
+            assert.ok(!buffer);
+            done();
+        });
+    });
+
+    it('should cancel a vector tile render', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        var vtile = new mapnik.VectorTile(0, 0, 0);
+        var token = new mapnik.CancelToken();
+        token.cancel();
+        vtile.render(map, new mapnik.Image(256, 256), {cancel: token}, function(err) {
+            assert.ok(err);
+            assert.equal(err.message, 'render cancelled');
+            done();
+        });
+    });
+
+    it('should cancel a blend', function(done) {
+        var images = [
+            fs.readFileSync('test/blend-fixtures/1.png'),
+            fs.readFileSync('test/blend-fixtures/2.png')
+        ];
+        var token = new mapnik.CancelToken();
+        token.cancel();
+        mapnik.blend(images, {cancel: token}, function(err, result) {
+            assert.ok(err);
+            assert.equal(err.message, 'render cancelled');
+            assert.ok(!result);
+            done();
+        });
+    });
+});
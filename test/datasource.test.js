@@ -89,5 +89,198 @@ describe('mapnik.Datasource', function() {
         assert.deepEqual(ds.extent(), expected.extent);
     });
 
+    it('should bulk load a MemoryDatasource', function() {
+        var ds = new mapnik.MemoryDatasource({});
+        assert.throws(function() { ds.addMany(); });
+        assert.throws(function() { ds.addMany({}); });
+        assert.throws(function() { ds.addMany([{x:0,y:0}, {x:'a',y:0}]); });
+        assert.throws(function() { ds.addMany(new Buffer('{"type":"FeatureCollection","features":[{"type":"Feature"')); });
+        var points = [];
+        for (var i = 0; i < 1000; ++i) {
+            points.push({x: i % 100, y: Math.floor(i / 100), properties: {idx: i}});
+        }
+        assert.equal(ds.addMany(points), 1000);
+        var collection = {
+            type: 'FeatureCollection',
+            features: [
+                {type: 'Feature', properties: {name: 'a, "b" [c]'}, geometry: {type: 'Point', coordinates: [200, 200]}},
+                {type: 'Feature', properties: {}, geometry: {type: 'LineString', coordinates: [[-10, -10], [-20, -20]]}}
+            ]
+        };
+        assert.equal(ds.addMany(new Buffer(JSON.stringify(collection))), 2);
+        // errors name the feature's index in the collection
+        var bad = '{"type":"FeatureCollection","features":[' +
+                  '{"type":"Feature","properties":{},"geometry":{"type":"Point","coordinates":[0,0]}},' +
+                  '{"type":"Feature","properties":{"a":},"geometry":{"type":"Point","coordinates":[0,0]}}]}';
+        assert.throws(function() { ds.addMany(new Buffer(bad)); }, /at index 1$/);
+        var featureset = ds.featureset();
+        var count = 0;
+        var feature;
+        var last;
+        while ((feature = featureset.next())) {
+            if (count < 1000) assert.equal(feature.attributes().idx, count);
+            last = feature;
+            count++;
+        }
+        assert.equal(count, 1002);
+        // ids keep counting across calls and features come back in insertion order
+        assert.equal(last.id(), 1002);
+    });
+
+    it('should find features added to a MemoryDatasource after a query', function() {
+        var ds = new mapnik.MemoryDatasource({});
+        function count() {
+            var featureset = ds.featureset();
+            var n = 0;
+            var last;
+            var feature;
+            while ((feature = featureset.next())) {
+                last = feature;
+                n++;
+            }
+            return {n: n, last: last};
+        }
+        ds.addMany([{x: 0, y: 0, properties: {idx: 0}}, {x: 1, y: 1, properties: {idx: 1}}]);
+        assert.equal(count().n, 2);
+        // inserted into the index the first query built
+        for (var i = 2; i < 50; ++i) {
+            ds.add({x: i, y: -i, properties: {idx: i}});
+            var result = count();
+            assert.equal(result.n, i + 1);
+            assert.equal(result.last.attributes().idx, i);
+        }
+    });
+
+    it('should read batches of features with only the requested fields', function() {
+        var ds = new mapnik.Datasource({type: 'shape', file: './test/data/world_merc.shp'});
+        assert.throws(function() { ds.featureset('NAME'); });
+        assert.throws(function() { ds.featureset({bbox: [0, 0, 1]}); });
+        assert.throws(function() { ds.featureset({fields: [1]}); });
+        var featureset = ds.featureset({fields: ['NAME', 'ISO3']});
+        assert.throws(function() { featureset.nextBatch(0); });
+        assert.throws(function() { featureset.nextBatch(10, {geometry: 'yes'}); });
+        var features = [];
+        var batch;
+        while ((batch = featureset.nextBatch(100)).length) {
+            assert.ok(batch.length <= 100);
+            features = features.concat(batch);
+        }
+        assert.equal(features.length, 245);
+        assert.deepEqual(features[244].properties, {NAME: 'Russia', ISO3: 'RUS'});
+        assert.equal(typeof features[244].id, 'number');
+        assert.equal(features[244].geometry, undefined);
+        assert.equal(featureset.nextBatch(1).length, 0);
+
+        // an empty list asks for no attributes at all
+        var bare = ds.featureset({fields: []}).nextBatch(10);
+        assert.equal(bare.length, 10);
+        bare.forEach(function(feature) {
+            assert.deepEqual(feature.properties, {});
+        });
+
+        // a bbox limits the features read
+        var extent = ds.extent();
+        var west = ds.featureset({bbox: [extent[0], extent[1], 0, extent[3]], fields: ['NAME']});
+        var first = west.nextBatch(1000, {geometry: true});
+        assert.ok(first.length > 0 && first.length < 245);
+        assert.equal(JSON.parse(first[0].geometry).type.indexOf('Polygon') >= 0, true);
+    });
+
+    it('should stream a datasource as GeoJSON', function(done) {
+        var ds = new mapnik.Datasource({type: 'shape', file: './test/data/world_merc.shp'});
+        assert.throws(function() { ds.exportGeoJSON({}, function() {}); });
+        assert.throws(function() { ds.exportGeoJSON({format: 'csv'}, function() {}, function() {}); });
+        assert.throws(function() { ds.exportGeoJSON({chunkSize: 0}, function() {}, function() {}); });
+        assert.throws(function() { ds.exportGeoJSON({srs: 3857}, function() {}, function() {}); });
+        var chunks = [];
+        ds.exportGeoJSON({fields: ['NAME'], chunkSize: 4096, srs: '+init=epsg:3857'}, function(chunk) {
+            assert.ok(Buffer.isBuffer(chunk));
+            chunks.push(chunk);
+        }, function(err) {
+            if (err) throw err;
+            assert.ok(chunks.length > 1);
+            var collection = JSON.parse(Buffer.concat(chunks).toString());
+            assert.equal(collection.type, 'FeatureCollection');
+            assert.equal(collection.features.length, 245);
+            assert.deepEqual(collection.features[244].properties, {NAME: 'Russia'});
+            // reprojected from web mercator to lon/lat
+            (function check_coords(coords) {
+                if (typeof coords[0] === 'number') {
+                    assert.ok(coords[0] >= -180 && coords[0] <= 180);
+                    assert.ok(coords[1] >= -90 && coords[1] <= 90);
+                } else {
+                    coords.forEach(check_coords);
+                }
+            })(collection.features[244].geometry.coordinates);
+            var lines = '';
+            var extent = ds.extent();
+            ds.exportGeoJSON({format: 'ndjson', bbox: [extent[0], extent[1], 0, extent[3]]}, function(chunk) {
+                lines += chunk.toString();
+            }, function(err) {
+                if (err) throw err;
+                var features = lines.split('\n').filter(function(l) { return l.length; }).map(JSON.parse);
+                assert.ok(features.length > 0 && features.length < 245);
+                assert.equal(features[0].type, 'Feature');
+                done();
+            });
+        });
+    });
+
+    it('should not hold pool threads for abandoned GeoJSON exports', function(done) {
+        var ds = new mapnik.Datasource({type: 'shape', file: './test/data/world_merc.shp'});
+        var count = 8;
+        var aborted = 0;
+        var exports = [];
+        for (var i = 0; i < count; ++i) {
+            // pauses at the first chunk and never resumes
+            exports.push(ds.exportGeoJSON({format: 'ndjson', chunkSize: 1024}, function() {
+                return false;
+            }, function(err) {
+                assert.ok(err);
+                assert.ok(/aborted/.test(err.message));
+                if (++aborted === count) done();
+            }));
+        }
+        assert.equal(typeof exports[0].resume, 'function');
+        assert.equal(typeof exports[0].abort, 'function');
+        // more exports than pool threads are paused, yet other work runs
+        var chunks = 0;
+        ds.exportGeoJSON({format: 'ndjson', chunkSize: 1024}, function() {
+            ++chunks;
+        }, function(err) {
+            if (err) throw err;
+            assert.ok(chunks > 1);
+            exports.forEach(function(e) {
+                e.abort();
+                // a second abort is ignored
+                e.abort();
+            });
+        });
+    });
+
+    it('should pause a GeoJSON export until resumed', function(done) {
+        var ds = new mapnik.Datasource({type: 'shape', file: './test/data/world_merc.shp'});
+        var chunks = 0;
+        var paused = false;
+        ds.exportGeoJSON({format: 'ndjson', chunkSize: 1024, srs: '+init=epsg:3857'}, function(chunk, resume) {
+            assert.equal(paused, false);
+            assert.equal(typeof resume, 'function');
+            ++chunks;
+            if (chunks % 10 === 0) {
+                paused = true;
+                setTimeout(function() {
+                    paused = false;
+                    resume();
+                }, 5);
+                return false;
+            }
+        }, function(err) {
+            if (err) throw err;
+            assert.equal(paused, false);
+            assert.ok(chunks > 10);
+            done();
+        });
+    });
+
 
 });
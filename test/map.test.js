@@ -2,6 +2,7 @@
 
 var mapnik = require('../');
 var assert = require('assert');
+var fs = require('fs');
 var path = require('path');
 
 mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
@@ -92,6 +93,57 @@ describe('mapnik.Map', function() {
         assert.equal(layers2.length, 0);
     });
 
+    it('should load cached stylesheets', function(done) {
+        mapnik.clearCache();
+        var xml = fs.readFileSync('./test/stylesheet.xml', 'utf8');
+        assert.throws(function() { new mapnik.Map(256, 256).fromStringSync(xml, {cache: 'yes'}); });
+
+        var parsed = new mapnik.Map(256, 256);
+        parsed.fromStringSync(xml, {base: './test/'});
+        var first = new mapnik.Map(256, 256);
+        first.fromStringSync(xml, {base: './test/', cache: true});
+        var second = new mapnik.Map(256, 256);
+        second.fromStringSync(xml, {base: './test/', cache: true});
+        assert.equal(first.toXML(), parsed.toXML());
+        assert.equal(second.toXML(), parsed.toXML());
+        assert.equal(second.width, 256);
+
+        // a copy is independent of the template and of other copies
+        second.clear();
+        var third = new mapnik.Map(256, 256);
+        third.fromStringSync(xml, {base: './test/', cache: true});
+        assert.equal(third.layers().length, 1);
+
+        // loading into a map with layers still merges
+        third.fromStringSync(xml, {base: './test/', cache: true});
+        assert.equal(third.layers().length, 2);
+
+        var loaded = new mapnik.Map(256, 256);
+        loaded.loadSync('./test/stylesheet.xml', {cache: true});
+        var reloaded = new mapnik.Map(256, 256);
+        reloaded.loadSync('./test/stylesheet.xml', {cache: true});
+        assert.equal(reloaded.toXML(), loaded.toXML());
+
+        // settings made before loading stay with their map
+        mapnik.clearCache();
+        var buffered = new mapnik.Map(256, 256);
+        buffered.bufferSize = 64;
+        buffered.fromStringSync(xml, {base: './test/', cache: true});
+        assert.equal(buffered.bufferSize, 64);
+        var plain = new mapnik.Map(256, 256);
+        plain.fromStringSync(xml, {base: './test/', cache: true});
+        assert.equal(plain.bufferSize, 0);
+        assert.equal(plain.toXML(), parsed.toXML());
+
+        var async = new mapnik.Map(256, 256);
+        async.fromString(xml, {base: './test/', cache: true}, function(err, map) {
+            if (err) throw err;
+            assert.equal(map.toXML(), parsed.toXML());
+            mapnik.clearCache();
+            done();
+        });
+    });
+
     it('cloned map should be safely independent of other maps', function() {
         var map2;
 
@@ -0,0 +1,68 @@
+"use strict";
+
+var mapnik = require('../');
+var assert = require('assert');
+var path = require('path');
+
+mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
+
+describe('mapnik.MapPool', function() {
+    it('should throw with invalid usage', function() {
+        assert.throws(function() { mapnik.MapPool(); });
+        assert.throws(function() { new mapnik.MapPool(); });
+        assert.throws(function() { new mapnik.MapPool({}); });
+        var map = new mapnik.Map(256, 256);
+        assert.throws(function() { new mapnik.MapPool(map, null); });
+        assert.throws(function() { new mapnik.MapPool(map, {size:0}); });
+        assert.throws(function() { new mapnik.MapPool(map, {size:'4'}); });
+        var pool = new mapnik.MapPool(map, {size:1});
+        assert.throws(function() { pool.acquire(); });
+        assert.throws(function() { pool.release(); });
+        assert.throws(function() { pool.release(map); });
+    });
+
+    it('should hand out cloned maps and queue when exhausted', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        var pool = new mapnik.MapPool(map, {size:2});
+        assert.equal(pool.size(), 2);
+        assert.equal(pool.idle(), 2);
+        var acquired = [];
+        pool.acquire(function(err, m) {
+            if (err) throw err;
+            assert.ok(m instanceof mapnik.Map);
+            assert.notStrictEqual(m, map);
+            assert.equal(m.toXML(), map.toXML());
+            acquired.push(m);
+        });
+        pool.acquire(function(err, m) {
+            if (err) throw err;
+            assert.notStrictEqual(m, acquired[0]);
+            acquired.push(m);
+            assert.equal(pool.waiting(), 1);
+            pool.release(acquired[0]);
+            // the waiting callback gets the map on a later turn, not from release
+            assert.equal(pool.waiting(), 0);
+            assert.equal(third, null);
+        });
+        // maps are reserved right away but callbacks never run synchronously
+        assert.equal(pool.idle(), 0);
+        assert.equal(acquired.length, 0);
+        var third = null;
+        pool.acquire(function(err, m) {
+            if (err) throw err;
+            third = m;
+            assert.strictEqual(m, acquired[0]);
+            assert.throws(function() { pool.release(acquired[1]); pool.release(acquired[1]); });
+            var im = new mapnik.Image(m.width, m.height);
+            m.render(im, function(err, im) {
+                if (err) throw err;
+                pool.release(m);
+                assert.equal(pool.idle(), 2);
+                done();
+            });
+        });
+        assert.equal(pool.waiting(), 1);
+    });
+});
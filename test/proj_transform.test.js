@@ -53,6 +53,25 @@ describe('mapnik.ProjTransform ', function() {
         assert.notStrictEqual(long_lat_coords,trans.backward(merc));
     });
 
+    it('should transform Float64Arrays of coordinates (4326 -> 3857)', function(done) {
+        var from = new mapnik.Projection('+init=epsg:4326');
+        var to = new mapnik.Projection('+init=epsg:3857');
+        var trans = new mapnik.ProjTransform(from,to);
+        assert.throws(function() { trans.forwardMany({}); });
+        var coords = new Float64Array([-122.33517, 47.63752, 139.6, 35.7]);
+        var merc = trans.forwardMany(new Float64Array(coords));
+        var single = trans.forward([coords[2], coords[3]]);
+        assert.equal(merc[2], single[0]);
+        assert.equal(merc[3], single[1]);
+        trans.backwardMany(merc, new Float64Array(merc.length), function(err, result) {
+            if (err) throw err;
+            for (var i = 0; i < coords.length; ++i) {
+                assert.ok(Math.abs(result[i] - coords[i]) < 1e-6);
+            }
+            done();
+        });
+    });
+
 /*
     it('should throw with invalid coords (4326 -> 3857)', function() {
         var from = new mapnik.Projection('+init=epsg:4326');
@@ -45,5 +45,50 @@ describe('mapnik.Projection ', function() {
         assert.notStrictEqual(merc_bounds, expected);
         assert.notStrictEqual(long_lat_bounds, merc.inverse(merc.forward(long_lat_bounds)));
     });
-});
 
+    it('should transform Float64Arrays of coordinates', function(done) {
+        var merc = new mapnik.Projection('+init=epsg:3857');
+        assert.throws(function() { merc.forwardMany([1,2]); });
+        assert.throws(function() { merc.forwardMany(new Float64Array(3)); });
+        assert.throws(function() { merc.forwardMany(new Float64Array(4), new Float64Array(2)); });
+        var coords = new Float64Array([-122.33517, 47.63752, 0, 0, 10, -20]);
+        var out = new Float64Array(coords.length);
+        assert.strictEqual(merc.forwardMany(coords, out), out);
+        // the input is untouched when an output array is passed
+        assert.equal(coords[0], -122.33517);
+        for (var i = 0; i < coords.length; i += 2) {
+            var single = merc.forward([coords[i], coords[i+1]]);
+            assert.equal(out[i], single[0]);
+            assert.equal(out[i+1], single[1]);
+        }
+        merc.inverseMany(out, function(err, result) {
+            if (err) throw err;
+            // transformed in place
+            assert.strictEqual(result, out);
+            for (var i = 0; i < coords.length; ++i) {
+                assert.ok(Math.abs(out[i] - coords[i]) < 1e-6);
+            }
+            done();
+        });
+    });
+
+    it('should transform concurrently with one Projection', function(done) {
+        var utm = new mapnik.Projection('+proj=utm +zone=33 +datum=WGS84 +units=m +no_defs');
+        var coords = [];
+        for (var i = 0; i < 1000; ++i) {
+            coords.push(12 + i / 1000, 45 + i / 1000);
+        }
+        var expected = utm.forwardMany(new Float64Array(coords));
+        var remaining = 8;
+        function run() {
+            utm.forwardMany(new Float64Array(coords), function(err, result) {
+                if (err) throw err;
+                for (var i = 0; i < result.length; ++i) {
+                    assert.equal(result[i], expected[i]);
+                }
+                if (!--remaining) done();
+            });
+        }
+        for (var j = 0; j < 8; ++j) run();
+    });
+});
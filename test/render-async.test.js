@@ -34,4 +34,212 @@ describe('mapnik async rendering', function() {
             });
         });
     });
+
+    it('should render a metatile and split it into encoded tiles', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            assert.throws(function() { map.renderMetatile(1, 0, 0); });
+            assert.throws(function() { map.renderMetatile(1, 2, 0, function() {}); });
+            assert.throws(function() { map.renderMetatile(1, 0, 0, {metatile:0}, function() {}); });
+            map.renderMetatile(1, 1, 1, {metatile:4, format:'png32'}, function(err, tiles) {
+                if (err) throw err;
+                // metatile is clamped to the 2x2 grid at z1
+                assert.equal(tiles.length, 4);
+                tiles.forEach(function(buffer) {
+                    var im = mapnik.Image.fromBytesSync(buffer);
+                    assert.equal(im.width(), 256);
+                    assert.equal(im.height(), 256);
+                });
+                done();
+            });
+        });
+    });
+
+    it('should render straight to an encoded buffer', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            map.zoomAll();
+            assert.throws(function() { map.render('png', {palette:{}}, function() {}); });
+            assert.throws(function() { map.render('png', {format:1}, function() {}); });
+            assert.throws(function() { map.render('png', {format:'png32'}, function() {}); });
+            var expected = map.renderSync('png32');
+            map.render('png32', {format:'png32'}, function(err, buffer) {
+                if (err) throw err;
+                assert.ok(buffer instanceof Buffer);
+                assert.equal(buffer.length, expected.length);
+                var im = mapnik.Image.fromBytesSync(buffer);
+                assert.equal(im.width(), 256);
+                assert.equal(im.height(), 256);
+                done();
+            });
+        });
+    });
+
+    it('should skip rasterizing tiles without features', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            assert.throws(function() { map.render('png', {skipEmpty:1}, function() {}); });
+            // open ocean in the south atlantic
+            map.zoomToBox([-2326390,-5721521,-2126390,-5521521]);
+            var expected = map.renderSync('png');
+            map.render('png', {skipEmpty:true}, function(err, buffer) {
+                if (err) throw err;
+                assert.equal(buffer.length, expected.length);
+                var im = new mapnik.Image(256, 256);
+                map.render(im, {skipEmpty:true}, function(err, im) {
+                    if (err) throw err;
+                    var steelblue = new mapnik.Color('steelblue').toString();
+                    assert.equal(im.getPixel(0, 0).toString(), steelblue);
+                    assert.equal(im.getPixel(128, 128).toString(), steelblue);
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should not skip tiles whose features only match a filter', function(done) {
+        var xml = '<Map srs="+init=epsg:3857" background-color="steelblue">' +
+                  '<Style name="brazil"><Rule><Filter>[NAME]=\'Brazil\'</Filter>' +
+                  '<PolygonSymbolizer fill="red"/>' +
+                  '</Rule></Style>' +
+                  '<Layer name="world" srs="+init=epsg:3857"><StyleName>brazil</StyleName>' +
+                  '<Datasource><Parameter name="type">shape</Parameter>' +
+                  '<Parameter name="file">data/world_merc.shp</Parameter></Datasource></Layer>' +
+                  '</Map>';
+        var map = new mapnik.Map(256, 256);
+        map.fromStringSync(xml, {strict:true, base:path.resolve(__dirname)});
+        // inland brazil
+        map.zoomToBox([-6000000,-1500000,-5500000,-1000000]);
+        var expected = map.renderSync('png');
+        map.render(new mapnik.Image(256, 256), {skipEmpty:true}, function(err, im) {
+            if (err) throw err;
+            assert.equal(im.getPixel(128, 128).toString(), new mapnik.Color('red').toString());
+            map.render('png', {skipEmpty:true}, function(err, buffer) {
+                if (err) throw err;
+                assert.equal(buffer.toString('hex'), expected.toString('hex'));
+                done();
+            });
+        });
+    });
+
+    it('should render many extents in one call', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            assert.throws(function() { map.renderMany({}, function() {}); });
+            assert.throws(function() { map.renderMany([{}], function() {}); });
+            assert.throws(function() { map.renderMany([{bbox:[0,0,1]}], function() {}); });
+            assert.throws(function() { map.renderMany([{z:1, x:2, y:0}], function() {}); });
+            assert.throws(function() { map.renderMany([{z:0, x:0, y:0}], {concurrency:0}, function() {}); });
+            map.zoomAll();
+            var entries = [
+                {z:0, x:0, y:0},
+                {bbox:map.extent, format:'jpeg'},
+                {z:1, x:1, y:0, format:'png32'}
+            ];
+            map.renderMany(entries, {concurrency:2}, function(err, buffers) {
+                if (err) throw err;
+                assert.equal(buffers.length, 3);
+                buffers.forEach(function(buffer) {
+                    var im = mapnik.Image.fromBytesSync(buffer);
+                    assert.equal(im.width(), 256);
+                    assert.equal(im.height(), 256);
+                });
+                // jpeg magic number
+                assert.equal(buffers[1][0], 0xFF);
+                assert.equal(buffers[1][1], 0xD8);
+                done();
+            });
+        });
+    });
+
+    it('should not render many with clones of an older map', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            var entries = [{z:0, x:0, y:0, format:'png32'}, {z:0, x:0, y:0, format:'png32'}];
+            map.renderMany(entries, {concurrency:2}, function(err, before) {
+                if (err) throw err;
+                assert.equal(before[0].toString('hex'), before[1].toString('hex'));
+                // the clones kept from the first call are dropped
+                map.background = new mapnik.Color('red');
+                map.renderMany(entries, {concurrency:2}, function(err, after) {
+                    if (err) throw err;
+                    assert.equal(after[0].toString('hex'), after[1].toString('hex'));
+                    assert.notEqual(after[0].toString('hex'), before[0].toString('hex'));
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should reuse features from the feature cache', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.load('./test/stylesheet.xml', function(err,map) {
+            if (err) throw err;
+            assert.throws(function() { map.setFeatureCache(true); });
+            assert.throws(function() { map.setFeatureCache({max_size:0}); });
+            assert.equal(map.featureCacheStats(), null);
+            map.zoomAll();
+            var expected = map.renderSync('png32');
+            map.setFeatureCache({cell_size:512});
+            map.render('png32', function(err, first) {
+                if (err) throw err;
+                map.render('png32', function(err, second) {
+                    if (err) throw err;
+                    // same features in the same order as without the cache
+                    assert.equal(first.toString('hex'), expected.toString('hex'));
+                    assert.equal(second.toString('hex'), expected.toString('hex'));
+                    var stats = map.featureCacheStats();
+                    // one entry per cell, all missed once then hit once
+                    assert.ok(stats.entries > 0);
+                    assert.equal(stats.misses, stats.entries);
+                    assert.equal(stats.hits, stats.entries);
+                    assert.ok(stats.size > 0);
+                    map.setFeatureCache(false);
+                    assert.equal(map.featureCacheStats(), null);
+                    done();
+                });
+            });
+        });
+    });
+
+    it('should share feature cache cells between adjacent tiles', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        // the buffered bbox of each tile crosses cell edges
+        map.bufferSize = 64;
+        var w = 10018754.171394622;
+        var tiles = [[-w, 0, 0, w], [0, 0, w, w]];
+        var expected = [];
+        function render(i, callback) {
+            map.zoomToBox(tiles[i]);
+            map.render(new mapnik.Image(256, 256), {stats:true}, function(err, im, stats) {
+                if (err) throw err;
+                callback(stats.layers[0].features_read);
+            });
+        }
+        render(0, function(read0) {
+            render(1, function(read1) {
+                expected = [read0, read1];
+                map.setFeatureCache({cell_size:256});
+                render(0, function(cached0) {
+                    assert.equal(cached0, expected[0]);
+                    var first = map.featureCacheStats();
+                    assert.equal(first.hits, 0);
+                    render(1, function(cached1) {
+                        // no feature is read twice from overlapping cells
+                        assert.equal(cached1, expected[1]);
+                        var second = map.featureCacheStats();
+                        assert.ok(second.hits > 0);
+                        assert.ok(second.entries < 2 * first.entries);
+                        done();
+                    });
+                });
+            });
+        });
+    });
 });
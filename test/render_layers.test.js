@@ -0,0 +1,72 @@
+"use strict";
+
+var mapnik = require('../');
+var assert = require('assert');
+var path = require('path');
+
+mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
+
+var merc = '+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over';
+
+function layer(name, style) {
+    return '<Layer name="' + name + '" srs="' + merc + '">' +
+           '<StyleName>' + style + '</StyleName>' +
+           '<Datasource>' +
+           '<Parameter name="file">data/world_merc.shp</Parameter>' +
+           '<Parameter name="type">shape</Parameter>' +
+           '</Datasource></Layer>';
+}
+
+var xml = '<Map srs="' + merc + '" background-color="steelblue">' +
+          '<Style name="fill"><Rule><PolygonSymbolizer fill="white"/></Rule></Style>' +
+          '<Style name="line"><Rule><LineSymbolizer stroke="red" stroke-width="2"/></Rule></Style>' +
+          layer('fill', 'fill') +
+          layer('line', 'line') +
+          '</Map>';
+
+function load() {
+    var map = new mapnik.Map(256, 256);
+    map.fromStringSync(xml, {strict: true, base: './test/'});
+    map.zoomAll();
+    return map;
+}
+
+function names(stats) {
+    return stats.layers.map(function(l) { return l.name; });
+}
+
+describe('rendering a subset of layers', function() {
+    it('should throw with invalid usage', function() {
+        var map = load();
+        var im = new mapnik.Image(256, 256);
+        assert.throws(function() { map.render(im, {layers:'fill'}, function() {}); });
+        assert.throws(function() { map.render(im, {layers:['missing']}, function() {}); });
+        assert.throws(function() { map.render(im, {layers:[2]}, function() {}); });
+        assert.throws(function() { map.render(im, {layers:[{}]}, function() {}); });
+        assert.throws(function() { map.renderSync('png', {layers:[-1]}); });
+        assert.throws(function() { map.renderFile('/tmp/x.svg', {layers:['fill']}, function() {}); });
+    });
+
+    it('should only render the named layers', function(done) {
+        var map = load();
+        map.render(new mapnik.Image(256, 256), {layers:['line'], stats:true}, function(err, im, stats) {
+            if (err) throw err;
+            assert.deepEqual(names(stats), ['line']);
+            map.render('png', {layers:[1, 0], stats:true}, function(err, buffer, stats) {
+                if (err) throw err;
+                // layers are drawn in map order whatever order they are named in
+                assert.deepEqual(names(stats), ['fill', 'line']);
+                assert.equal(buffer.length, map.renderSync('png').length);
+                done();
+            });
+        });
+    });
+
+    it('should render only the background without layers', function() {
+        var map = load();
+        var im = mapnik.Image.fromBytesSync(map.renderSync('png', {layers:[]}));
+        var steelblue = new mapnik.Color('steelblue').toString();
+        assert.equal(im.getPixel(0, 0).toString(), steelblue);
+        assert.equal(im.getPixel(128, 128).toString(), steelblue);
+    });
+});
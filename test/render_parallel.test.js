@@ -0,0 +1,101 @@
+"use strict";
+
+var mapnik = require('../');
+var assert = require('assert');
+var path = require('path');
+
+mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
+
+var merc = '+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs +over';
+
+function layer(name, style) {
+    return '<Layer name="' + name + '" srs="' + merc + '">' +
+           '<StyleName>' + style + '</StyleName>' +
+           '<Datasource>' +
+           '<Parameter name="file">data/world_merc.shp</Parameter>' +
+           '<Parameter name="type">shape</Parameter>' +
+           '</Datasource></Layer>';
+}
+
+var xml = '<Map srs="' + merc + '" background-color="steelblue">' +
+          '<Style name="fill"><Rule><PolygonSymbolizer fill="white" clip="false"/></Rule></Style>' +
+          '<Style name="line"><Rule><LineSymbolizer stroke="red" stroke-width="2"/></Rule></Style>' +
+          layer('fill-a', 'fill') +
+          layer('line-a', 'line') +
+          layer('fill-b', 'fill') +
+          '</Map>';
+
+function load() {
+    var map = new mapnik.Map(256, 256);
+    map.fromStringSync(xml, {strict: true, base: './test/'});
+    map.zoomAll();
+    return map;
+}
+
+describe('parallel rendering', function() {
+    it('should throw with invalid usage', function() {
+        var map = load();
+        var im = new mapnik.Image(256, 256);
+        assert.throws(function() { map.render(im, {parallel:1}, function() {}); });
+        assert.throws(function() { map.render(im, {parallel:['fill-a']}, function() {}); });
+        assert.throws(function() { map.render(im, {parallel:[['missing']]}, function() {}); });
+        assert.throws(function() { map.render(im, {parallel:[['fill-a'],['fill-a']]}, function() {}); });
+        // a group may not wrap around another group's layer
+        assert.throws(function() { map.render(im, {parallel:[['fill-a','fill-b'],['line-a']]}, function() {}); });
+    });
+
+    it('should match a sequential render', function(done) {
+        var map = load();
+        map.render(new mapnik.Image(256, 256), function(err, expected) {
+            if (err) throw err;
+            map.render(new mapnik.Image(256, 256), {parallel:true}, function(err, actual) {
+                if (err) throw err;
+                assert.ok(actual.painted());
+                assert.ok(expected.compare(actual, {threshold:2}) < 256 * 256 / 100);
+                done();
+            });
+        });
+    });
+
+    it('should render explicit groups to a buffer with stats', function(done) {
+        var map = load();
+        map.render('png', {parallel:[['fill-a','line-a']], stats:true}, function(err, buffer, stats) {
+            if (err) throw err;
+            assert.ok(buffer.length > 0);
+            // stats stay in map order across groups
+            assert.deepEqual(stats.layers.map(function(l) { return l.name; }), ['fill-a', 'line-a', 'fill-b']);
+            done();
+        });
+    });
+
+    it('should honour cancellation', function(done) {
+        var map = load();
+        var token = new mapnik.CancelToken();
+        token.cancel();
+        map.render(new mapnik.Image(256, 256), {parallel:true, cancel:token}, function(err) {
+            assert.ok(err);
+            assert.equal(err.message, 'render cancelled');
+            done();
+        });
+    });
+
+    it('should render groups on the worker pool', function(done) {
+        mapnik.setThreadPool({size:2});
+        var map = load();
+        map.render(new mapnik.Image(256, 256), {parallel:true}, function(err, expected) {
+            if (err) throw err;
+            // more concurrent renders than pool threads must not deadlock
+            var remaining = 4;
+            for (var i = 0; i < 4; ++i) {
+                map.clone().render(new mapnik.Image(256, 256), {parallel:true}, function(err, actual) {
+                    if (err) throw err;
+                    assert.equal(expected.compare(actual), 0);
+                    if (--remaining === 0) {
+                        mapnik.setThreadPool({size:0});
+                        done();
+                    }
+                });
+            }
+        });
+    });
+});
@@ -0,0 +1,126 @@
+"use strict";
+
+var mapnik = require('../');
+var assert = require('assert');
+var fs = require('fs');
+var path = require('path');
+
+mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
+
+function check_stats(stats) {
+    assert.equal(stats.layers.length, 1);
+    var layer = stats.layers[0];
+    assert.equal(layer.name, 'world');
+    assert.ok(layer.time >= 0);
+    assert.ok(layer.features_read > 0);
+    assert.ok(layer.features_drawn > 0);
+    assert.ok(layer.features_drawn <= layer.features_read);
+    assert.ok(stats.render_time >= layer.time);
+}
+
+describe('render stats', function() {
+    it('should throw with invalid usage', function() {
+        var map = new mapnik.Map(256, 256);
+        assert.throws(function() { map.render(new mapnik.Image(256, 256), {stats:1}, function() {}); });
+        assert.throws(function() { map.renderFile('/tmp/x.png', {stats:'yes'}, function() {}); });
+    });
+
+    it('should not pass stats unless asked', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        map.render(new mapnik.Image(256, 256), function(err, im, stats) {
+            if (err) throw err;
+            assert.ok(im);
+            assert.equal(stats, undefined);
+            done();
+        });
+    });
+
+    it('should report stats for an image render', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        map.render(new mapnik.Image(256, 256), {stats:true}, function(err, im, stats) {
+            if (err) throw err;
+            assert.ok(im);
+            check_stats(stats);
+            assert.equal(stats.encode_time, 0);
+            done();
+        });
+    });
+
+    it('should report encode time for a buffer render', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        map.render('png', {stats:true}, function(err, buffer, stats) {
+            if (err) throw err;
+            assert.ok(buffer.length > 0);
+            check_stats(stats);
+            assert.ok(stats.encode_time >= 0);
+            done();
+        });
+    });
+
+    it('should report stats for renderFile', function(done) {
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        var filename = './test/tmp/renderFile-stats.png';
+        map.renderFile(filename, {stats:true}, function(err, unused, stats) {
+            if (err) throw err;
+            assert.ok(fs.existsSync(filename));
+            check_stats(stats);
+            done();
+        });
+    });
+
+    it('should not change a buffered render', function(done) {
+        // markers of countries in the buffer reach into the image, so they
+        // are only drawn if the layer is queried with the map's buffer
+        var xml = '<Map srs="+init=epsg:3857" buffer-size="128">' +
+                  '<Style name="markers"><Rule>' +
+                  '<MarkersSymbolizer width="60" height="60" placement="point" allow-overlap="true"/>' +
+                  '</Rule></Style>' +
+                  '<Layer name="world" srs="+init=epsg:3857"><StyleName>markers</StyleName>' +
+                  '<Datasource><Parameter name="type">shape</Parameter>' +
+                  '<Parameter name="file">data/world_merc.shp</Parameter></Datasource></Layer>' +
+                  '</Map>';
+        var map = new mapnik.Map(256, 256);
+        map.fromStringSync(xml, {strict:true, base:path.resolve(__dirname)});
+        assert.equal(map.bufferSize, 128);
+        map.zoomToBox([-1000000,4000000,3000000,8000000]);
+        map.render(new mapnik.Image(256, 256), function(err, plain) {
+            if (err) throw err;
+            map.render(new mapnik.Image(256, 256), {stats:true}, function(err, im, stats) {
+                if (err) throw err;
+                assert.ok(stats.layers[0].features_read > 0);
+                assert.equal(im.compare(plain), 0);
+                assert.equal(im.encodeSync('png').toString('hex'), plain.encodeSync('png').toString('hex'));
+                done();
+            });
+        });
+    });
+
+    it('should count features drawn by also-filter rules', function(done) {
+        var xml = '<Map srs="+init=epsg:3857">' +
+                  '<Style name="also"><Rule><AlsoFilter/>' +
+                  '<PolygonSymbolizer fill="white"/>' +
+                  '</Rule></Style>' +
+                  '<Layer name="world" srs="+init=epsg:3857"><StyleName>also</StyleName>' +
+                  '<Datasource><Parameter name="type">shape</Parameter>' +
+                  '<Parameter name="file">data/world_merc.shp</Parameter></Datasource></Layer>' +
+                  '</Map>';
+        var map = new mapnik.Map(256, 256);
+        map.fromStringSync(xml, {strict:true, base:path.resolve(__dirname)});
+        map.zoomAll();
+        map.render(new mapnik.Image(256, 256), {stats:true}, function(err, im, stats) {
+            if (err) throw err;
+            assert.equal(stats.layers.length, 1);
+            assert.ok(stats.layers[0].features_drawn > 0);
+            assert.equal(stats.layers[0].features_drawn, stats.layers[0].features_read);
+            done();
+        });
+    });
+});
@@ -0,0 +1,59 @@
+"use strict";
+
+var mapnik = require('../');
+var assert = require('assert');
+var fs = require('fs');
+var path = require('path');
+
+mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'shape.input'));
+
+describe('mapnik.setThreadPool', function() {
+    after(function() {
+        mapnik.setThreadPool({size:0});
+    });
+
+    it('should throw with invalid usage', function() {
+        assert.throws(function() { mapnik.setThreadPool(); });
+        assert.throws(function() { mapnik.setThreadPool({}); });
+        assert.throws(function() { mapnik.setThreadPool({size:-1}); });
+        assert.throws(function() { mapnik.setThreadPool({size:'2'}); });
+    });
+
+    it('should render, encode and blend on the worker pool', function(done) {
+        mapnik.setThreadPool({size:2});
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.zoomAll();
+        var remaining = 4;
+        var finish = function() {
+            if (--remaining === 0) {
+                // shrinking the pool lets queued work finish first
+                mapnik.setThreadPool({size:1});
+                map.render('png', function(err, buffer) {
+                    if (err) throw err;
+                    assert.ok(buffer.length > 0);
+                    done();
+                });
+            }
+        };
+        for (var i = 0; i < 3; ++i) {
+            map.clone().render(new mapnik.Image(256, 256), function(err, im) {
+                if (err) throw err;
+                im.encode('png', function(err, buffer) {
+                    if (err) throw err;
+                    assert.ok(buffer.length > 0);
+                    finish();
+                });
+            });
+        }
+        var images = [
+            fs.readFileSync('test/blend-fixtures/1.png'),
+            fs.readFileSync('test/blend-fixtures/2.png')
+        ];
+        mapnik.blend(images, function(err, result) {
+            if (err) throw err;
+            assert.ok(result.length > 0);
+            finish();
+        });
+    });
+});
@@ -199,6 +199,32 @@ describe('mapnik.VectorTile.composite', function() {
         });
     });
 
+    it('should composite asynchronously with the same result', function(done) {
+        var vtiles = [get_tile_at('lines',[0,0,0]),get_tile_at('points',[1,1,1]),get_tile_at('lines',[2,1,1])];
+        var expected = new mapnik.VectorTile(2,1,1);
+        expected.composite(vtiles,{buffer_size:1});
+        var vtile = new mapnik.VectorTile(2,1,1);
+        assert.throws(function() { vtile.composite(vtiles,'',function() {}); });
+        vtile.composite(vtiles,{buffer_size:1},function(err,result) {
+            if (err) throw err;
+            assert.equal(result,vtile);
+            assert.deepEqual(vtile.names(),['lines','points','lines']);
+            assert.equal(vtile.getData().toString('hex'),expected.getData().toString('hex'));
+            done();
+        });
+    });
+
+    it('should re-render unparsed tiles the same as parsed ones', function() {
+        var raw = [get_tile_at('lines',[0,0,0]),get_tile_at('points',[1,1,1])];
+        var parsed = [get_tile_at('lines',[0,0,0]),get_tile_at('points',[1,1,1])];
+        parsed.forEach(function(vt) { vt.parse(); });
+        var vtile = new mapnik.VectorTile(2,1,1);
+        vtile.composite(raw,{buffer_size:1});
+        var expected = new mapnik.VectorTile(2,1,1);
+        expected.composite(parsed,{buffer_size:1});
+        assert.equal(vtile.getData().toString('hex'),expected.getData().toString('hex'));
+    });
+
     it('should render with custom buffer_size', function(done) {
         var vtile = new mapnik.VectorTile(2,1,1);
         var vtiles = [get_tile_at('lines',[0,0,0]),get_tile_at('points',[1,1,1])];
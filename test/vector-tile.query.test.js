@@ -69,6 +69,22 @@ describe('mapnik.VectorTile query polygon', function() {
             assert.equal(features[0].layer,'world');
         }
     });
+    it('query reuses the layer index', function(done) {
+        var data = fs.readFileSync(path.resolve(__dirname + "/data/vector_tile/tile3.vector.pbf"));
+        var unparsed = new mapnik.VectorTile(5,28,12);
+        unparsed.setData(data);
+        var first = unparsed.query(139.6142578125,37.17782559332976,{tolerance:0});
+        var second = unparsed.query(139.6142578125,37.17782559332976,{tolerance:0});
+        assert.equal(first.length,1);
+        assert.equal(second.length,1);
+        assert.equal(first[0].id(),second[0].id());
+        assert.equal(first[0].toJSON(),second[0].toJSON());
+        assert.equal(first[0].toJSON(),vtile.query(139.6142578125,37.17782559332976,{tolerance:0})[0].toJSON());
+        // replacing the data drops the index
+        unparsed.clear();
+        assert.equal(unparsed.query(139.6142578125,37.17782559332976,{tolerance:0}).length,0);
+        done();
+    });
 });
 
 describe('mapnik.VectorTile query polygon (clipped)', function() {
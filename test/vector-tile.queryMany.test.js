@@ -96,6 +96,21 @@ describe('mapnik.VectorTile queryMany', function() {
         run();
     });
 
+    it('vtile.queryMany with all_points:false only measures features within tolerance of each point', function() {
+        var vtile = new mapnik.VectorTile(0,0,0);
+        vtile.addGeoJSON(JSON.stringify(geojson),"layer-name");
+        var manyResults = vtile.queryMany([[0,0],[-40,-40]],{tolerance:1000,fields:['name'],layer:'layer-name',all_points:false});
+        assert.equal(manyResults.hits.length, 2);
+        assert.equal(manyResults.hits[0].length, 1);
+        assert.equal(Math.round(manyResults.hits[0][0].distance), 0);
+        assert.equal(manyResults.features[manyResults.hits[0][0].feature_id].attributes().name, 'A');
+        assert.equal(manyResults.hits[1].length, 1);
+        assert.equal(Math.round(manyResults.hits[1][0].distance), 514);
+        assert.equal(manyResults.features[manyResults.hits[1][0].feature_id].attributes().name, 'B');
+        assert.equal(manyResults.features.length, 2);
+        assert.throws(function() { vtile.queryMany([[0,0]],{layer:'layer-name',all_points:1}); });
+    });
+
     // Done outside of test so mocha doesn't time the vt load/parse.
     var profile = new mapnik.VectorTile(0,0,0);
     profile.setData(fs.readFileSync(path.join(__dirname, 'data', 'vector_tile', 'tile0.vector.pbf')));
@@ -152,6 +167,59 @@ describe('mapnik.VectorTile queryMany', function() {
         run();
     });
 
+    it('vtile.queryMany matches vtile.query for a grid of points', function() {
+        var points = [];
+        for (var lon = -170; lon < 180; lon += 10) {
+            for (var lat = -80; lat < 85; lat += 10) {
+                points.push([lon, lat]);
+            }
+        }
+        var manyResults = profile.queryMany(points, {tolerance:0, layer:'world', all_points:false});
+        assert.equal(manyResults.hits.length <= points.length, true);
+        points.forEach(function(pt, p) {
+            var single = profile.query(pt[0], pt[1], {tolerance:0, layer:'world'});
+            var hits = manyResults.hits[p] || [];
+            assert.equal(hits.length, single.length);
+            var ids = hits.map(function(hit) { return manyResults.features[hit.feature_id].id(); });
+            assert.deepEqual(ids.sort(), single.map(function(f) { return f.id(); }).sort());
+        });
+    });
+
+    it('vtile.queryMany clamps points beyond the mercator limits', function() {
+        var vtile = new mapnik.VectorTile(0,0,0);
+        vtile.addGeoJSON(JSON.stringify({
+            "type": "FeatureCollection",
+            "features": [{
+                "type": "Feature",
+                "geometry": { "type": "Point", "coordinates": [10,80] },
+                "properties": { "name": "P" }
+            }]
+        }),"points");
+        function merc(lon, lat) {
+            var max_extent = 20037508.342789244;
+            return [lon * max_extent / 180,
+                    Math.log(Math.tan((90 + lat) * Math.PI / 360)) * max_extent / Math.PI];
+        }
+        var feature = merc(10,80);
+        // the query points land on the top and bottom right edges of the world
+        var expected = [merc(10,85.0511287798066), merc(180,-85.0511287798066)].map(function(pt) {
+            return Math.sqrt(Math.pow(pt[0] - feature[0], 2) + Math.pow(pt[1] - feature[1], 2));
+        });
+        function check_clamped(manyResults) {
+            assert.equal(manyResults.hits.length, 2);
+            assert.equal(manyResults.features.length, 1);
+            expected.forEach(function(distance, p) {
+                assert.equal(manyResults.hits[p].length, 1);
+                // vertices are stored at about 10km precision at z0
+                assert.ok(Math.abs(manyResults.hits[p][0].distance - distance) < 10000);
+            });
+        }
+        var query = [[10,89.99],[190,-89.99]];
+        check_clamped(vtile.queryMany(query, {tolerance:0, layer:'points'}));
+        mapnik.clearCache();
+        check_clamped(vtile.queryMany(query, {tolerance:0, layer:'points'}));
+    });
+
     function check(manyResults) {
         assert.equal(Array.isArray(manyResults.hits), true);
         assert.equal(manyResults.hits.length, 3);
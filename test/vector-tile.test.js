@@ -100,6 +100,47 @@ describe('mapnik.VectorTile ', function() {
         });
     });
 
+    it('should be able to create a vector tile from geojson (async)', function(done) {
+        var geojson = {
+          "type": "FeatureCollection",
+          "features": [
+            {
+              "type": "Feature",
+              "geometry": {
+                "type": "Point",
+                "coordinates": [-122, 48]
+              },
+              "properties": {
+                "name": "geojson data"
+              }
+            }
+          ]
+        };
+        var expected = new mapnik.VectorTile(0,0,0);
+        expected.addGeoJSON(JSON.stringify(geojson),"layer-name");
+        var vtile = new mapnik.VectorTile(0,0,0);
+        vtile.addGeoJSON(JSON.stringify(geojson),"layer-name",{},function(err) {
+            if (err) throw err;
+            assert.equal(vtile.getData().toString('hex'),expected.getData().toString('hex'));
+            assert.deepEqual(vtile.names(),["layer-name"]);
+            var decoded = JSON.parse(vtile.toGeoJSON(0));
+            assert.equal(decoded.features.length,1);
+            assert.equal(decoded.features[0].properties.name,"geojson data");
+            assert.equal(Math.round(decoded.features[0].geometry.coordinates[0]),-122);
+            assert.equal(Math.round(decoded.features[0].geometry.coordinates[1]),48);
+            // a bare geometry is added as a single feature
+            var vtile2 = new mapnik.VectorTile(0,0,0);
+            vtile2.addGeoJSON(JSON.stringify(geojson.features[0].geometry),"geometry",function(err) {
+                if (err) throw err;
+                assert.equal(JSON.parse(vtile2.toGeoJSON(0)).features.length,1);
+                vtile2.addGeoJSON('{"type":"FeatureCollection","features":[',"broken",function(err) {
+                    assert.ok(err);
+                    done();
+                });
+            });
+        });
+    });
+
     it('should be able to create a vector tile from multiple geojson files', function(done) {
         mapnik.register_datasource(path.join(mapnik.settings.paths.input_plugins,'ogr.input'));
         var vtile = new mapnik.VectorTile(0,0,0);
@@ -250,6 +291,78 @@ describe('mapnik.VectorTile ', function() {
         });
     });
 
+    it('should copy raw data in getData', function(done) {
+        var data = fs.readFileSync("./test/data/vector_tile/tile1.vector.pbf");
+        var vtile = new mapnik.VectorTile(9,112,195);
+        vtile.setData(data);
+        var copy = vtile.getData();
+        assert.notStrictEqual(copy, data);
+        assert.equal(copy.toString('hex'), data.toString('hex'));
+        // writing to the returned Buffer leaves the tile alone
+        copy.fill(0);
+        assert.equal(vtile.getData().toString('hex'), data.toString('hex'));
+        assert.deepEqual(vtile.names(), ["world"]);
+        vtile.addData(data);
+        var merged = vtile.getData();
+        assert.equal(merged.length, data.length*2);
+        var vtile2 = new mapnik.VectorTile(9,112,195);
+        var called = false;
+        vtile2.setData(data, function(err) {
+            if (err) throw err;
+            called = true;
+            assert.equal(vtile2.getData().toString('hex'), data.toString('hex'));
+            assert.deepEqual(vtile2.names(), ["world"]);
+            vtile2.setData(new Buffer(0), function(err) {
+                assert.ok(err);
+                done();
+            });
+        });
+        assert.equal(called, false);
+    });
+
+    it('should not change data while async calls read it', function(done) {
+        var data = fs.readFileSync("./test/data/vector_tile/tile1.vector.pbf");
+        var vtile = new mapnik.VectorTile(9,112,195);
+        vtile.setData(data);
+        vtile.query(-100,40,{layer:'world'},function(err) {
+            if (err) throw err;
+            // allowed again once the query is done
+            vtile.addData(data);
+            assert.equal(vtile.getData().length, data.length*2);
+            done();
+        });
+        assert.throws(function() { vtile.addData(data); }, /in use by 1 async operation/);
+        assert.throws(function() { vtile.setData(data); }, /in use by 1 async operation/);
+        assert.throws(function() { vtile.clear(); }, /in use by 1 async operation/);
+        assert.throws(function() {
+            vtile.addGeoJSON(JSON.stringify({type: 'FeatureCollection', features: []}), 'other');
+        }, /in use by 1 async operation/);
+        assert.throws(function() { vtile.composite([new mapnik.VectorTile(9,112,195)]); }, /in use by 1 async operation/);
+        assert.throws(function() { vtile.parse(); }, /in use by 1 async operation/);
+        assert.throws(function() { vtile.parse(function() {}); }, /in use by 1 async operation/);
+        assert.throws(function() { vtile.getData({release:true}); }, /in use by 1 async operation/);
+        assert.equal(vtile.getData().length, data.length);
+    });
+
+    it('should hand over raw data without a copy in getData({release:true})', function() {
+        var data = fs.readFileSync("./test/data/vector_tile/tile1.vector.pbf");
+        var vtile = new mapnik.VectorTile(9,112,195);
+        vtile.setData(data);
+        assert.throws(function() { vtile.getData(true); }, /options object/);
+        assert.throws(function() { vtile.getData({release:1}); }, /must be a boolean/);
+        assert.strictEqual(vtile.getData({release:true}), data);
+        assert.equal(vtile.empty(), true);
+        assert.equal(vtile.getData().length, 0);
+        // bytes owned by the tile move into the returned Buffer
+        vtile.setData(data);
+        vtile.addData(data);
+        var merged = vtile.getData({release:true});
+        assert.equal(merged.length, data.length*2);
+        assert.equal(vtile.empty(), true);
+        assert.equal(merged.slice(0, data.length).toString('hex'), data.toString('hex'));
+        assert.equal(merged.slice(data.length).toString('hex'), data.toString('hex'));
+    });
+
     it('should be able to setData/parse (async)', function(done) {
         var vtile = new mapnik.VectorTile(9,112,195);
         assert.equal(vtile.empty(), true);
@@ -290,6 +403,32 @@ describe('mapnik.VectorTile ', function() {
     });
 
 
+    it('should query, render and export layers without parsing', function(done) {
+        var data = fs.readFileSync('./test/data/vector_tile/tile0.vector.pbf');
+        var parsed = new mapnik.VectorTile(0, 0, 0);
+        parsed.setData(data);
+        parsed.parse();
+        var vtile = new mapnik.VectorTile(0, 0, 0);
+        vtile.setData(data);
+        assert.equal(vtile.toGeoJSON('__all__'), parsed.toGeoJSON('__all__'));
+        assert.equal(vtile.toGeoJSON(0), parsed.toGeoJSON(0));
+        assert.equal(vtile.query(-98, 39).length, parsed.query(-98, 39).length);
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/stylesheet.xml');
+        map.extent = [-20037508.34, -20037508.34, 20037508.34, 20037508.34];
+        vtile.render(map, new mapnik.Image(256, 256), function(err, image) {
+            if (err) throw err;
+            parsed.render(map, new mapnik.Image(256, 256), function(err, expected) {
+                if (err) throw err;
+                assert.equal(image.compare(expected), 0);
+                // layers added after a parse are decoded on demand as well
+                parsed.addData(data);
+                assert.equal(JSON.parse(parsed.toGeoJSON('__array__')).length, 2);
+                done();
+            });
+        });
+    });
+
     it('should be able to get tile info as JSON', function(done) {
         var vtile = new mapnik.VectorTile(9,112,195);
         vtile.setData(new Buffer(_data,"hex"));
@@ -445,6 +584,23 @@ describe('mapnik.VectorTile ', function() {
     });
 
 
+    it('should not change a tile while a map renders into it', function(done) {
+        var vtile = new mapnik.VectorTile(9,112,195);
+        var map = new mapnik.Map(256, 256);
+        map.loadSync('./test/data/vector_tile/layers.xml');
+        map.extent = [-11271098.442818949,4696291.017841229,-11192826.925854929,4774562.534805249];
+        map.render(vtile,{},function(err,vtile) {
+            if (err) throw err;
+            assert.equal(vtile.empty(), false);
+            vtile.clear();
+            done();
+        });
+        assert.throws(function() { vtile.clear(); }, /in use by 1 async operation/);
+        assert.throws(function() {
+            new mapnik.Map(256, 256).render(vtile,{},function() {});
+        }, /render: this tile appears to be in use by 1 async operation/);
+    });
+
     it('should detect as solid a tile with two "box" layers', function(done) {
         var vtile = new mapnik.VectorTile(9,112,195);
         var map = new mapnik.Map(256, 256);